@@ -28,8 +28,16 @@
 
 #include "application/opengl.hpp"
 #include "application/application.hpp"
+#include "raytracer/CycleTimer.hpp"
 #include <iostream>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
 #include <png.h>
+#include <zlib.h>
 #include <cassert>
 
 namespace _462
@@ -57,6 +65,35 @@ static bool _ends_with(const char *s, const char *postfix)
 
 // ***** png related internal functions ***** //
 
+// Reads the info of a png and sets up libpng to give its rows as RGBA, 8
+// bits per channel. Returns false if it can't. Must be called with a jump
+// buffer set, as libpng jumps there on errors.
+static bool _read_png_info_RGBA(png_structp png_ptr, png_infop info_ptr, int *width, int *height)
+{
+    png_read_info(png_ptr, info_ptr);
+    *width = png_get_image_width(png_ptr, info_ptr);
+    *height = png_get_image_height(png_ptr, info_ptr);
+    int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+    png_byte color_type = png_get_color_type(png_ptr, info_ptr);
+
+    // force the image into RGBA, 8 bits per channel
+    if (color_type != PNG_COLOR_TYPE_RGBA)
+        png_set_expand(png_ptr);
+    if (color_type == PNG_COLOR_TYPE_GRAY ||
+            color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(png_ptr);
+    if (bit_depth < 8)
+        png_set_packing(png_ptr);
+    else if (bit_depth == 16)
+        png_set_strip_16(png_ptr);
+    if (color_type != PNG_COLOR_TYPE_RGBA)
+        png_set_filler(png_ptr, 255, PNG_FILLER_AFTER);
+    png_read_update_info(png_ptr, info_ptr);
+
+    // make sure we're actually in rgba mode
+    return (int)png_get_rowbytes(png_ptr, info_ptr) == ((*width) * 4);
+}
+
 static unsigned char* _load_image_RGBA_png(const char *fileName, int *width, int *height)
 {
     // open the file
@@ -110,28 +147,7 @@ static unsigned char* _load_image_RGBA_png(const char *fileName, int *width, int
     png_set_sig_bytes(png_ptr, HEADER_LENGTH);
 
     // read the image info, get some info
-    png_read_info(png_ptr, info_ptr);
-    *width = png_get_image_width(png_ptr, info_ptr);
-    *height = png_get_image_height(png_ptr, info_ptr);
-    int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-    png_byte color_type = png_get_color_type(png_ptr, info_ptr);
-
-    // force the image into RGBA, 8 bits per channel
-    if (color_type != PNG_COLOR_TYPE_RGBA)
-        png_set_expand(png_ptr);
-    if (color_type == PNG_COLOR_TYPE_GRAY ||
-            color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
-        png_set_gray_to_rgb(png_ptr);
-    if (bit_depth < 8)
-        png_set_packing(png_ptr);
-    else if (bit_depth == 16)
-        png_set_strip_16(png_ptr);
-    if (color_type != PNG_COLOR_TYPE_RGBA)
-        png_set_filler(png_ptr, 255, PNG_FILLER_AFTER);
-    png_read_update_info(png_ptr, info_ptr);
-
-    // make sure we're actually in rgba mode
-    if ((int)png_get_rowbytes(png_ptr, info_ptr) != ((*width) * 4))
+    if (!_read_png_info_RGBA(png_ptr, info_ptr, width, height))
     {
         png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
         fclose(fp);
@@ -154,60 +170,437 @@ static unsigned char* _load_image_RGBA_png(const char *fileName, int *width, int
     return buffer;
 }
 
-static bool _save_image_RGBA_png(const char *fileName, unsigned char *buffer,
-                                 int width, int height)
+// ***** png reading a band at a time ***** //
+
+struct ImageioPngReader
 {
-    // open the file
-    FILE *fp = fopen(fileName, "wb");
+    FILE *fp;
+    png_structp png_ptr;
+    png_infop info_ptr;
+    int width, height;
+    // rows read so far, from the top
+    int rows_read;
+};
+
+ImageioPngReader* imageio_png_open(const char *fileName, int *width, int *height)
+{
+    FILE *fp = fopen(fileName, "rb");
     if (!fp)
-        return false;
+        return 0;
 
-    // create the needed data structures
-    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, 0,
-                          0);
-    if (!png_ptr)
-    {
-        fclose(fp);
-        return false;
-    }
-    png_infop info_ptr = png_create_info_struct(png_ptr);
+    const size_t HEADER_LENGTH = 8;
+    png_byte header[HEADER_LENGTH];
+    size_t n = fread(header, 1, HEADER_LENGTH, fp);
+    png_structp png_ptr = 0;
+    if (n == HEADER_LENGTH && !png_sig_cmp(header, 0, HEADER_LENGTH))
+        png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+    png_infop info_ptr = png_ptr ? png_create_info_struct(png_ptr) : 0;
     if (!info_ptr)
     {
+        png_destroy_read_struct(png_ptr ? &png_ptr : 0, (png_infopp) 0, (png_infopp) 0);
         fclose(fp);
-        png_destroy_write_struct(&png_ptr, (png_infopp) 0);
-        return false;
+        return 0;
     }
 
-    // do the setjmp thingy
+    ImageioPngReader *reader = new ImageioPngReader();
+    reader->fp = fp;
+    reader->png_ptr = png_ptr;
+    reader->info_ptr = info_ptr;
+
     if (setjmp(png_jmpbuf(png_ptr)))
     {
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        fclose(fp);
-        return false;
+        imageio_png_close(reader);
+        return 0;
     }
 
-    // set up the io
     png_init_io(png_ptr, fp);
+    png_set_sig_bytes(png_ptr, HEADER_LENGTH);
 
-    // write the header
-    png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB_ALPHA,
-                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-    png_write_info(png_ptr, info_ptr);
-    png_set_flush(png_ptr, 10);
+    // the passes of an interlaced image each cover the whole of it
+    if (!_read_png_info_RGBA(png_ptr, info_ptr, &reader->width, &reader->height) ||
+        png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE)
+    {
+        imageio_png_close(reader);
+        return 0;
+    }
 
-    // write the image
-    png_bytep *row_pointers = new png_bytep[height];
-    for (int y = 0 ; y < height ; y++)
-        row_pointers[y] = (png_byte *) (buffer + (height - 1 - y) * width * 4);
-    png_write_image(png_ptr, row_pointers);
-    png_write_end(png_ptr, info_ptr);
+    *width = reader->width;
+    *height = reader->height;
+    return reader;
+}
+
+bool imageio_png_read_rows(ImageioPngReader *reader, unsigned char *rows, int num_rows)
+{
+    if (num_rows < 0 || reader->rows_read + num_rows > reader->height)
+        return false;
+
+    if (setjmp(png_jmpbuf(reader->png_ptr)))
+        return false;
+
+    for (int i = num_rows - 1; i >= 0; i--)
+    {
+        png_read_row(reader->png_ptr, rows + 4 * (size_t) reader->width * i, 0);
+        reader->rows_read++;
+    }
 
-    // clean up memory, and finish
-    fclose(fp);
-    png_destroy_write_struct(&png_ptr, &info_ptr);
     return true;
 }
 
+void imageio_png_close(ImageioPngReader *reader)
+{
+    png_destroy_read_struct(&reader->png_ptr, &reader->info_ptr, (png_infopp) 0);
+    fclose(reader->fp);
+    delete reader;
+}
+
+// compression of the png images saved, see imageio_set_png_compression
+static int _png_level = 6;
+static int _png_threads = 1;
+
+// strips get at least this many bytes of rows, so the threads are worth
+// starting and the bytes each strip adds to the file don't matter
+static const size_t _PNG_MIN_STRIP_BYTES = 256 * 1024;
+// how far back deflate looks for matches; each strip is primed with this
+// much of the rows before it, so cutting the image costs next to nothing
+static const size_t _PNG_WINDOW = 32768;
+
+static inline int _paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+// Filters the rgba rows y0 to y1 (counted from the top of the band of
+// num_rows rows in buffer, whose last row is its top one) into filtered,
+// each row as its filter type followed by the filtered bytes. above is the
+// row above the band, null at the top of the image. Each row gets the
+// filter that leaves the smallest sum of bytes taken as signed, the
+// heuristic libpng uses.
+static void _filter_png_rows(const unsigned char* buffer, int width, int num_rows,
+                             const unsigned char* above, int y0, int y1,
+                             unsigned char* filtered)
+{
+    const size_t bpp = 4;
+    const size_t row_bytes = (size_t) width * bpp;
+    std::vector<unsigned char> scratch(5 * row_bytes);
+
+    for (int y = y0; y < y1; y++)
+    {
+        const unsigned char* row = buffer + (size_t) (num_rows - 1 - y) * row_bytes;
+        const unsigned char* prior = y > 0 ? row + row_bytes : above;
+        unsigned char* out = filtered + (size_t) y * (row_bytes + 1);
+        unsigned long sums[5] = { 0, 0, 0, 0, 0 };
+
+        for (size_t i = 0; i < row_bytes; i++)
+        {
+            int x = row[i];
+            int a = i >= bpp ? row[i - bpp] : 0;
+            int b = prior ? prior[i] : 0;
+            int c = prior && i >= bpp ? prior[i - bpp] : 0;
+            unsigned char v[5];
+            v[0] = (unsigned char) x;
+            v[1] = (unsigned char) (x - a);
+            v[2] = (unsigned char) (x - b);
+            v[3] = (unsigned char) (x - ((a + b) >> 1));
+            v[4] = (unsigned char) (x - _paeth(a, b, c));
+
+            for (int f = 0; f < 5; f++)
+            {
+                scratch[f * row_bytes + i] = v[f];
+                sums[f] += abs((signed char) v[f]);
+            }
+        }
+
+        int best = 0;
+        for (int f = 1; f < 5; f++)
+        {
+            if (sums[f] < sums[best])
+                best = f;
+        }
+
+        out[0] = (unsigned char) best;
+        memcpy(out + 1, &scratch[best * row_bytes], row_bytes);
+    }
+}
+
+// a strip of filtered rows deflated on its own
+struct _PngStrip
+{
+    const unsigned char* filtered;
+    // byte range of the strip in filtered
+    size_t begin, end;
+    bool last;
+    int level;
+    // raw deflate data: ends on a byte boundary (a sync flush) unless the
+    // strip is the last one, so the strips can just be concatenated
+    std::vector<unsigned char> out;
+    uLong adler;
+    bool ok;
+};
+
+static void _deflate_png_strip(_PngStrip* strip)
+{
+    z_stream z;
+    memset(&z, 0, sizeof z);
+    strip->ok = false;
+
+    if (deflateInit2(&z, strip->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+
+    // let the strip refer back to the end of the one before it
+    if (strip->begin > 0)
+    {
+        size_t dict = std::min(_PNG_WINDOW, strip->begin);
+        deflateSetDictionary(&z, strip->filtered + strip->begin - dict, dict);
+    }
+
+    size_t size = strip->end - strip->begin;
+    strip->out.resize(deflateBound(&z, size) + 64);
+    z.next_in = (Bytef*) (strip->filtered + strip->begin);
+    z.avail_in = size;
+    z.next_out = &strip->out[0];
+    z.avail_out = strip->out.size();
+
+    int result = deflate(&z, strip->last ? Z_FINISH : Z_SYNC_FLUSH);
+    strip->ok = strip->last ? result == Z_STREAM_END :
+        result == Z_OK && z.avail_in == 0 && z.avail_out > 0;
+    strip->out.resize(z.total_out);
+    deflateEnd(&z);
+
+    strip->adler = adler32(adler32(0, 0, 0), strip->filtered + strip->begin, size);
+}
+
+static void _put_u32(unsigned char* p, uLong v)
+{
+    p[0] = (unsigned char) (v >> 24);
+    p[1] = (unsigned char) (v >> 16);
+    p[2] = (unsigned char) (v >> 8);
+    p[3] = (unsigned char) v;
+}
+
+// writes a chunk whose data is the given pieces one after another
+static bool _write_png_chunk(FILE* fp, const char* type, const unsigned char* const* pieces,
+                             const size_t* sizes, int num_pieces)
+{
+    size_t length = 0;
+    for (int i = 0; i < num_pieces; i++)
+        length += sizes[i];
+
+    unsigned char header[8];
+    _put_u32(header, length);
+    memcpy(header + 4, type, 4);
+    uLong crc = crc32(crc32(0, 0, 0), header + 4, 4);
+    bool ok = fwrite(header, 1, 8, fp) == 8;
+
+    for (int i = 0; i < num_pieces; i++)
+    {
+        crc = crc32(crc, pieces[i], sizes[i]);
+        ok = ok && fwrite(pieces[i], 1, sizes[i], fp) == sizes[i];
+    }
+
+    unsigned char footer[4];
+    _put_u32(footer, crc);
+    return ok && fwrite(footer, 1, 4, fp) == 4;
+}
+
+// A png being written a band of rows at a time. The rows of each band are
+// filtered and deflated in strips on several threads, each strip a raw
+// deflate stream of its own that ends on a byte boundary, so that one after
+// another they are a single valid deflate stream; each strip goes in an IDAT
+// chunk of its own.
+struct ImageioPngWriter
+{
+    FILE* fp;
+    int width, height;
+    int level, threads;
+    // rows written so far, from the top
+    int rows_written;
+    // the last row written, unfiltered, which the next one is filtered against
+    std::vector<unsigned char> last_row;
+    // the end of the filtered rows written, which deflate may still refer to
+    std::vector<unsigned char> window;
+    // adler32 of the filtered rows written
+    uLong adler;
+    bool ok;
+    ImageioPngStats stats;
+};
+
+ImageioPngWriter* imageio_png_begin( const char *fileName, int width, int height )
+{
+    FILE *fp = fopen(fileName, "wb");
+    if (!fp)
+        return NULL;
+
+    ImageioPngWriter* writer = new ImageioPngWriter();
+    writer->fp = fp;
+    writer->width = width;
+    writer->height = height;
+    writer->level = _png_level;
+    writer->threads = _png_threads;
+    writer->rows_written = 0;
+    writer->adler = adler32(0, 0, 0);
+    writer->stats = ImageioPngStats();
+
+    static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    writer->ok = fwrite(signature, 1, 8, fp) == 8;
+
+    // 8 bit rgba, not interlaced
+    unsigned char ihdr[13] = { 0, 0, 0, 0, 0, 0, 0, 0, 8, 6, 0, 0, 0 };
+    _put_u32(ihdr, width);
+    _put_u32(ihdr + 4, height);
+    const unsigned char* ihdr_data = ihdr;
+    size_t ihdr_size = sizeof ihdr;
+    writer->ok = writer->ok && _write_png_chunk(fp, "IHDR", &ihdr_data, &ihdr_size, 1);
+    writer->stats.bytes = 8 + 25;
+
+    return writer;
+}
+
+bool imageio_png_write_rows( ImageioPngWriter* writer, const unsigned char* rows, int num_rows )
+{
+    if (writer->rows_written + num_rows > writer->height)
+        writer->ok = false;
+    if (!writer->ok || num_rows <= 0)
+        return writer->ok;
+
+    double start = CycleTimer::currentSeconds();
+    const size_t row_bytes = (size_t) writer->width * 4;
+    const size_t filtered_row = row_bytes + 1;
+    const size_t band_bytes = filtered_row * num_rows;
+
+    // the band's filtered rows follow those deflate may still refer back to
+    size_t history = writer->window.size();
+    std::vector<unsigned char> filtered(history + band_bytes);
+    if (history > 0)
+        memcpy(&filtered[0], &writer->window[0], history);
+    unsigned char* band = &filtered[history];
+    const unsigned char* above = writer->rows_written > 0 ? &writer->last_row[0] : NULL;
+
+    int num_strips = (int) std::max((size_t) 1, std::min((size_t) writer->threads,
+                                    band_bytes / _PNG_MIN_STRIP_BYTES));
+    int strip_rows = (num_rows + num_strips - 1) / num_strips;
+    num_strips = (num_rows + strip_rows - 1) / strip_rows;
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_strips; i++)
+    {
+        threads.push_back(std::thread(_filter_png_rows, rows, writer->width, num_rows, above,
+                                      i * strip_rows, std::min(num_rows, (i + 1) * strip_rows),
+                                      band));
+    }
+    _filter_png_rows(rows, writer->width, num_rows, above, 0, std::min(num_rows, strip_rows), band);
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    threads.clear();
+
+    double deflate_start = CycleTimer::currentSeconds();
+
+    bool first = writer->rows_written == 0;
+    bool final = writer->rows_written + num_rows == writer->height;
+    std::vector<_PngStrip> strips(num_strips);
+    for (int i = 0; i < num_strips; i++)
+    {
+        strips[i].filtered = &filtered[0];
+        strips[i].begin = history + std::min((size_t) num_rows, (size_t) i * strip_rows) * filtered_row;
+        strips[i].end = history + std::min((size_t) num_rows, (size_t) (i + 1) * strip_rows) * filtered_row;
+        strips[i].last = final && i == num_strips - 1;
+        strips[i].level = writer->level;
+    }
+    for (int i = 1; i < num_strips; i++)
+        threads.push_back(std::thread(_deflate_png_strip, &strips[i]));
+    _deflate_png_strip(&strips[0]);
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    for (int i = 0; i < num_strips; i++)
+    {
+        writer->ok = writer->ok && strips[i].ok;
+        writer->adler = adler32_combine(writer->adler, strips[i].adler,
+                                        strips[i].end - strips[i].begin);
+    }
+    if (!writer->ok)
+        return false;
+
+    double write_start = CycleTimer::currentSeconds();
+
+    // the zlib header, with the level as the level field sees it
+    unsigned char zlib_header[2] = { 0x78, 0 };
+    int flevel = writer->level < 2 ? 0 : writer->level < 6 ? 1 : writer->level == 6 ? 2 : 3;
+    zlib_header[1] = (unsigned char) (flevel << 6);
+    zlib_header[1] += 31 - (zlib_header[0] * 256 + zlib_header[1]) % 31;
+    unsigned char zlib_footer[4];
+    _put_u32(zlib_footer, writer->adler);
+
+    for (int i = 0; i < num_strips; i++)
+    {
+        const unsigned char* pieces[3];
+        size_t sizes[3];
+        int n = 0;
+        if (first && i == 0)
+        {
+            pieces[n] = zlib_header;
+            sizes[n++] = sizeof zlib_header;
+        }
+        pieces[n] = strips[i].out.empty() ? zlib_header : &strips[i].out[0];
+        sizes[n++] = strips[i].out.size();
+        if (strips[i].last)
+        {
+            pieces[n] = zlib_footer;
+            sizes[n++] = sizeof zlib_footer;
+        }
+        writer->ok = writer->ok && _write_png_chunk(writer->fp, "IDAT", pieces, sizes, n);
+        for (int j = 0; j < n; j++)
+            writer->stats.bytes += sizes[j];
+        writer->stats.bytes += 12;
+    }
+
+    // keep what the next band needs: the bottom row of this one, which is
+    // its first in memory, and the end of its filtered rows
+    size_t keep = std::min(_PNG_WINDOW, filtered.size());
+    writer->window.assign(filtered.end() - keep, filtered.end());
+    writer->last_row.assign(rows, rows + row_bytes);
+    writer->rows_written += num_rows;
+
+    double done = CycleTimer::currentSeconds();
+    writer->stats.filter_time += deflate_start - start;
+    writer->stats.deflate_time += write_start - deflate_start;
+    writer->stats.write_time += done - write_start;
+    writer->stats.strips += num_strips;
+
+    return writer->ok;
+}
+
+bool imageio_png_end( ImageioPngWriter* writer, ImageioPngStats* stats )
+{
+    bool ok = writer->ok && writer->rows_written == writer->height;
+    ok = ok && _write_png_chunk(writer->fp, "IEND", 0, 0, 0);
+    ok = fclose(writer->fp) == 0 && ok;
+    writer->stats.bytes += 12;
+
+    if (stats)
+        *stats = writer->stats;
+
+    delete writer;
+    return ok;
+}
+
+// Saves the image as a png, all of its rows as a single band.
+static bool _save_image_RGBA_png(const char *fileName, unsigned char *buffer,
+                                 int width, int height, ImageioPngStats* stats)
+{
+    ImageioPngWriter* writer = imageio_png_begin(fileName, width, height);
+    if (!writer)
+        return false;
+
+    imageio_png_write_rows(writer, buffer, height);
+    return imageio_png_end(writer, stats);
+}
+
 // ***** external functions ***** //
 
 // Sets the width and height to the appropriate values and mallocs
@@ -227,14 +620,49 @@ unsigned char* imageio_load_image( const char *fileName, int *width, int *height
 // to the given file name, returns true on success, false otherwise.
 // The image format is RGBA.
 bool imageio_save_image( const char *fileName, unsigned char *buffer,
-                         int width, int height )
+                         int width, int height, ImageioPngStats* stats )
 {
     if (_ends_with(fileName, ".png"))
-        return _save_image_RGBA_png(fileName, buffer, width, height);
+        return _save_image_RGBA_png(fileName, buffer, width, height, stats);
     else
         return false;
 }
 
+bool imageio_is_pfm( const char *fileName )
+{
+    return _ends_with(fileName, ".pfm");
+}
+
+// Saves the float RGB image in buffer to a portable float map. The rows of a
+// pfm go from the bottom up like those of buffer, so the file is written
+// straight from it, unbuffered, without copying the pixels anywhere.
+bool imageio_save_pfm( const char *fileName, const float *buffer, int width, int height )
+{
+    FILE *fp = fopen(fileName, "wb");
+    if (!fp)
+        return false;
+    setvbuf(fp, NULL, _IONBF, 0);
+
+    // a negative scale marks little endian floats
+    const uint16_t one = 1;
+    bool little_endian = *(const unsigned char*) &one == 1;
+    char header[64];
+    int header_len = snprintf(header, sizeof header, "PF\n%d %d\n%s\n",
+                              width, height, little_endian ? "-1.0" : "1.0");
+
+    size_t row_bytes = 3 * sizeof(float) * (size_t) width;
+    bool ok = fwrite(header, 1, header_len, fp) == (size_t) header_len;
+    ok = ok && fwrite(buffer, row_bytes, height, fp) == (size_t) height;
+    ok = fclose(fp) == 0 && ok;
+    return ok;
+}
+
+void imageio_set_png_compression( int level, int threads )
+{
+    _png_level = std::max(0, std::min(9, level));
+    _png_threads = std::max(1, threads);
+}
+
 // Wraps the general functionality of saving an image and writes the current
 // frame buffer to a specified file name.  Also returns true on succces,
 // false otherwise.
@@ -38,10 +38,73 @@ namespace _462
 // width = height are set to -1.
 unsigned char* imageio_load_image( const char* filename, int *width, int *height );
 
+// Where the time of saving a png image went.
+struct ImageioPngStats
+{
+    // choosing and applying the row filters, and deflating the rows
+    double filter_time;
+    double deflate_time;
+    // writing the chunks to the file
+    double write_time;
+    // strips of rows deflated on their own threads
+    int strips;
+    size_t bytes;
+};
+
+// Sets the zlib compression level (0 to 9) of the png images saved from now
+// on and how many threads may compress them, each deflating a strip of rows
+// of its own. Defaults to level 6 on one thread.
+void imageio_set_png_compression( int level, int threads );
+
 // Saves image given by buffer with specicified width and height
 // to the given file name, returns true on success, false otherwise.
-// The image format is RGBA.
-bool imageio_save_image( const char* filename, unsigned char* buffer, int width, int height );
+// The image format is RGBA. If stats is not null and the image is a png,
+// it is set to the timings of saving it.
+bool imageio_save_image( const char* filename, unsigned char* buffer, int width, int height,
+                         ImageioPngStats* stats = 0 );
+
+// A png being written a band of rows at a time, see imageio_png_begin.
+struct ImageioPngWriter;
+
+// Starts writing a png of the given size a band of rows at a time, from the
+// top of the image down, each band compressed as it comes so the whole
+// image never has to be in memory. Returns 0 if the file can't be created.
+ImageioPngWriter* imageio_png_begin( const char* filename, int width, int height );
+
+// Writes the next num_rows rows of the image, given like the buffers of
+// imageio_save_image (RGBA, rows from the bottom up), so the last row in
+// rows is the top one of the band. Returns true on success.
+bool imageio_png_write_rows( ImageioPngWriter* writer, const unsigned char* rows, int num_rows );
+
+// Finishes the png and frees the writer. Returns true if every row of the
+// image was written and the file saved. If stats is not null, it is set to
+// the timings of all the bands.
+bool imageio_png_end( ImageioPngWriter* writer, ImageioPngStats* stats );
+
+// A png being read a band of rows at a time, see imageio_png_open.
+struct ImageioPngReader;
+
+// Opens a png to read it a band of rows at a time, from the top of the
+// image down, so the whole image never has to be in memory, and sets width
+// and height to its size. Returns 0 if the file can't be read as a png or
+// is interlaced, which can't be read a row at a time.
+ImageioPngReader* imageio_png_open( const char* filename, int* width, int* height );
+
+// Reads the next num_rows rows of the image as RGBA into rows, laid out like
+// the buffers of imageio_load_image (rows from the bottom up), so the last
+// row in rows is the top one of the band. Returns true on success.
+bool imageio_png_read_rows( ImageioPngReader* reader, unsigned char* rows, int num_rows );
+
+// Closes the png and frees the reader.
+void imageio_png_close( ImageioPngReader* reader );
+
+// Whether an image of the given file name is a portable float map.
+bool imageio_is_pfm( const char* filename );
+
+// Saves a float RGB image (3 floats per pixel, rows from the bottom up like
+// those of imageio_save_image) to the given file name as a portable float
+// map, returns true on success, false otherwise.
+bool imageio_save_pfm( const char* filename, const float* buffer, int width, int height );
 
 // Writes the current opengl frame buffer to a specified file name.
 // Returns true on succces, false otherwise.
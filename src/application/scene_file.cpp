@@ -0,0 +1,466 @@
+#include "application/scene_file.hpp"
+#include "scene/sphere.hpp"
+#include "scene/triangle.hpp"
+#include "scene/model.hpp"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <map>
+#include <exception>
+
+namespace _462
+{
+
+static const char scene_file_magic[8] = { '4', '6', '2', 'S', 'C', 'E', 'N', 'E' };
+
+// size of the records of each section, 1 for the bytes of the strings
+static const size_t scene_record_sizes[NUM_SCENE_SECTIONS] =
+{
+    sizeof( PointLight ),
+    sizeof( SceneFileMaterial ),
+    sizeof( SceneFileMesh ),
+    sizeof( SceneFileSphere ),
+    sizeof( SceneFileTriangle ),
+    sizeof( SceneFileModel ),
+    1
+};
+
+bool is_compiled_scene_file( const char* filename )
+{
+    char magic[sizeof scene_file_magic];
+    std::ifstream file( filename, std::ios::binary );
+
+    return file.read( magic, sizeof magic ) &&
+        memcmp( magic, scene_file_magic, sizeof magic ) == 0;
+}
+
+// the records of a section of a compiled scene read into memory
+template< typename T >
+static const T* get_section( const char* base, const SceneFileHeader& header,
+                             SceneFileSection section )
+{
+    return (const T*) ( base + header.offsets[section] );
+}
+
+static void check_index( uint64_t index, size_t count, const char* filename )
+{
+    if ( index >= count )
+    {
+        std::cout << "Compiled scene '" << filename << "' is damaged.\n";
+        throw std::exception();
+    }
+}
+
+static const char* get_string( const char* strings, uint64_t size, uint64_t offset,
+                               const char* filename )
+{
+    // the table ends with a null, so every string in it does
+    check_index( offset, size, filename );
+    return strings + offset;
+}
+
+static void load_transform( const SceneFileTransform& transform, Geometry* geom )
+{
+    geom->position = transform.position;
+    geom->orientation = transform.orientation;
+    geom->scale = transform.scale;
+}
+
+bool load_compiled_scene( Scene* scene, const char* filename, const MeshFilenameMap* mesh_files )
+{
+    std::ifstream file( filename, std::ios::binary | std::ios::ate );
+    if ( !file )
+    {
+        std::cout << "Error opening file '" << filename << "' for scene loading.\n";
+        return false;
+    }
+
+    // read it whole, into 8 byte words so the records are aligned
+    uint64_t size = file.tellg();
+    std::vector< uint64_t > words( ( size + 7 ) / 8 );
+    file.seekg( 0 );
+    if ( size < sizeof( SceneFileHeader ) || !file.read( (char*) words.data(), size ) )
+    {
+        std::cout << "Compiled scene '" << filename << "' is damaged.\n";
+        return false;
+    }
+
+    const char* base = (const char*) words.data();
+    const SceneFileHeader& header = *(const SceneFileHeader*) base;
+
+    if ( memcmp( header.magic, scene_file_magic, sizeof scene_file_magic ) != 0 ||
+         header.version != scene_file_version || header.byte_order != scene_file_byte_order ||
+         header.real_size != sizeof( real_t ) )
+    {
+        std::cout << "Compiled scene '" << filename << "' was written by another version"
+                  << " or for another machine; compile it again.\n";
+        return false;
+    }
+
+    for ( int i = 0; i < NUM_SCENE_SECTIONS; i++ )
+    {
+        uint64_t offset = header.offsets[i];
+        if ( offset % scene_file_alignment != 0 || offset > size ||
+             header.counts[i] > ( size - offset ) / scene_record_sizes[i] )
+        {
+            std::cout << "Compiled scene '" << filename << "' is damaged.\n";
+            return false;
+        }
+    }
+
+    const char* strings = get_section< char >( base, header, SCENE_SECTION_STRINGS );
+    uint64_t strings_size = header.counts[SCENE_SECTION_STRINGS];
+    if ( strings_size > 0 && strings[strings_size - 1] != '\0' )
+    {
+        std::cout << "Compiled scene '" << filename << "' is damaged.\n";
+        return false;
+    }
+
+    scene->reset();
+
+    try
+    {
+        scene->camera.position = header.camera_position;
+        scene->camera.orientation = header.camera_orientation;
+        scene->camera.fov = header.camera_fov;
+        scene->camera.near_clip = header.camera_near_clip;
+        scene->camera.far_clip = header.camera_far_clip;
+        scene->background_color = header.background_color;
+        scene->ambient_light = header.ambient_light;
+        scene->refractive_index = header.refractive_index;
+
+        const PointLight* lights = get_section< PointLight >( base, header, SCENE_SECTION_LIGHTS );
+        for ( uint64_t i = 0; i < header.counts[SCENE_SECTION_LIGHTS]; ++i )
+        {
+            scene->add_light( lights[i] );
+        }
+
+        const SceneFileMaterial* materials =
+            get_section< SceneFileMaterial >( base, header, SCENE_SECTION_MATERIALS );
+        for ( uint64_t i = 0; i < header.counts[SCENE_SECTION_MATERIALS]; ++i )
+        {
+            Material* mat = new Material();
+            scene->add_material( mat );
+            mat->ambient = materials[i].ambient;
+            mat->diffuse = materials[i].diffuse;
+            mat->specular = materials[i].specular;
+            mat->shininess = materials[i].shininess;
+            mat->refractive_index = materials[i].refractive_index;
+            if ( materials[i].texture_filename != scene_file_no_string )
+            {
+                mat->texture_filename = get_string( strings, strings_size,
+                                                    materials[i].texture_filename, filename );
+            }
+        }
+
+        const SceneFileMesh* meshes = get_section< SceneFileMesh >( base, header, SCENE_SECTION_MESHES );
+        std::map< std::string, Mesh* > mesh_names;
+        for ( uint64_t i = 0; i < header.counts[SCENE_SECTION_MESHES]; ++i )
+        {
+            Mesh* mesh = new Mesh();
+            scene->add_mesh( mesh );
+            mesh->name = get_string( strings, strings_size, meshes[i].name, filename );
+            mesh->filename = get_string( strings, strings_size, meshes[i].filename, filename );
+            mesh_names[mesh->name] = mesh;
+
+            // swap in the file given for this mesh, if any
+            if ( mesh_files )
+            {
+                MeshFilenameMap::const_iterator iter = mesh_files->find( mesh->name );
+                if ( iter != mesh_files->end() )
+                {
+                    mesh->filename = iter->second;
+                }
+            }
+        }
+
+        // catch typos in the substitutions
+        if ( mesh_files )
+        {
+            for ( MeshFilenameMap::const_iterator i = mesh_files->begin(); i != mesh_files->end(); ++i )
+            {
+                if ( mesh_names.find( i->first ) == mesh_names.end() )
+                {
+                    std::cout << "ERROR, no mesh '" << i->first << "' to replace in " << filename << ".\n";
+                    throw std::exception();
+                }
+            }
+        }
+
+        Material* const* scene_materials = scene->get_materials();
+        size_t num_materials = scene->num_materials();
+
+        // the geometries of each kind are allocated all at once
+        uint64_t num_spheres = header.counts[SCENE_SECTION_SPHERES];
+        const SceneFileSphere* spheres =
+            get_section< SceneFileSphere >( base, header, SCENE_SECTION_SPHERES );
+        if ( num_spheres > 0 )
+        {
+            Sphere* geoms = new Sphere[num_spheres];
+            scene->add_geometries( geoms, num_spheres );
+            for ( uint64_t i = 0; i < num_spheres; ++i )
+            {
+                load_transform( spheres[i].transform, &geoms[i] );
+                geoms[i].radius = spheres[i].radius;
+                check_index( spheres[i].material, num_materials, filename );
+                geoms[i].material = scene_materials[spheres[i].material];
+            }
+        }
+
+        uint64_t num_triangles = header.counts[SCENE_SECTION_TRIANGLES];
+        const SceneFileTriangle* triangles =
+            get_section< SceneFileTriangle >( base, header, SCENE_SECTION_TRIANGLES );
+        if ( num_triangles > 0 )
+        {
+            Triangle* geoms = new Triangle[num_triangles];
+            scene->add_geometries( geoms, num_triangles );
+            for ( uint64_t i = 0; i < num_triangles; ++i )
+            {
+                load_transform( triangles[i].transform, &geoms[i] );
+                for ( int j = 0; j < 3; j++ )
+                {
+                    const SceneFileVertex& vertex = triangles[i].vertices[j];
+                    geoms[i].vertices[j].position = vertex.position;
+                    geoms[i].vertices[j].normal = vertex.normal;
+                    geoms[i].vertices[j].tex_coord = vertex.tex_coord;
+                    check_index( vertex.material, num_materials, filename );
+                    geoms[i].vertices[j].material = scene_materials[vertex.material];
+                }
+            }
+        }
+
+        uint64_t num_models = header.counts[SCENE_SECTION_MODELS];
+        const SceneFileModel* models = get_section< SceneFileModel >( base, header, SCENE_SECTION_MODELS );
+        if ( num_models > 0 )
+        {
+            Model* geoms = new Model[num_models];
+            scene->add_geometries( geoms, num_models );
+            for ( uint64_t i = 0; i < num_models; ++i )
+            {
+                load_transform( models[i].transform, &geoms[i] );
+                check_index( models[i].mesh, scene->num_meshes(), filename );
+                check_index( models[i].material, num_materials, filename );
+                geoms[i].mesh = scene->get_meshes()[models[i].mesh];
+                geoms[i].material = scene_materials[models[i].material];
+            }
+        }
+    }
+    catch ( std::bad_alloc const& )
+    {
+        std::cout << "Out of memory error while loading scene.\n";
+        scene->reset();
+        return false;
+    }
+    catch ( ... )
+    {
+        scene->reset();
+        return false;
+    }
+
+    return true;
+}
+
+// the strings of a compiled scene being written, each stored once
+struct SceneFileStrings
+{
+    std::string table;
+    std::map< std::string, uint64_t > offsets;
+
+    uint64_t add( const std::string& str )
+    {
+        std::map< std::string, uint64_t >::iterator iter = offsets.find( str );
+        if ( iter != offsets.end() )
+        {
+            return iter->second;
+        }
+
+        uint64_t offset = table.size();
+        table.append( str.c_str(), str.size() + 1 );
+        offsets[str] = offset;
+        return offset;
+    }
+};
+
+static SceneFileTransform save_transform( const Geometry* geom )
+{
+    SceneFileTransform transform;
+    transform.position = geom->position;
+    transform.orientation = geom->orientation;
+    transform.scale = geom->scale;
+    return transform;
+}
+
+template< typename T >
+static uint64_t get_index( const std::map< const T*, uint64_t >& indices, const T* item )
+{
+    typename std::map< const T*, uint64_t >::const_iterator iter = indices.find( item );
+    if ( iter == indices.end() )
+    {
+        std::cout << "A geometry refers to something that isn't in its scene.\n";
+        throw std::exception();
+    }
+    return iter->second;
+}
+
+// writes the records of a section, padded to the alignment
+template< typename T >
+static void write_section( std::ofstream& file, SceneFileHeader& header, SceneFileSection section,
+                           const std::vector< T >& records, uint64_t& offset )
+{
+    static const char zeros[scene_file_alignment] = { 0 };
+
+    header.offsets[section] = offset;
+    header.counts[section] = records.size();
+    uint64_t bytes = records.size() * sizeof( T );
+    if ( bytes > 0 )
+    {
+        file.write( (const char*) records.data(), bytes );
+    }
+
+    uint64_t padding = ( scene_file_alignment - bytes % scene_file_alignment ) % scene_file_alignment;
+    file.write( zeros, padding );
+    offset += bytes + padding;
+}
+
+bool save_compiled_scene( const Scene& scene, const char* filename )
+{
+    std::map< const Material*, uint64_t > material_indices;
+    std::map< const Mesh*, uint64_t > mesh_indices;
+    SceneFileStrings strings;
+
+    std::vector< PointLight > lights( scene.get_lights(), scene.get_lights() + scene.num_lights() );
+    std::vector< SceneFileMaterial > materials;
+    std::vector< SceneFileMesh > meshes;
+    std::vector< SceneFileSphere > spheres;
+    std::vector< SceneFileTriangle > triangles;
+    std::vector< SceneFileModel > models;
+
+    try
+    {
+        for ( size_t i = 0; i < scene.num_materials(); ++i )
+        {
+            const Material* mat = scene.get_materials()[i];
+            SceneFileMaterial record;
+            record.ambient = mat->ambient;
+            record.diffuse = mat->diffuse;
+            record.specular = mat->specular;
+            record.shininess = mat->shininess;
+            record.refractive_index = mat->refractive_index;
+            record.texture_filename = mat->texture_filename.empty() ?
+                scene_file_no_string : strings.add( mat->texture_filename );
+            material_indices[mat] = materials.size();
+            materials.push_back( record );
+        }
+
+        for ( size_t i = 0; i < scene.num_meshes(); ++i )
+        {
+            const Mesh* mesh = scene.get_meshes()[i];
+            SceneFileMesh record;
+            record.name = strings.add( mesh->name );
+            record.filename = strings.add( mesh->filename );
+            mesh_indices[mesh] = meshes.size();
+            meshes.push_back( record );
+        }
+
+        for ( size_t i = 0; i < scene.num_geometries(); ++i )
+        {
+            const Geometry* geom = scene.get_geometries()[i];
+
+            if ( const Sphere* sphere = dynamic_cast< const Sphere* >( geom ) )
+            {
+                SceneFileSphere record;
+                record.transform = save_transform( sphere );
+                record.radius = sphere->radius;
+                record.material = get_index( material_indices, sphere->material );
+                spheres.push_back( record );
+            }
+            else if ( const Triangle* triangle = dynamic_cast< const Triangle* >( geom ) )
+            {
+                SceneFileTriangle record;
+                record.transform = save_transform( triangle );
+                for ( int j = 0; j < 3; j++ )
+                {
+                    const Triangle::Vertex& vertex = triangle->vertices[j];
+                    record.vertices[j].position = vertex.position;
+                    record.vertices[j].normal = vertex.normal;
+                    record.vertices[j].tex_coord = vertex.tex_coord;
+                    record.vertices[j].material = get_index( material_indices, vertex.material );
+                }
+                triangles.push_back( record );
+            }
+            else if ( const Model* model = dynamic_cast< const Model* >( geom ) )
+            {
+                SceneFileModel record;
+                record.transform = save_transform( model );
+                record.mesh = get_index( mesh_indices, model->mesh );
+                record.material = get_index( material_indices, model->material );
+                models.push_back( record );
+            }
+            else
+            {
+                std::cout << "Geometry " << i << " is of a kind compiled scenes can't hold.\n";
+                return false;
+            }
+        }
+    }
+    catch ( std::exception const& )
+    {
+        return false;
+    }
+
+    // the geometries are loaded back grouped by kind, so a scene that lists
+    // them in another order would get other ids
+    for ( size_t i = 0; i < scene.num_geometries(); ++i )
+    {
+        const Geometry* geom = scene.get_geometries()[i];
+        bool in_order = i < spheres.size() ? dynamic_cast< const Sphere* >( geom ) != 0 :
+            i < spheres.size() + triangles.size() ? dynamic_cast< const Triangle* >( geom ) != 0 :
+            dynamic_cast< const Model* >( geom ) != 0;
+        if ( !in_order )
+        {
+            std::cout << "Geometries aren't grouped as spheres, triangles and models.\n";
+            return false;
+        }
+    }
+
+    std::ofstream file( filename, std::ios::binary );
+    if ( !file )
+    {
+        return false;
+    }
+
+    SceneFileHeader header = SceneFileHeader();
+    memcpy( header.magic, scene_file_magic, sizeof header.magic );
+    header.version = scene_file_version;
+    header.byte_order = scene_file_byte_order;
+    header.real_size = sizeof( real_t );
+    header.camera_position = scene.camera.position;
+    header.camera_orientation = scene.camera.orientation;
+    header.camera_fov = scene.camera.fov;
+    header.camera_near_clip = scene.camera.near_clip;
+    header.camera_far_clip = scene.camera.far_clip;
+    header.background_color = scene.background_color;
+    header.ambient_light = scene.ambient_light;
+    header.refractive_index = scene.refractive_index;
+
+    // the header goes first, written again once the sections are placed
+    uint64_t offset = sizeof header + ( scene_file_alignment - sizeof header % scene_file_alignment ) %
+        scene_file_alignment;
+    file.write( (const char*) &header, sizeof header );
+    file.seekp( offset );
+
+    std::vector< char > string_table( strings.table.begin(), strings.table.end() );
+    write_section( file, header, SCENE_SECTION_LIGHTS, lights, offset );
+    write_section( file, header, SCENE_SECTION_MATERIALS, materials, offset );
+    write_section( file, header, SCENE_SECTION_MESHES, meshes, offset );
+    write_section( file, header, SCENE_SECTION_SPHERES, spheres, offset );
+    write_section( file, header, SCENE_SECTION_TRIANGLES, triangles, offset );
+    write_section( file, header, SCENE_SECTION_MODELS, models, offset );
+    write_section( file, header, SCENE_SECTION_STRINGS, string_table, offset );
+
+    file.seekp( 0 );
+    file.write( (const char*) &header, sizeof header );
+    return file.good();
+}
+
+} /* _462 */
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "application/scene_loader.hpp"
+#include "scene/scene.hpp"
+#include <stdint.h>
+
+namespace _462
+{
+
+/**
+ * Compiled scene files hold what a .scene file describes as arrays of fixed
+ * size records, so loading one is a single read and a pass over each array,
+ * without parsing text or looking names up: a header with the camera and
+ * the scene's colors, then the lights, materials, meshes, spheres, triangles
+ * (with their three vertices each) and models, then the strings they name.
+ * Geometries refer to materials and meshes by index, and materials and
+ * meshes to their files by offset into the strings. Every section starts at
+ * a multiple of scene_file_alignment. Files are written by "raytracer -P"
+ * and only read back on machines with the same byte order and precision.
+ */
+
+// bumped whenever the layout changes; files of other versions are rejected
+const uint32_t scene_file_version = 1;
+const uint64_t scene_file_alignment = 8;
+// written as is, so it reads back differently on a machine of the other
+// byte order
+const uint32_t scene_file_byte_order = 0x01020304;
+// string offset of a material without a texture
+const uint64_t scene_file_no_string = ~0ull;
+
+enum SceneFileSection
+{
+    SCENE_SECTION_LIGHTS,
+    SCENE_SECTION_MATERIALS,
+    SCENE_SECTION_MESHES,
+    SCENE_SECTION_SPHERES,
+    SCENE_SECTION_TRIANGLES,
+    SCENE_SECTION_MODELS,
+    SCENE_SECTION_STRINGS,
+    NUM_SCENE_SECTIONS
+};
+
+struct SceneFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    // sizeof( real_t ) of the writer
+    uint32_t real_size;
+    uint32_t padding;
+    Vector3 camera_position;
+    Quaternion camera_orientation;
+    real_t camera_fov;
+    real_t camera_near_clip;
+    real_t camera_far_clip;
+    Color3 background_color;
+    Color3 ambient_light;
+    real_t refractive_index;
+    // records in each section, bytes for the strings, and where each starts
+    uint64_t counts[NUM_SCENE_SECTIONS];
+    uint64_t offsets[NUM_SCENE_SECTIONS];
+};
+
+// the transformation every geometry has
+struct SceneFileTransform
+{
+    Vector3 position;
+    Quaternion orientation;
+    Vector3 scale;
+};
+
+struct SceneFileMaterial
+{
+    Color3 ambient;
+    Color3 diffuse;
+    Color3 specular;
+    real_t shininess;
+    real_t refractive_index;
+    uint64_t texture_filename;
+};
+
+struct SceneFileMesh
+{
+    uint64_t name;
+    uint64_t filename;
+};
+
+struct SceneFileVertex
+{
+    Vector3 position;
+    Vector3 normal;
+    Vector2 tex_coord;
+    uint64_t material;
+};
+
+struct SceneFileSphere
+{
+    SceneFileTransform transform;
+    real_t radius;
+    uint64_t material;
+};
+
+struct SceneFileTriangle
+{
+    SceneFileTransform transform;
+    SceneFileVertex vertices[3];
+};
+
+struct SceneFileModel
+{
+    SceneFileTransform transform;
+    uint64_t mesh;
+    uint64_t material;
+};
+
+/// whether a file starts like a compiled scene file
+bool is_compiled_scene_file( const char* filename );
+
+/**
+ * Loads a compiled scene file, which load_scene does for any file that
+ * starts like one.
+ * @return True on success, false on error, with the scene cleared.
+ */
+bool load_compiled_scene( Scene* scene, const char* filename, const MeshFilenameMap* mesh_files );
+
+/**
+ * Writes a scene as loaded by load_scene to a compiled scene file.
+ * @return false if the file can't be written or the scene has geometries
+ *  other than spheres, triangles and models.
+ */
+bool save_compiled_scene( const Scene& scene, const char* filename );
+
+} /* _462 */
@@ -6,6 +6,7 @@
  */
 
 #include "application/scene_loader.hpp"
+#include "application/scene_file.hpp"
 
 #include "scene/geometry.hpp"
 #include "scene/scene.hpp"
@@ -221,7 +222,7 @@ static void parse_point_light( const TiXmlElement* elem, PointLight* light )
 }
 
 template< typename T >
-static void parse_lookup_data( const std::map< const char*, T, StrCompare > tmap, const TiXmlElement* elem, const char* name, T* val )
+static void parse_lookup_data( const std::map< const char*, T, StrCompare >& tmap, const TiXmlElement* elem, const char* name, T* val )
 {
     typename std::map< const char*, T, StrCompare >::const_iterator iter;
     const char* att;
@@ -259,6 +260,7 @@ static const char* parse_mesh( const TiXmlElement* elem, Mesh* mesh )
 
     parse_attrib_string( elem, false, STR_FILENAME, &mesh->filename );
     parse_attrib_string( elem, true,  STR_NAME,     &name );
+    mesh->name = name;
 
     return name;
 }
@@ -344,7 +346,7 @@ static void check_mem( void* ptr )
     }
 }
 
-bool load_scene( Scene* scene, const char* filename )
+bool load_scene( Scene* scene, const char* filename, const MeshFilenameMap* mesh_files )
 {
     TiXmlDocument doc( filename );
     const TiXmlElement* root = 0;
@@ -355,6 +357,12 @@ bool load_scene( Scene* scene, const char* filename )
 
     assert( scene );
 
+    // compiled scenes skip the xml entirely
+    if ( is_compiled_scene_file( filename ) )
+    {
+        return load_compiled_scene( scene, filename, mesh_files );
+    }
+
     // load the document
 
     if ( !doc.LoadFile() )
@@ -437,9 +445,31 @@ bool load_scene( Scene* scene, const char* filename )
                 std::cout << "Mesh '" << name << "' multiply defined.\n";
                 throw std::exception();
             }
+            // swap in the file given for this mesh, if any
+            if ( mesh_files )
+            {
+                MeshFilenameMap::const_iterator iter = mesh_files->find( name );
+                if ( iter != mesh_files->end() )
+                {
+                    mesh->filename = iter->second;
+                }
+            }
             elem = elem->NextSiblingElement( STR_MESH );
         }
 
+        // catch typos in the substitutions
+        if ( mesh_files )
+        {
+            for ( MeshFilenameMap::const_iterator i = mesh_files->begin(); i != mesh_files->end(); ++i )
+            {
+                if ( meshes.find( i->first.c_str() ) == meshes.end() )
+                {
+                    std::cout << "ERROR, no mesh '" << i->first << "' to replace in " << filename << ".\n";
+                    throw std::exception();
+                }
+            }
+        }
+
         // parse vertices (used by triangles)
         elem = root->FirstChildElement( STR_VERTEX );
         while ( elem )
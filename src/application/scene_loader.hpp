@@ -7,18 +7,25 @@
 
 #pragma once
 
+#include <map>
+#include <string>
+
 namespace _462
 {
 
 class Scene;
 
+// mesh name -> obj file to load for it instead of the one in the scene file
+typedef std::map< std::string, std::string > MeshFilenameMap;
+
 /**
- * Loads a scene from a .scene file.
- * Clears away the old scene. Prints a message to stdout if an error occurs.
+ * Loads a scene from a .scene file, or from a compiled scene file made from
+ * one by "raytracer -P" (see scene_file.hpp). Clears away the old scene. Prints a message to stdout if an error occurs.
+ * @param mesh_files If not null, replaces the filenames of the named meshes.
  * @return True on success, false on error.
  * Will clear the scene on error.
  */
-bool load_scene( Scene* scene, const char* filename );
+bool load_scene( Scene* scene, const char* filename, const MeshFilenameMap* mesh_files = 0 );
 
 } /* _462 */
 
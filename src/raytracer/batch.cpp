@@ -0,0 +1,382 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include "raytracer/batch.hpp"
+#include "raytracer/numa.hpp"
+#include "raytracer/CycleTimer.hpp"
+#include "application/imageio.hpp"
+#include "application/scene_loader.hpp"
+#include "scene/scene.hpp"
+
+#define MAX_NAME_LEN 1024
+
+using namespace std;
+
+namespace _462
+{
+
+struct SequenceFrame
+{
+    string scene_file;
+    MeshFilenameMap mesh_files;
+};
+
+// result of loading one frame on the loader thread
+struct LoadedFrame
+{
+    LoadedFrame() : scene(new Scene()), ok(false), load_time(0) { }
+
+    unique_ptr<Scene> scene;
+    bool ok;
+    double load_time;
+};
+
+// one frame being saved on the writer thread
+struct SavedFrame
+{
+    SavedFrame() : buffer(0), index(0), ok(false), write_time(0) { }
+
+    string filename;
+    unsigned char* buffer;
+    size_t index;
+    bool ok;
+    double write_time;
+    ImageioPngStats stats;
+};
+
+static string format_frame(const string& pattern, int frame)
+{
+    char buf[MAX_NAME_LEN];
+    snprintf(buf, sizeof buf, pattern.c_str(), frame);
+    return buf;
+}
+
+static bool parse_int(const string& str, int* val)
+{
+    char* end;
+    long l = strtol(str.c_str(), &end, 10);
+    if (str.empty() || *end)
+    {
+        return false;
+    }
+    *val = (int) l;
+    return true;
+}
+
+static bool parse_sequence(const char* filename, vector<SequenceFrame>* frames)
+{
+    ifstream file(filename);
+    if (!file)
+    {
+        cout << "Error opening sequence file '" << filename << "'.\n";
+        return false;
+    }
+
+    string line;
+    for (int line_num = 1; getline(file, line); line_num++)
+    {
+        istringstream stream(line);
+        vector<string> tokens;
+        string token;
+        while (stream >> token)
+        {
+            tokens.push_back(token);
+        }
+
+        if (tokens.empty() || tokens[0][0] == '#')
+        {
+            continue;
+        }
+
+        // optional frame range right after the scene
+        size_t next = 1;
+        int first = 0, last = 0;
+        bool ranged = tokens.size() >= 3 &&
+            parse_int(tokens[1], &first) && parse_int(tokens[2], &last);
+        if (ranged)
+        {
+            next = 3;
+        }
+        else
+        {
+            first = last = 0;
+        }
+
+        for (int frame = first; frame <= last; frame++)
+        {
+            SequenceFrame f;
+            f.scene_file = ranged ? format_frame(tokens[0], frame) : tokens[0];
+
+            for (size_t i = next; i < tokens.size(); i++)
+            {
+                size_t eq = tokens[i].find('=');
+                if (eq == string::npos || eq == 0)
+                {
+                    cout << filename << ":" << line_num << ": expected mesh=file, got '"
+                         << tokens[i] << "'.\n";
+                    return false;
+                }
+                string file = tokens[i].substr(eq + 1);
+                f.mesh_files[tokens[i].substr(0, eq)] = ranged ? format_frame(file, frame) : file;
+            }
+
+            frames->push_back(f);
+        }
+    }
+
+    return true;
+}
+
+// out.png -> out_0007.png, unless the name is a pattern itself
+static string output_name(const char* output_file, int frame)
+{
+    char buf[MAX_NAME_LEN];
+    string name;
+
+    if (output_file)
+    {
+        name = output_file;
+    }
+    else
+    {
+        imageio_gen_name(buf, sizeof buf);
+        name = buf;
+    }
+
+    if (name.find('%') != string::npos)
+    {
+        return format_frame(name, frame);
+    }
+
+    snprintf(buf, sizeof buf, "_%04d", frame);
+    size_t dot = name.rfind('.');
+    size_t slash = name.rfind('/');
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+    {
+        dot = name.size();
+    }
+    return name.insert(dot, buf);
+}
+
+/**
+ * Loads everything a frame needs before it can be traced. Runs on the loader
+ * thread while the previous frame is traced, so it touches nothing but its
+ * own scene and the (locked) texture cache.
+ */
+static void load_frame(const SequenceFrame* frame, TextureCache* textures,
+                       int width, int height, LoadedFrame* loaded)
+{
+    double start = CycleTimer::currentSeconds();
+
+    // let go of the scene this slot held two frames ago, and of the
+    // textures only it used
+    loaded->scene->reset();
+    textures->prune();
+
+    Scene* scene = loaded->scene.get();
+    loaded->ok = false;
+
+    try
+    {
+        if (!load_scene(scene, frame->scene_file.c_str(), &frame->mesh_files))
+        {
+            cout << "Error loading scene " << frame->scene_file << ".\n";
+            return;
+        }
+
+        Material* const* materials = scene->get_materials();
+        Mesh* const* meshes = scene->get_meshes();
+
+        for (size_t i = 0; i < scene->num_materials(); ++i)
+        {
+            if (!materials[i]->load(textures))
+            {
+                cout << "Error loading texture for " << frame->scene_file << ".\n";
+                return;
+            }
+        }
+
+        for (size_t i = 0; i < scene->num_meshes(); ++i)
+        {
+            // the frame before is tracing on every core meanwhile
+            if (!meshes[i]->load(1))
+            {
+                cout << "Error loading mesh for " << frame->scene_file << ".\n";
+                return;
+            }
+        }
+
+        scene->camera.aspect = real_t(width) / real_t(height);
+        Raytracer::build_scene(scene);
+    }
+    catch (std::bad_alloc const&)
+    {
+        cout << "Out of memory error while loading " << frame->scene_file << ".\n";
+        return;
+    }
+
+    loaded->ok = true;
+    loaded->load_time = CycleTimer::currentSeconds() - start;
+}
+
+static void save_frame(int width, int height, SavedFrame* saved)
+{
+    double start = CycleTimer::currentSeconds();
+    saved->stats = ImageioPngStats();
+    saved->ok = imageio_save_image(saved->filename.c_str(), saved->buffer, width, height,
+                                   &saved->stats);
+    saved->write_time = CycleTimer::currentSeconds() - start;
+}
+
+static void report_saved(const SavedFrame& saved)
+{
+    if (saved.ok)
+    {
+        cout << "Saved raytraced image to '" << saved.filename << "'.\n";
+    }
+    else
+    {
+        cout << "Error saving raytraced image to '" << saved.filename << "'.\n";
+    }
+
+    cout << "Frame " << saved.index << ": write " << saved.write_time << "s ("
+         << saved.stats.strips << " strips, " << saved.stats.bytes << " bytes)" << endl;
+}
+
+bool render_sequence(const char* sequence_file, const char* output_file,
+                     int width, int height, bool extras,
+                     const RaytraceOptions& options, int numthreads)
+{
+    vector<SequenceFrame> frames;
+    if (!parse_sequence(sequence_file, &frames))
+    {
+        return false;
+    }
+
+    if (frames.empty())
+    {
+        cout << "No frames in sequence file '" << sequence_file << "'.\n";
+        return false;
+    }
+
+    // one buffer is traced into while the other one is saved
+    size_t buffer_size = 4 * (size_t) width * height;
+    unsigned char* buffers[2];
+    buffers[0] = framebuffer_alloc(buffer_size);
+    buffers[1] = buffers[0] ? framebuffer_alloc(buffer_size) : 0;
+    if (!buffers[1])
+    {
+        framebuffer_free(buffers[0], buffer_size);
+        cout << "Unable to allocate buffer.\n";
+        return false;
+    }
+
+    double start = CycleTimer::currentSeconds();
+    double total_load = 0, total_trace = 0, total_write = 0, stalled = 0, write_stalled = 0;
+    size_t failed = 0;
+
+    SavedFrame saved;
+    thread writer;
+    // the buffer the next frame is traced into, never the one the writer
+    // holds; frames that fail to load don't flip it
+    size_t trace_buffer = 0;
+
+    TextureCache textures;
+    Raytracer raytracer;
+    // one slot is traced while the other one is loaded
+    LoadedFrame slots[2];
+
+    thread loader(load_frame, &frames[0], &textures, width, height, &slots[0]);
+
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        LoadedFrame& current = slots[i % 2];
+
+        // anything left to wait for here is load time not hidden behind
+        // tracing the previous frame
+        double wait_start = CycleTimer::currentSeconds();
+        loader.join();
+        if (i > 0)
+        {
+            stalled += CycleTimer::currentSeconds() - wait_start;
+        }
+
+        if (i + 1 < frames.size())
+        {
+            loader = thread(load_frame, &frames[i + 1], &textures, width, height,
+                            &slots[(i + 1) % 2]);
+        }
+
+        if (!current.ok)
+        {
+            failed++;
+            continue;
+        }
+
+        // the previous frame is being saved from the other buffer
+        unsigned char* buffer = buffers[trace_buffer];
+
+        double trace_start = CycleTimer::currentSeconds();
+        raytracer.initialize(current.scene.get(), width, height, extras, options, true);
+        raytracer.raytrace(buffer, 0, numthreads);
+        double trace_time = CycleTimer::currentSeconds() - trace_start;
+
+        cout << "Frame " << i << ": load " << current.load_time
+             << "s, trace " << trace_time << "s" << endl;
+        total_load += current.load_time;
+        total_trace += trace_time;
+
+        // anything left to wait for here is write time not hidden behind
+        // tracing this frame
+        if (writer.joinable())
+        {
+            double write_wait = CycleTimer::currentSeconds();
+            writer.join();
+            write_stalled += CycleTimer::currentSeconds() - write_wait;
+            report_saved(saved);
+            failed += saved.ok ? 0 : 1;
+            total_write += saved.write_time;
+        }
+
+        saved.filename = output_name(output_file, i);
+        saved.buffer = buffer;
+        saved.index = i;
+        writer = thread(save_frame, width, height, &saved);
+        trace_buffer = 1 - trace_buffer;
+    }
+
+    if (loader.joinable())
+    {
+        loader.join();
+    }
+
+    if (writer.joinable())
+    {
+        double write_wait = CycleTimer::currentSeconds();
+        writer.join();
+        write_stalled += CycleTimer::currentSeconds() - write_wait;
+        report_saved(saved);
+        failed += saved.ok ? 0 : 1;
+        total_write += saved.write_time;
+    }
+
+    framebuffer_free(buffers[0], buffer_size);
+    framebuffer_free(buffers[1], buffer_size);
+
+    cout << "Sequence time:  " << CycleTimer::currentSeconds() - start << "s for "
+         << frames.size() - failed << "/" << frames.size() << " frames\n"
+         << "Load time:      " << total_load << "s (" << stalled << "s not hidden by tracing)\n"
+         << "Trace time:     " << total_trace << "s\n"
+         << "Write time:     " << total_write << "s (" << write_stalled
+         << "s not hidden by tracing)\n"
+         << "Texture cache:  " << textures.num_hits() << " hits, "
+         << textures.num_misses() << " misses" << endl;
+
+    return failed == 0;
+}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "raytracer/raytracer.hpp"
+
+namespace _462
+{
+
+/**
+ * Renders every frame listed in a sequence file to its own numbered image.
+ * Each line of the file names a scene, optionally followed by a frame range
+ * and mesh substitutions:
+ *
+ *   scenes/cube.scene
+ *   scenes/fairy_one.scene fairy=models/fairy/fairy05.obj
+ *   scenes/fairy_one.scene 1 25 fairy=models/fairy/fairy%02d.obj
+ *
+ * A range renders one frame per number, substituted into any printf-style
+ * %d in the scene and mesh filenames. Blank lines and lines starting with
+ * '#' are ignored.
+ *
+ * While one frame is traced the next one is loaded (scene, textures,
+ * meshes and bounding volumes) on a separate thread, and textures the two
+ * have in common are decoded once.
+ * @param output_file The output image name. If it contains a %d it is used
+ *  as the pattern for the frame number, otherwise the number is inserted
+ *  before the extension. May be null to use a default name.
+ * @return true if every frame was rendered and saved.
+ */
+bool render_sequence(const char* sequence_file, const char* output_file,
+                     int width, int height, bool extras,
+                     const RaytraceOptions& options, int numthreads);
+
+}
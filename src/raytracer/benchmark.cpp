@@ -0,0 +1,765 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <stdint.h>
+#include <malloc.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "raytracer/benchmark.hpp"
+#include "raytracer/CycleTimer.hpp"
+#include "application/imageio.hpp"
+#include "scene/texture.hpp"
+#include "scene/mesh.hpp"
+#include "scene/scene.hpp"
+#include "scene/sphere.hpp"
+#include "scene/triangle.hpp"
+#include "scene/model.hpp"
+#include "application/scene_loader.hpp"
+#include "application/scene_file.hpp"
+
+// filtered fetches timed per layout and access pattern
+#define TEXTURE_SAMPLES (1 << 22)
+// timed runs of each, of which the fastest counts
+#define TEXTURE_RUNS 3
+// timed loads of each obj file with each parser, of which the fastest counts
+#define OBJ_RUNS 3
+// timed loads of each scene from xml and compiled, of which the fastest counts
+#define SCENE_RUNS 3
+// lights and materials of the generated scenes
+#define SCENE_LIGHTS 8
+#define SCENE_MATERIALS 16
+
+using namespace std;
+
+namespace _462
+{
+
+enum AccessPattern
+{
+    ACCESS_ROWS,
+    ACCESS_COLUMNS,
+    ACCESS_DIAGONAL,
+    ACCESS_RANDOM,
+    NUM_ACCESS_PATTERNS
+};
+
+static const char* access_pattern_names[NUM_ACCESS_PATTERNS] =
+{
+    "rows", "columns", "diagonal", "random"
+};
+
+// texture coordinate of the i-th fetch of a pattern over a w x h texture:
+// texel by texel along the rows, down the columns or along lines at 30
+// degrees (like a floor seen at an angle), or anywhere at all
+static Vector2 access_coord(AccessPattern pattern, size_t i, int w, int h, uint32_t* rng)
+{
+    switch (pattern)
+    {
+    case ACCESS_ROWS:
+        return Vector2((i % w + 0.5) / w, ((i / w) % h + 0.5) / h);
+    case ACCESS_COLUMNS:
+        return Vector2(((i / h) % w + 0.5) / w, (i % h + 0.5) / h);
+    case ACCESS_DIAGONAL:
+    {
+        real_t t = i % w;
+        real_t line = i / w;
+        return Vector2((t * 0.866 - line * 0.5) / w, (t * 0.5 + line * 0.866) / h);
+    }
+    default:
+        *rng = *rng * 1664525 + 1013904223;
+        real_t u = (*rng >> 8) / real_t(1 << 24);
+        *rng = *rng * 1664525 + 1013904223;
+        real_t v = (*rng >> 8) / real_t(1 << 24);
+        return Vector2(u, v);
+    }
+}
+
+// fetches per second of one layout and pattern, in the fastest of a few
+// runs. the sum of the fetched colors keeps them from being optimized away.
+static double time_fetches(const MemoryTexture& texture, AccessPattern pattern, Color3* sum)
+{
+    int width = texture.width();
+    int height = texture.height();
+    double best = INFINITY;
+
+    for (int run = 0; run < TEXTURE_RUNS; run++)
+    {
+        uint32_t rng = 1;
+        *sum = Color3::Black;
+
+        double start = CycleTimer::currentSeconds();
+
+        for (size_t i = 0; i < TEXTURE_SAMPLES; i++)
+        {
+            Vector2 coord = access_coord(pattern, i, width, height, &rng);
+            *sum += texture.sample_bilinear(0, coord);
+        }
+
+        best = min(best, CycleTimer::currentSeconds() - start);
+    }
+
+    return TEXTURE_SAMPLES / best;
+}
+
+static bool texture_benchmark(int argc, char* argv[])
+{
+    static const char* default_images[] = { "images/stones.png", "images/wood2.png" };
+    const char* const* images = argc > 0 ? argv : default_images;
+    int num_images = argc > 0 ? argc : 2;
+
+    for (int i = 0; i < num_images; i++)
+    {
+        int width, height;
+        unsigned char* data = imageio_load_image(images[i], &width, &height);
+        if (!data)
+        {
+            cout << "Cannot load texture file " << images[i] << endl;
+            return false;
+        }
+
+        double start = CycleTimer::currentSeconds();
+        MemoryTexture linear(data, width, height, TEXTURE_LINEAR);
+        double linear_time = CycleTimer::currentSeconds() - start;
+
+        start = CycleTimer::currentSeconds();
+        MemoryTexture tiled(data, width, height, TEXTURE_TILED);
+        double tiled_time = CycleTimer::currentSeconds() - start;
+        free(data);
+
+        cout << images[i] << " (" << width << "x" << height << "): pyramid built in "
+             << linear_time << "s linear, " << tiled_time << "s tiled" << endl;
+
+        for (int p = 0; p < NUM_ACCESS_PATTERNS; p++)
+        {
+            AccessPattern pattern = (AccessPattern) p;
+            Color3 linear_sum, tiled_sum;
+            double linear_rate = time_fetches(linear, pattern, &linear_sum);
+            double tiled_rate = time_fetches(tiled, pattern, &tiled_sum);
+
+            if (linear_sum != tiled_sum)
+            {
+                cout << "The layouts fetched different texels for "
+                     << access_pattern_names[p] << endl;
+                return false;
+            }
+
+            cout << "    " << access_pattern_names[p] << ": "
+                 << linear_rate / 1e6 << " Mfetch/s linear, "
+                 << tiled_rate / 1e6 << " Mfetch/s tiled ("
+                 << 100.0 * (tiled_rate / linear_rate - 1) << "%)" << endl;
+        }
+    }
+
+    return true;
+}
+
+// adds path if it is an obj file, or the obj files anywhere under it if it
+// is a directory
+static void find_obj_files(const string& path, vector<string>& files)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        if (path.size() > 4 && path.compare(path.size() - 4, 4, ".obj") == 0)
+        {
+            files.push_back(path);
+        }
+        return;
+    }
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+    {
+        return;
+    }
+
+    while (struct dirent* entry = readdir(dir))
+    {
+        if (entry->d_name[0] != '.')
+        {
+            find_obj_files(path + "/" + entry->d_name, files);
+        }
+    }
+
+    closedir(dir);
+}
+
+// seconds to load an obj file in the fastest of a few runs, or a negative
+// number if it doesn't load. the last run is left in mesh.
+static double time_obj_load(Mesh& mesh, ObjParser parser, int threads,
+                            VertexDedup dedup = VERTEX_DEDUP_HASH)
+{
+    double best = INFINITY;
+
+    for (int run = 0; run < OBJ_RUNS; run++)
+    {
+        double start = CycleTimer::currentSeconds();
+
+        if (!mesh.load_obj(parser, threads, dedup))
+        {
+            return -1;
+        }
+
+        best = min(best, CycleTimer::currentSeconds() - start);
+    }
+
+    return best;
+}
+
+static bool same_mesh(const Mesh& a, const Mesh& b)
+{
+    if (a.num_vertices() != b.num_vertices() || a.num_triangles() != b.num_triangles())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.num_vertices(); i++)
+    {
+        if (a.get_positions()[i] != b.get_positions()[i] ||
+            a.get_normals()[i] != b.get_normals()[i] ||
+            a.get_tex_coords()[i] != b.get_tex_coords()[i])
+        {
+            return false;
+        }
+    }
+
+    return a.num_triangles() == 0 ||
+        memcmp(a.get_triangles(), b.get_triangles(),
+               a.num_triangles() * sizeof(MeshTriangle)) == 0;
+}
+
+static bool obj_benchmark(int argc, char* argv[])
+{
+    vector<string> files;
+    if (argc == 0)
+    {
+        find_obj_files("models", files);
+    }
+    for (int i = 0; i < argc; i++)
+    {
+        find_obj_files(argv[i], files);
+    }
+    sort(files.begin(), files.end());
+
+    if (files.empty())
+    {
+        cout << "No obj files to load" << endl;
+        return false;
+    }
+
+    // at least 2 so files large enough to be cut are parsed in chunks even
+    // on one core
+    int threads = max(2u, thread::hardware_concurrency());
+    double stream_total = 0;
+    double mapped_total = 0;
+    double parallel_total = 0;
+    double bytes_total = 0;
+    bool same = true;
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        struct stat st;
+        double bytes = stat(files[i].c_str(), &st) == 0 ? st.st_size : 0;
+
+        Mesh stream_mesh, mapped_mesh, parallel_mesh;
+        stream_mesh.filename = files[i];
+        mapped_mesh.filename = files[i];
+        parallel_mesh.filename = files[i];
+        double stream_time = time_obj_load(stream_mesh, OBJ_PARSER_STREAM, 1);
+        double mapped_time = time_obj_load(mapped_mesh, OBJ_PARSER_MAPPED, 1);
+        double parallel_time = time_obj_load(parallel_mesh, OBJ_PARSER_MAPPED, threads);
+
+        if (stream_time < 0 && mapped_time < 0 && parallel_time < 0)
+        {
+            cout << files[i] << ": does not load" << endl;
+            continue;
+        }
+
+        if (stream_time < 0 || mapped_time < 0 || parallel_time < 0)
+        {
+            cout << files[i] << ": only loads with some of the parsers" << endl;
+            same = false;
+            continue;
+        }
+
+        if (!same_mesh(stream_mesh, mapped_mesh) || !same_mesh(stream_mesh, parallel_mesh))
+        {
+            cout << files[i] << ": the parsers loaded different meshes" << endl;
+            same = false;
+        }
+
+        stream_total += stream_time;
+        mapped_total += mapped_time;
+        parallel_total += parallel_time;
+        bytes_total += bytes;
+
+        cout << files[i] << " (" << bytes / 1e3 << " kB, "
+             << mapped_mesh.num_triangles() << " triangles): "
+             << stream_time * 1e3 << " ms stream, " << mapped_time * 1e3 << " ms mapped ("
+             << stream_time / mapped_time << "x, " << bytes / mapped_time / 1e6
+             << " MB/s), " << parallel_time * 1e3 << " ms on " << threads << " threads ("
+             << stream_time / parallel_time << "x)" << endl;
+    }
+
+    if (mapped_total > 0)
+    {
+        cout << "Total: " << bytes_total / 1e6 << " MB in " << stream_total << "s stream, "
+             << mapped_total << "s mapped, " << parallel_total << "s on " << threads
+             << " threads (" << bytes_total / stream_total / 1e6 << ", "
+             << bytes_total / mapped_total / 1e6 << " and "
+             << bytes_total / parallel_total / 1e6 << " MB/s)" << endl;
+    }
+
+    return same;
+}
+
+// a field of /proc/self/status in bytes, like VmRSS or VmHWM
+static size_t memory_status(const char* field)
+{
+    ifstream status("/proc/self/status");
+    string line;
+    size_t length = strlen(field);
+
+    while (getline(status, line))
+    {
+        if (line.compare(0, length, field) == 0 && line[length] == ':')
+        {
+            return strtoull(line.c_str() + length + 1, NULL, 10) * 1024;
+        }
+    }
+
+    return 0;
+}
+
+// how far loading an obj file raises the resident memory of the process
+// above what it was before, handing freed memory back first so loads
+// can't reuse what earlier ones left
+static size_t peak_obj_load_memory(const string& filename, VertexDedup dedup)
+{
+    malloc_trim(0);
+    // resets the peak (VmHWM) to the current resident size
+    ofstream("/proc/self/clear_refs") << "5";
+    size_t before = memory_status("VmRSS");
+
+    Mesh mesh;
+    mesh.filename = filename;
+    mesh.load_obj(OBJ_PARSER_MAPPED, 1, dedup);
+
+    size_t peak = memory_status("VmHWM");
+    return peak > before ? peak - before : 0;
+}
+
+static bool dedup_benchmark(int argc, char* argv[])
+{
+    vector<string> files;
+    if (argc == 0)
+    {
+        find_obj_files("models", files);
+    }
+    for (int i = 0; i < argc; i++)
+    {
+        find_obj_files(argv[i], files);
+    }
+    sort(files.begin(), files.end());
+
+    if (files.empty())
+    {
+        cout << "No obj files to load" << endl;
+        return false;
+    }
+
+    bool same = true;
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        Mesh map_mesh, hash_mesh;
+        map_mesh.filename = files[i];
+        hash_mesh.filename = files[i];
+        double map_time = time_obj_load(map_mesh, OBJ_PARSER_MAPPED, 1, VERTEX_DEDUP_MAP);
+        double hash_time = time_obj_load(hash_mesh, OBJ_PARSER_MAPPED, 1, VERTEX_DEDUP_HASH);
+
+        if (map_time < 0 || hash_time < 0)
+        {
+            cout << files[i] << ": does not load" << endl;
+            continue;
+        }
+
+        if (!same_mesh(map_mesh, hash_mesh))
+        {
+            cout << files[i] << ": the map and the hash table shared different vertices"
+                 << endl;
+            same = false;
+        }
+
+        size_t map_peak = peak_obj_load_memory(files[i], VERTEX_DEDUP_MAP);
+        size_t hash_peak = peak_obj_load_memory(files[i], VERTEX_DEDUP_HASH);
+
+        cout << files[i] << " (" << hash_mesh.num_triangles() << " triangles, "
+             << hash_mesh.num_vertices() << " vertices): "
+             << map_time * 1e3 << " ms with a map, " << hash_time * 1e3
+             << " ms with a hash table (" << map_time / hash_time << "x); peak memory "
+             << map_peak / 1e6 << " MB with a map, " << hash_peak / 1e6
+             << " MB with a hash table" << endl;
+    }
+
+    return same;
+}
+
+// writes a scene of the given number of objects, half spheres, a quarter
+// triangles and the rest models, spread over a grid with a few materials
+static bool write_generated_scene(const string& filename, size_t num_objects)
+{
+    ofstream file(filename.c_str());
+    if (!file)
+    {
+        return false;
+    }
+
+    size_t num_spheres = num_objects / 2;
+    size_t num_triangles = num_objects / 4;
+    uint32_t rng = 462;
+
+    file << "<scene>\n"
+            "    <camera>\n"
+            "        <fov v=\"1.0471975511\"/>\n"
+            "        <near_clip v=\".01\"/>\n"
+            "        <far_clip v=\"1000.0\"/>\n"
+            "        <position x=\"0.0\" y=\"10.0\" z=\"50.0\"/>\n"
+            "        <orientation a=\"0.0\" x=\"0.0\" y=\"1.0\" z=\"0.0\"/>\n"
+            "    </camera>\n"
+            "    <background_color r=\"0.2\" g=\"0.3\" b=\"0.4\"/>\n"
+            "    <refractive_index v=\"1.0\"/>\n"
+            "    <ambient_light r=\"0.1\" g=\"0.1\" b=\"0.1\"/>\n";
+
+    for (int i = 0; i < SCENE_LIGHTS; i++)
+    {
+        file << "    <point_light>\n"
+                "        <position x=\"" << i * 10.0 << "\" y=\"20.0\" z=\"" << -i * 5.0 << "\"/>\n"
+                "        <color r=\"0.5\" g=\"0.5\" b=\"0.5\"/>\n"
+                "        <attenuation_linear v=\"0.01\"/>\n"
+                "    </point_light>\n";
+    }
+
+    for (int i = 0; i < SCENE_MATERIALS; i++)
+    {
+        file << "    <material name=\"m" << i << "\"" << (i == 0 ? " texture=\"images/stones.png\"" : "")
+             << ">\n"
+                "        <refractive_index v=\"" << (i % 4 == 3 ? 1.5 : 0.0) << "\"/>\n"
+                "        <ambient r=\"" << i / 16.0 << "\" g=\"0.5\" b=\"0.25\"/>\n"
+                "        <diffuse r=\"0.75\" g=\"" << i / 16.0 << "\" b=\"0.5\"/>\n"
+                "        <specular r=\"0.1\" g=\"0.1\" b=\"0.1\"/>\n"
+                "        <shininess v=\"" << i + 1 << "\"/>\n"
+                "    </material>\n";
+    }
+
+    file << "    <mesh name=\"cube\" filename=\"models/cube.obj\"/>\n"
+            "    <mesh name=\"sphere\" filename=\"models/sphere.obj\"/>\n";
+
+    // three vertices of each triangle of their own
+    for (size_t i = 0; i < num_triangles * 3; i++)
+    {
+        rng = rng * 1664525 + 1013904223;
+        file << "    <vertex name=\"v" << i << "\" material=\"m" << rng % SCENE_MATERIALS << "\">\n"
+                "        <position x=\"" << (rng >> 8) % 1000 / 100.0 << "\" y=\"" << i % 7
+             << "\" z=\"" << (rng >> 16) % 100 / 10.0 << "\"/>\n"
+                "        <normal x=\"0.0\" y=\"1.0\" z=\"" << i % 3 / 4.0 << "\"/>\n"
+                "        <tex_coord u=\"" << i % 2 << "\" v=\"" << i % 3 / 2.0 << "\"/>\n"
+                "    </vertex>\n";
+    }
+
+    for (size_t i = 0; i < num_objects; i++)
+    {
+        rng = rng * 1664525 + 1013904223;
+        double x = (double) (i % 100) - 50, z = (double) (i / 100 % 100) - 50, y = (double) (i / 10000);
+        const char* kind = i < num_spheres ? "sphere" : i < num_spheres + num_triangles ? "triangle" : "model";
+
+        file << "    <" << kind << " material=\"m" << rng % SCENE_MATERIALS << "\"";
+        if (i >= num_spheres + num_triangles)
+        {
+            file << " mesh=\"" << (rng % 2 ? "cube" : "sphere") << "\"";
+        }
+        file << ">\n"
+                "        <position x=\"" << x << "\" y=\"" << y << "\" z=\"" << z << "\"/>\n"
+                "        <orientation a=\"" << (rng >> 8) % 628 / 100.0 << "\" x=\"0.0\" y=\"1.0\" z=\"0.5\"/>\n"
+                "        <scale x=\"0.5\" y=\"" << 0.25 + i % 4 * 0.25 << "\" z=\"0.5\"/>\n";
+
+        if (i < num_spheres)
+        {
+            file << "        <radius v=\"" << 0.1 + (rng >> 16) % 40 / 100.0 << "\"/>\n";
+        }
+        else if (i < num_spheres + num_triangles)
+        {
+            size_t v = (i - num_spheres) * 3;
+            file << "        <vertex name=\"v" << v << "\"/>\n"
+                    "        <vertex name=\"v" << v + 1 << "\"/>\n"
+                    "        <vertex name=\"v" << v + 2 << "\"/>\n";
+        }
+
+        file << "    </" << kind << ">\n";
+    }
+
+    file << "</scene>\n";
+    return file.good();
+}
+
+static double file_size(const string& filename)
+{
+    struct stat st;
+    return stat(filename.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+// seconds to load a scene in the fastest of a few runs, or a negative number
+// if it doesn't load. the last run is left in scene.
+static double time_scene_load(Scene& scene, const string& filename)
+{
+    double best = INFINITY;
+
+    for (int run = 0; run < SCENE_RUNS; run++)
+    {
+        double start = CycleTimer::currentSeconds();
+
+        if (!load_scene(&scene, filename.c_str()))
+        {
+            return -1;
+        }
+
+        best = min(best, CycleTimer::currentSeconds() - start);
+    }
+
+    return best;
+}
+
+template<typename T>
+static size_t index_of(T* const* items, size_t count, const T* item)
+{
+    return find(items, items + count, item) - items;
+}
+
+static bool same_geometry(const Scene& a, const Scene& b, size_t i)
+{
+    const Geometry* ga = a.get_geometries()[i];
+    const Geometry* gb = b.get_geometries()[i];
+    Material* const* ma = a.get_materials();
+    Material* const* mb = b.get_materials();
+    size_t n = a.num_materials();
+
+    if (ga->position != gb->position || ga->scale != gb->scale || ga->id != gb->id ||
+        ga->orientation.w != gb->orientation.w || ga->orientation.x != gb->orientation.x ||
+        ga->orientation.y != gb->orientation.y || ga->orientation.z != gb->orientation.z)
+    {
+        return false;
+    }
+
+    if (const Sphere* sa = dynamic_cast<const Sphere*>(ga))
+    {
+        const Sphere* sb = dynamic_cast<const Sphere*>(gb);
+        return sb && sa->radius == sb->radius &&
+            index_of(ma, n, sa->material) == index_of(mb, n, sb->material);
+    }
+
+    if (const Triangle* ta = dynamic_cast<const Triangle*>(ga))
+    {
+        const Triangle* tb = dynamic_cast<const Triangle*>(gb);
+        for (int j = 0; tb && j < 3; j++)
+        {
+            const Triangle::Vertex& va = ta->vertices[j];
+            const Triangle::Vertex& vb = tb->vertices[j];
+            if (va.position != vb.position || va.normal != vb.normal ||
+                va.tex_coord != vb.tex_coord ||
+                index_of(ma, n, va.material) != index_of(mb, n, vb.material))
+            {
+                return false;
+            }
+        }
+        return tb != 0;
+    }
+
+    const Model* pa = dynamic_cast<const Model*>(ga);
+    const Model* pb = dynamic_cast<const Model*>(gb);
+    return pa && pb && index_of(ma, n, pa->material) == index_of(mb, n, pb->material) &&
+        index_of(a.get_meshes(), a.num_meshes(), pa->mesh) ==
+        index_of(b.get_meshes(), b.num_meshes(), pb->mesh);
+}
+
+static bool same_scene(const Scene& a, const Scene& b)
+{
+    if (a.num_geometries() != b.num_geometries() || a.num_materials() != b.num_materials() ||
+        a.num_meshes() != b.num_meshes() || a.num_lights() != b.num_lights() ||
+        a.camera.position != b.camera.position || a.camera.fov != b.camera.fov ||
+        a.background_color != b.background_color || a.ambient_light != b.ambient_light ||
+        a.refractive_index != b.refractive_index)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.num_lights(); i++)
+    {
+        const PointLight& la = a.get_lights()[i];
+        const PointLight& lb = b.get_lights()[i];
+        if (la.position != lb.position || la.color != lb.color ||
+            la.attenuation.linear != lb.attenuation.linear)
+        {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < a.num_materials(); i++)
+    {
+        const Material* ma = a.get_materials()[i];
+        const Material* mb = b.get_materials()[i];
+        if (ma->ambient != mb->ambient || ma->diffuse != mb->diffuse ||
+            ma->specular != mb->specular || ma->shininess != mb->shininess ||
+            ma->refractive_index != mb->refractive_index ||
+            ma->texture_filename != mb->texture_filename)
+        {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < a.num_meshes(); i++)
+    {
+        if (a.get_meshes()[i]->name != b.get_meshes()[i]->name ||
+            a.get_meshes()[i]->filename != b.get_meshes()[i]->filename)
+        {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < a.num_geometries(); i++)
+    {
+        if (!same_geometry(a, b, i))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool scene_benchmark(int argc, char* argv[])
+{
+    static const char* const default_args[] = { "1000", "10000", "100000" };
+
+    vector<string> args(argv, argv + argc);
+    if (argc == 0)
+    {
+        args.assign(default_args, default_args + 3);
+    }
+
+    const char* tmpdir = getenv("TMPDIR");
+    ostringstream prefix;
+    prefix << (tmpdir ? tmpdir : "/tmp") << "/raytracer_scene_" << getpid();
+
+    double xml_total = 0;
+    double compiled_total = 0;
+    bool same = true;
+
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        // a number is the size of a scene to generate, anything else a scene file
+        char* end;
+        unsigned long long count = strtoull(args[i].c_str(), &end, 10);
+        bool generated = *end == '\0';
+        string xml_file = generated ? prefix.str() + ".scene" : args[i];
+        string compiled_file = prefix.str() + ".bscene";
+
+        if (generated && !write_generated_scene(xml_file, count))
+        {
+            cout << "Cannot write " << xml_file << endl;
+            remove(xml_file.c_str());
+            return false;
+        }
+
+        Scene xml_scene, compiled_scene;
+        double xml_time = time_scene_load(xml_scene, xml_file);
+        bool compiled = xml_time >= 0 && save_compiled_scene(xml_scene, compiled_file.c_str());
+        double compiled_time = compiled ? time_scene_load(compiled_scene, compiled_file) : -1;
+        double xml_bytes = file_size(xml_file);
+        double compiled_bytes = file_size(compiled_file);
+
+        if (generated)
+        {
+            remove(xml_file.c_str());
+        }
+        remove(compiled_file.c_str());
+
+        if (xml_time < 0)
+        {
+            cout << args[i] << ": does not load" << endl;
+            continue;
+        }
+
+        if (compiled_time < 0)
+        {
+            cout << args[i] << ": does not compile" << endl;
+            same = false;
+            continue;
+        }
+
+        if (!same_scene(xml_scene, compiled_scene))
+        {
+            cout << args[i] << ": the compiled scene differs from the xml" << endl;
+            same = false;
+        }
+
+        xml_total += xml_time;
+        compiled_total += compiled_time;
+
+        double objects = xml_scene.num_geometries();
+        cout << (generated ? "generated " : "") << args[i] << " (" << objects << " geometries, "
+             << xml_bytes / 1e3 << " kB xml, " << compiled_bytes / 1e3 << " kB compiled): "
+             << xml_time * 1e3 << " ms xml (" << objects / xml_time / 1e6 << " M/s), "
+             << compiled_time * 1e3 << " ms compiled (" << objects / compiled_time / 1e6
+             << " M/s, " << xml_time / compiled_time << "x)" << endl;
+    }
+
+    if (compiled_total > 0)
+    {
+        cout << "Total: " << xml_total << "s xml, " << compiled_total << "s compiled ("
+             << xml_total / compiled_total << "x)" << endl;
+    }
+
+    return same;
+}
+
+bool run_benchmark(const char* name, int argc, char* argv[])
+{
+    if (strcmp(name, "texture") == 0)
+    {
+        return texture_benchmark(argc, argv);
+    }
+
+    if (strcmp(name, "obj") == 0)
+    {
+        return obj_benchmark(argc, argv);
+    }
+
+    if (strcmp(name, "dedup") == 0)
+    {
+        return dedup_benchmark(argc, argv);
+    }
+
+    if (strcmp(name, "scene") == 0)
+    {
+        return scene_benchmark(argc, argv);
+    }
+
+    cout << "Unknown benchmark '" << name << "'\n";
+    return false;
+}
+
+}
+
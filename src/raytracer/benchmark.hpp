@@ -0,0 +1,34 @@
+#pragma once
+
+namespace _462
+{
+
+/**
+ * Runs one of the micro benchmarks on the given files and prints its
+ * results. The benchmarks are:
+ *
+ *   texture [image...]  texture fetch throughput of the row by row and the
+ *                       tiled texture layouts, for a few access patterns.
+ *                       Defaults to images/stones.png and images/wood2.png.
+ *
+ *   obj [path...]       load time of every obj file in the given files and
+ *                       directories with the memory mapped and the string
+ *                       stream parser, checking that they agree. Defaults to
+ *                       models.
+ *
+ *   dedup [path...]     load time and peak memory of the same obj files with
+ *                       the vertices faces share found in a hash table and
+ *                       in a std::map.
+ *
+ *   scene [count or file...]
+ *                       load time of scenes from xml and from the compiled
+ *                       scene file made from them, checking that they agree.
+ *                       A count generates a scene of that many objects.
+ *                       Defaults to 1000, 10000 and 100000.
+ *
+ * @return false if there is no such benchmark or it could not run.
+ */
+bool run_benchmark(const char* name, int argc, char* argv[]);
+
+}
+
@@ -2,6 +2,7 @@
 #include <vector>
 #include <algorithm>
 #include <limits>
+#include <cstring>
 #include "raytracer/CycleTimer.hpp"
 #include "raytracer/bvh.hpp"
 #include "scene/model.hpp"
@@ -100,12 +101,12 @@ Box::Box(const Mesh* mesh, vector<int>& indices, int n, int m)
         for (int j = 0; j < 3; j++)
         {
             int vidx = t.vertices[j];
-            MeshVertex v = mesh->get_vertices()[vidx];
+            const Vector3& position = mesh->get_positions()[vidx];
 
             for (int axis = 0; axis < 3; axis++)
             {
-                min_corner[axis] = min(min_corner[axis], v.position[axis]);
-                max_corner[axis] = max(max_corner[axis], v.position[axis]);
+                min_corner[axis] = min(min_corner[axis], position[axis]);
+                max_corner[axis] = max(max_corner[axis], position[axis]);
             }
         }
     }
@@ -277,6 +278,147 @@ BvhNode::~BvhNode()
         delete [] indices;
 }
 
+void BvhNode::save_records(vector<BvhRecord>& records) const
+{
+    BvhRecord record;
+    bool leaf = !left_node && !right_node;
+
+    // leaves never set their boxes, so save zeros instead
+    Box zero;
+    zero.min_corner = zero.max_corner = Vector3::Zero;
+    record.left_bbox = leaf ? zero : left_bbox;
+    record.right_bbox = leaf ? zero : right_bbox;
+    record.start_triangle = leaf ? start_triangle : 0;
+    record.end_triangle = leaf ? end_triangle : 0;
+    record.leaf = leaf;
+    record.padding = 0;
+    records.push_back(record);
+
+    if (!leaf)
+    {
+        left_node->save_records(records);
+        right_node->save_records(records);
+    }
+}
+
+void BvhNode::save(vector<unsigned char>& data) const
+{
+    vector<BvhRecord> records;
+    save_records(records);
+
+    uint32_t counts[2] = { (uint32_t) mesh->num_triangles(), (uint32_t) records.size() };
+    // the nodes start 8 byte aligned
+    size_t order_size = (counts[0] * sizeof(int32_t) + 7) & ~(size_t) 7;
+
+    data.assign(sizeof counts + order_size + records.size() * sizeof(BvhRecord), 0);
+    memcpy(&data[0], counts, sizeof counts);
+    memcpy(&data[sizeof counts], indices[0].data(), counts[0] * sizeof(int32_t));
+    memcpy(&data[sizeof counts + order_size], records.data(), records.size() * sizeof(BvhRecord));
+}
+
+BvhNode::BvhNode(const Mesh* _mesh, vector<int>* _indices, const BvhRecord& record, bool& valid)
+    : indices(_indices), mesh(_mesh), left_node(NULL), right_node(NULL),
+      start_triangle(0), end_triangle(0), root(false)
+{
+    if (record.leaf)
+    {
+        start_triangle = record.start_triangle;
+        end_triangle = record.end_triangle;
+        valid = valid && 0 <= start_triangle && start_triangle <= end_triangle &&
+            end_triangle <= (int) mesh->num_triangles();
+        return;
+    }
+
+    left_bbox = record.left_bbox;
+    right_bbox = record.right_bbox;
+}
+
+// saved hierarchies deeper than this are damaged; the ones build makes stay
+// within a few times log2 of their triangles
+static size_t max_saved_depth(size_t num_triangles)
+{
+    size_t depth = 64;
+    for (size_t n = num_triangles; n > 1; n >>= 1)
+    {
+        depth += 2;
+    }
+    return depth;
+}
+
+BvhNode* BvhNode::load(const Mesh* mesh, const unsigned char* data, size_t size)
+{
+    uint32_t counts[2];
+    if (size < sizeof counts)
+    {
+        return NULL;
+    }
+    memcpy(counts, data, sizeof counts);
+
+    size_t order_size = ((size_t) counts[0] * sizeof(int32_t) + 7) & ~(size_t) 7;
+    if (counts[0] != mesh->num_triangles() || counts[1] == 0 ||
+        size != sizeof counts + order_size + (size_t) counts[1] * sizeof(BvhRecord))
+    {
+        return NULL;
+    }
+
+    vector<int>* indices = new vector<int>[3];
+    indices[0].resize(counts[0]);
+    memcpy(indices[0].data(), data + sizeof counts, counts[0] * sizeof(int32_t));
+
+    bool valid = true;
+    for (size_t i = 0; i < counts[0]; i++)
+    {
+        valid = valid && indices[0][i] >= 0 && indices[0][i] < (int) counts[0];
+    }
+
+    // the nodes are rebuilt from a stack of the links still to fill rather
+    // than by recursion, so a damaged file can't run the stack out
+    const BvhRecord* records = (const BvhRecord*) (data + sizeof counts + order_size);
+    size_t max_depth = max_saved_depth(counts[0]);
+    BvhNode* root = NULL;
+    vector<pair<BvhNode**, size_t> > links(1, make_pair(&root, (size_t) 1));
+    size_t next = 0;
+
+    while (!links.empty() && valid)
+    {
+        BvhNode** link = links.back().first;
+        size_t depth = links.back().second;
+        links.pop_back();
+
+        if (next >= counts[1] || depth > max_depth)
+        {
+            valid = false;
+            break;
+        }
+
+        BvhRecord record;
+        memcpy(&record, &records[next++], sizeof record);
+        *link = new BvhNode(mesh, indices, record, valid);
+
+        // the left subtree is saved first, so it is filled first
+        if (!record.leaf)
+        {
+            links.push_back(make_pair(&(*link)->right_node, depth + 1));
+            links.push_back(make_pair(&(*link)->left_node, depth + 1));
+        }
+    }
+
+    if (!root)
+    {
+        delete [] indices;
+        return NULL;
+    }
+    root->root = true;
+
+    if (!valid || next != counts[1])
+    {
+        delete root;
+        return NULL;
+    }
+
+    return root;
+}
+
 void BvhNode::print()
 {
     cout << "{";
@@ -309,6 +451,16 @@ void BvhNode::print()
 
 void BvhNode::intersect_packet(const Packet& packet, BvhNode::IsectInfo *info, bool *intersected)
 {
+    if (packet.occupancy)
+    {
+        packet.occupancy->node_visits++;
+
+        for (int i = 0; i < rays_per_packet; i++)
+        {
+            packet.occupancy->active_rays += intersected[i];
+        }
+    }
+
     // leaf node
     if (!left_node && !right_node)
     {
@@ -405,9 +557,9 @@ bool BvhNode::intersect_leaf(const Vector3& eye, const Vector3& ray,
         v0 = triangle.vertices[0];
         v1 = triangle.vertices[1];
         v2 = triangle.vertices[2];
-        p0 = mesh->get_vertices()[v0].position;
-        p1 = mesh->get_vertices()[v1].position;
-        p2 = mesh->get_vertices()[v2].position;
+        p0 = mesh->get_positions()[v0];
+        p1 = mesh->get_positions()[v1];
+        p2 = mesh->get_positions()[v2];
 
         if (triangle_ray_intersect(eye, ray, p0, p1, p2, min_time,
                                    min_gamma, min_beta))
@@ -483,9 +635,9 @@ void BvhNode::intersect_leaf_simd(const Packet& packet, BvhNode::IsectInfo *info
         v1 = triangle.vertices[1];
         v2 = triangle.vertices[2];
 
-        to_ispc(mesh->get_vertices()[v0].position, p0);
-        to_ispc(mesh->get_vertices()[v1].position, p1);
-        to_ispc(mesh->get_vertices()[v2].position, p2);
+        to_ispc(mesh->get_positions()[v0], p0);
+        to_ispc(mesh->get_positions()[v1], p1);
+        to_ispc(mesh->get_positions()[v2], p2);
 
         for (int i = 0; i < rays_per_packet; i++)
         {
@@ -540,9 +692,9 @@ bool BvhNode::intersect_ray(const Ray& ray, BvhNode::IsectInfo& info)
             v0 = triangle.vertices[0];
             v1 = triangle.vertices[1];
             v2 = triangle.vertices[2];
-            p0 = mesh->get_vertices()[v0].position;
-            p1 = mesh->get_vertices()[v1].position;
-            p2 = mesh->get_vertices()[v2].position;
+            p0 = mesh->get_positions()[v0];
+            p1 = mesh->get_positions()[v1];
+            p2 = mesh->get_positions()[v2];
 
             if (triangle_ray_intersect(ray.eye, ray.dir, p0, p1, p2, info.time,
                                        info.gamma, info.beta))
@@ -570,10 +722,10 @@ bool BvhNode::intersect_ray(const Ray& ray, BvhNode::IsectInfo& info)
     return ret;
 }
 
-// this test will exit early if any triangle is hit
-bool BvhNode::shadow_test(const Ray& ray)
+// this test will exit early if any triangle is hit, setting triangle (if not
+// null) to the one hit
+bool BvhNode::shadow_test(const Ray& ray, size_t* triangle_hit)
 {
-    bool ret = false;
     BvhNode::IsectInfo info;
 
     if (!left_node && !right_node)
@@ -587,13 +739,17 @@ bool BvhNode::shadow_test(const Ray& ray)
             v0 = triangle.vertices[0];
             v1 = triangle.vertices[1];
             v2 = triangle.vertices[2];
-            p0 = mesh->get_vertices()[v0].position;
-            p1 = mesh->get_vertices()[v1].position;
-            p2 = mesh->get_vertices()[v2].position;
+            p0 = mesh->get_positions()[v0];
+            p1 = mesh->get_positions()[v1];
+            p2 = mesh->get_positions()[v2];
 
             if (triangle_ray_intersect(ray.eye, ray.dir, p0, p1, p2, info.time,
                                        info.gamma, info.beta))
             {
+                if (triangle_hit)
+                {
+                    *triangle_hit = indices[0][s];
+                }
                 return true;
             }
         }
@@ -601,26 +757,15 @@ bool BvhNode::shadow_test(const Ray& ray)
         return false;
     }
 
-    if (left_bbox.intersect_ray(ray.eye, ray.dir))
-    {
-        bool l_inter = left_node->intersect_ray(ray, info);
-        ret = ret || l_inter;
-
-    }
-
     // no need to check the right side if left intersected
-    if (ret)
+    if (left_bbox.intersect_ray(ray.eye, ray.dir) &&
+        left_node->shadow_test(ray, triangle_hit))
     {
         return true;
     }
 
-    if (right_bbox.intersect_ray(ray.eye, ray.dir))
-    {
-        bool r_inter = right_node->intersect_ray(ray, info);
-        ret = ret || r_inter;
-    }
-
-    return ret;
+    return right_bbox.intersect_ray(ray.eye, ray.dir) &&
+        right_node->shadow_test(ray, triangle_hit);
 }
 
 }
@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <limits>
+#include <stdint.h>
 #include "scene/mesh.hpp"
 #include "geom_utils.hpp"
 #include "raytracer/ray.hpp"
@@ -40,6 +41,17 @@ public:
     Vector3 get_centroid();
 };
 
+// a node of a saved hierarchy; nodes are saved depth first, each followed
+// by its left and then its right subtree
+struct BvhRecord
+{
+    Box left_bbox, right_bbox;
+    int32_t start_triangle, end_triangle;
+    // 1 for leaves, whose boxes are zero
+    int32_t leaf;
+    int32_t padding;
+};
+
 class BvhNode
 {
 public:
@@ -71,8 +83,26 @@ public:
     bool intersect_leaf(const Vector3& eye, const Vector3& ray, float& min_time, size_t& min_index,
                             float& min_beta, float& min_gamma);
     void intersect_leaf_simd(const Packet& packet, BvhNode::IsectInfo *infos, bool *intersected);
-    bool shadow_test(const Ray& ray);
+    bool shadow_test(const Ray& ray, size_t* triangle);
     void print();
+
+    /**
+     * Saves the hierarchy under this root node: the number of triangles
+     * and of nodes, the triangle order of the leaves, then the nodes.
+     */
+    void save(std::vector<unsigned char>& data) const;
+
+    /**
+     * Rebuilds a hierarchy saved for the same mesh by save.
+     * @return null if the data doesn't fit the mesh.
+     */
+    static BvhNode* load(const Mesh* mesh, const unsigned char* data, size_t size);
+
+private:
+
+    // one saved node, without its children
+    BvhNode(const Mesh* _mesh, std::vector<int>* _indices, const BvhRecord& record, bool& valid);
+    void save_records(std::vector<BvhRecord>& records) const;
 };
 
 }
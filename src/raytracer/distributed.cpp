@@ -0,0 +1,376 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <csignal>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "raytracer/distributed.hpp"
+#include "raytracer/raytracer.hpp"
+#include "raytracer/CycleTimer.hpp"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// jobs per worker, so a slow or restarted worker doesn't hold up the end
+#define JOBS_PER_WORKER 4
+// total number of times dead workers are replaced before giving up
+#define MAX_WORKER_RESTARTS 4
+// a band may take this many times as long as the slowest band finished so
+// far before its worker counts as hung, if that is longer than the timeout
+#define JOB_TIMEOUT_FACTOR 4
+
+using namespace std;
+
+namespace _462
+{
+
+// a band of rows; sent as the request and echoed back before the pixels
+struct RowRange
+{
+    uint32_t y_start;
+    uint32_t y_end;
+};
+
+struct WorkerProcess
+{
+    WorkerProcess() : pid(-1), fd(-1), job(-1), job_start(0) { }
+
+    pid_t pid;
+    // coordinator's end of the socket, -1 if the worker is gone
+    int fd;
+    // index of the job being rendered, -1 if idle
+    int job;
+    // when the job was sent
+    double job_start;
+};
+
+static bool write_fully(int fd, const void* data, size_t size)
+{
+    const char* p = (const char*) data;
+
+    while (size > 0)
+    {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n <= 0)
+        {
+            return false;
+        }
+
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool read_fully(int fd, void* data, size_t size)
+{
+    char* p = (char*) data;
+
+    while (size > 0)
+    {
+        ssize_t n = read(fd, p, size);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n <= 0)
+        {
+            return false;
+        }
+
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+// body of a worker process: render whatever rows are asked for until the
+// coordinator hangs up
+static void worker_loop(int fd, Raytracer* raytracer, unsigned char* buffer,
+                        size_t width, size_t height, int numthreads)
+{
+    RowRange range;
+
+    while (read_fully(fd, &range, sizeof range))
+    {
+        if (range.y_start >= range.y_end || range.y_end > height)
+        {
+            break;
+        }
+
+        raytracer->raytrace_rows(buffer, 0, numthreads, range.y_start, range.y_end);
+
+        if (!write_fully(fd, &range, sizeof range) ||
+            !write_fully(fd, buffer + 4 * width * range.y_start,
+                         4 * width * (range.y_end - range.y_start)))
+        {
+            break;
+        }
+    }
+}
+
+static bool spawn_worker(vector<WorkerProcess>& workers, int index,
+                         Raytracer* raytracer, unsigned char* buffer,
+                         size_t width, size_t height, int numthreads, double job_timeout)
+{
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        cout << "Could not create socket for worker " << index << endl;
+        return false;
+    }
+
+    // don't let the child flush our buffered output a second time
+    cout.flush();
+
+    pid_t pid = fork();
+
+    if (pid < 0)
+    {
+        cout << "Could not fork worker " << index << endl;
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        // drop the other workers' sockets, or they would never see the
+        // coordinator hang up
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            if (workers[i].fd >= 0)
+            {
+                close(workers[i].fd);
+            }
+        }
+
+        close(fds[0]);
+        worker_loop(fds[1], raytracer, buffer, width, height, numthreads);
+        cout.flush();
+        _exit(0);
+    }
+
+    close(fds[1]);
+
+    // a worker that hangs halfway through sending its rows fails the read
+    // instead of blocking it
+    struct timeval timeout;
+    timeout.tv_sec = (time_t) job_timeout;
+    timeout.tv_usec = (suseconds_t) ((job_timeout - timeout.tv_sec) * 1e6);
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    workers[index].pid = pid;
+    workers[index].fd = fds[0];
+    workers[index].job = -1;
+
+    return true;
+}
+
+static void stop_worker(WorkerProcess& worker, bool kill_it)
+{
+    if (worker.fd >= 0)
+    {
+        close(worker.fd);
+        worker.fd = -1;
+    }
+
+    if (worker.pid > 0)
+    {
+        if (kill_it)
+        {
+            kill(worker.pid, SIGKILL);
+        }
+
+        waitpid(worker.pid, NULL, 0);
+        worker.pid = -1;
+    }
+
+    worker.job = -1;
+}
+
+bool raytrace_distributed(Raytracer* raytracer, unsigned char* buffer,
+                          size_t width, size_t height,
+                          int num_workers, int numthreads, double job_timeout)
+{
+    double start = CycleTimer::currentSeconds();
+
+    // cut the image into bands of whole packets
+    size_t rows_per_job = height / (num_workers * JOBS_PER_WORKER);
+    rows_per_job = ((rows_per_job + packet_dim - 1) / packet_dim) * packet_dim;
+    rows_per_job = rows_per_job > 0 ? rows_per_job : packet_dim;
+
+    vector<RowRange> jobs;
+    deque<int> pending;
+
+    for (size_t y = 0; y < height; y += rows_per_job)
+    {
+        RowRange range;
+        range.y_start = y;
+        range.y_end = min(height, y + rows_per_job);
+        pending.push_back(jobs.size());
+        jobs.push_back(range);
+    }
+
+    vector<WorkerProcess> workers(num_workers);
+    size_t remaining = jobs.size();
+    int restarts = 0;
+    int timeouts = 0;
+    // seconds the slowest band took so far
+    double slowest_job = 0;
+
+    for (int i = 0; i < num_workers; i++)
+    {
+        spawn_worker(workers, i, raytracer, buffer, width, height, numthreads, job_timeout);
+    }
+
+    while (remaining > 0)
+    {
+        vector<struct pollfd> fds;
+        vector<int> polled;
+
+        for (int i = 0; i < num_workers; i++)
+        {
+            WorkerProcess& worker = workers[i];
+
+            if (worker.fd < 0)
+            {
+                continue;
+            }
+
+            // hand out the next band to idle workers
+            if (worker.job < 0 && !pending.empty())
+            {
+                worker.job = pending.front();
+                worker.job_start = CycleTimer::currentSeconds();
+                pending.pop_front();
+
+                if (!write_fully(worker.fd, &jobs[worker.job], sizeof(RowRange)))
+                {
+                    // picked up below as a failure once polled
+                    cout << "Could not send rows to worker " << i << endl;
+                }
+            }
+
+            if (worker.job >= 0)
+            {
+                struct pollfd pfd;
+                pfd.fd = worker.fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                fds.push_back(pfd);
+                polled.push_back(i);
+            }
+        }
+
+        if (fds.empty())
+        {
+            cout << "No workers left with " << remaining << " bands to render.\n";
+            break;
+        }
+
+        // wake up when the first busy worker runs out of time
+        double allowed = max(job_timeout, JOB_TIMEOUT_FACTOR * slowest_job);
+        double first_deadline = INFINITY;
+        for (size_t p = 0; p < polled.size(); p++)
+        {
+            first_deadline = min(first_deadline, workers[polled[p]].job_start + allowed);
+        }
+        double wait = max(0.0, first_deadline - CycleTimer::currentSeconds());
+        int timeout_ms = (int) min(wait * 1000 + 1, (double) INT_MAX);
+
+        if (poll(&fds[0], fds.size(), timeout_ms) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            cout << "poll failed while waiting for workers.\n";
+            break;
+        }
+
+        double now = CycleTimer::currentSeconds();
+
+        for (size_t p = 0; p < fds.size(); p++)
+        {
+            int i = polled[p];
+            WorkerProcess& worker = workers[i];
+            const RowRange& job = jobs[worker.job];
+
+            if (fds[p].revents)
+            {
+                RowRange reply;
+                bool ok = read_fully(worker.fd, &reply, sizeof reply) &&
+                    reply.y_start == job.y_start && reply.y_end == job.y_end &&
+                    read_fully(worker.fd, buffer + 4 * width * job.y_start,
+                               4 * width * (job.y_end - job.y_start));
+
+                if (ok)
+                {
+                    slowest_job = max(slowest_job, CycleTimer::currentSeconds() - worker.job_start);
+                    worker.job = -1;
+                    remaining--;
+                    continue;
+                }
+
+                // the worker died or sent garbage: redo its band elsewhere
+                cout << "Worker " << i << " failed on rows " << job.y_start
+                     << "-" << job.y_end << ", retrying." << endl;
+            }
+            else if (now >= worker.job_start + allowed)
+            {
+                // the worker hangs: kill it and redo its band elsewhere
+                timeouts++;
+                cout << "Worker " << i << " timed out after " << now - worker.job_start
+                     << "s on rows " << job.y_start << "-" << job.y_end << ", retrying." << endl;
+            }
+            else
+            {
+                continue;
+            }
+
+            pending.push_front(worker.job);
+            stop_worker(worker, true);
+
+            if (restarts < MAX_WORKER_RESTARTS)
+            {
+                restarts++;
+                spawn_worker(workers, i, raytracer, buffer, width, height, numthreads, job_timeout);
+            }
+        }
+    }
+
+    for (int i = 0; i < num_workers; i++)
+    {
+        stop_worker(workers[i], false);
+    }
+
+    cout << num_workers << " Distributed time: " << CycleTimer::currentSeconds() - start
+         << " (" << jobs.size() << " bands, " << restarts << " worker restarts, "
+         << timeouts << " timeouts)" << endl;
+
+    return remaining == 0;
+}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+
+namespace _462
+{
+
+class Raytracer;
+
+/**
+ * Renders the whole image with local worker processes. The calling process
+ * is the coordinator: it forks num_workers workers (which inherit the
+ * already loaded and initialized scene), hands out bands of rows over Unix
+ * domain sockets and copies the returned pixels into buffer. A band whose
+ * worker dies, or hangs past its deadline and is killed, is put back in the
+ * queue and the worker is restarted, up to a fixed number of times.
+ * @param raytracer An initialized raytracer for the scene.
+ * @param buffer The RGBA buffer to assemble the image in.
+ * @param num_workers The number of worker processes.
+ * @param numthreads The number of threads each worker traces with.
+ * @param job_timeout Seconds a worker may take over a band before it is
+ *  taken for hung, or a few times the slowest band so far if longer.
+ * @return true if every band was rendered.
+ */
+bool raytrace_distributed(Raytracer* raytracer, unsigned char* buffer,
+                          size_t width, size_t height,
+                          int num_workers, int numthreads, double job_timeout);
+
+}
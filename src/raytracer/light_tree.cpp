@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <cmath>
+#include "raytracer/light_tree.hpp"
+
+#define LEAF_SIZE 4
+
+using namespace std;
+
+namespace _462
+{
+
+static real_t brightest_channel(const Color3& c)
+{
+    return max(c.r, max(c.g, c.b));
+}
+
+static real_t attenuation_at(const PointLight& light, real_t distance)
+{
+    return light.attenuation.constant + light.attenuation.linear * distance +
+        light.attenuation.quadratic * distance * distance;
+}
+
+// the distance at which a light's contribution drops to cutoff: where
+// attenuation reaches brightness / cutoff. 0 if it never gets that bright,
+// infinite if it never gets that faint.
+static real_t light_radius(const PointLight& light, real_t cutoff)
+{
+    if (cutoff <= 0)
+    {
+        return INFINITY;
+    }
+
+    const PointLight::Attenuation& a = light.attenuation;
+    real_t target = brightest_channel(light.color) / cutoff;
+
+    if (a.constant >= target)
+    {
+        return 0;
+    }
+    else if (a.quadratic > 0)
+    {
+        return (-a.linear + sqrt(a.linear * a.linear -
+                                 4 * a.quadratic * (a.constant - target))) / (2 * a.quadratic);
+    }
+    else if (a.linear > 0)
+    {
+        return (target - a.constant) / a.linear;
+    }
+
+    return INFINITY;
+}
+
+struct sphere_less
+{
+    size_t axis;
+    sphere_less(size_t _axis) : axis(_axis) { }
+
+    template <typename S>
+    bool operator()(const S& a, const S& b) const
+    {
+        if (a.center[axis] == b.center[axis])
+            return a.light < b.light;
+
+        return a.center[axis] < b.center[axis];
+    }
+};
+
+void LightTree::build(const PointLight* _lights, size_t _num_lights, real_t cutoff)
+{
+    lights = _lights;
+    num_lights = _num_lights;
+    nodes.clear();
+    spheres.clear();
+    unbounded.clear();
+
+    for (size_t i = 0; i < num_lights; i++)
+    {
+        real_t radius = light_radius(lights[i], cutoff);
+
+        if (radius == INFINITY)
+        {
+            unbounded.push_back(i);
+        }
+        else if (radius > 0)
+        {
+            LightSphere sphere = { lights[i].position, radius * radius, (uint32_t) i };
+            spheres.push_back(sphere);
+        }
+    }
+
+    if (!spheres.empty())
+    {
+        build_node(0, spheres.size());
+    }
+}
+
+// builds the node over spheres [start, end) and its children, splitting at
+// the median center along the widest axis of the centers
+uint32_t LightTree::build_node(size_t start, size_t end)
+{
+    uint32_t index = nodes.size();
+    nodes.push_back(Node());
+
+    Vector3 min_corner(INFINITY, INFINITY, INFINITY);
+    Vector3 max_corner(-INFINITY, -INFINITY, -INFINITY);
+    Vector3 min_center = min_corner;
+    Vector3 max_center = max_corner;
+
+    for (size_t i = start; i < end; i++)
+    {
+        real_t radius = sqrt(spheres[i].radius2);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            real_t c = spheres[i].center[axis];
+            min_corner[axis] = min(min_corner[axis], c - radius);
+            max_corner[axis] = max(max_corner[axis], c + radius);
+            min_center[axis] = min(min_center[axis], c);
+            max_center[axis] = max(max_center[axis], c);
+        }
+    }
+
+    nodes[index].min_corner = min_corner;
+    nodes[index].max_corner = max_corner;
+
+    if (end - start <= LEAF_SIZE)
+    {
+        nodes[index].offset = start;
+        nodes[index].count = end - start;
+        return index;
+    }
+
+    Vector3 extent = max_center - min_center;
+    size_t axis = 0;
+    if (extent.y > extent[axis])
+        axis = 1;
+    if (extent.z > extent[axis])
+        axis = 2;
+
+    size_t mid = (start + end) / 2;
+    nth_element(spheres.begin() + start, spheres.begin() + mid, spheres.begin() + end,
+                sphere_less(axis));
+
+    // the left child follows its parent
+    build_node(start, mid);
+    uint32_t right = build_node(mid, end);
+    nodes[index].offset = right;
+    nodes[index].count = 0;
+
+    return index;
+}
+
+real_t LightTree::importance(size_t light, const Vector3& point, const Vector3& normal) const
+{
+    Vector3 direction = lights[light].position - point;
+    real_t distance = length(direction);
+    real_t front_face = dot(normal, direction) / distance;
+
+    if (!(front_face > 0))
+    {
+        return 0;
+    }
+
+    return front_face * brightest_channel(lights[light].color) /
+        attenuation_at(lights[light], distance);
+}
+
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include "scene/scene.hpp"
+
+namespace _462
+{
+
+// lights are culled where they can add less than this to a pixel
+const real_t default_light_cutoff = 1.0 / 512;
+// most lights sampled per shading point with stochastic light sampling
+const int max_light_samples = 64;
+
+/**
+ * A bounding volume hierarchy over the spheres the point lights of a scene
+ * reach. A light reaches as far as its contribution, before shadows and the
+ * angle of the surface, stays above a cutoff in some channel; lights without
+ * distance attenuation reach everywhere and are kept out of the tree.
+ */
+class LightTree
+{
+public:
+
+    LightTree() : lights(NULL), num_lights(0) { }
+
+    /**
+     * Builds the tree over the given lights, which have to outlive it.
+     * @param cutoff Lights are culled where they add less than this; 0
+     *  never culls.
+     */
+    void build(const PointLight* _lights, size_t _num_lights, real_t cutoff);
+
+    size_t num_nodes() const { return nodes.size(); }
+    size_t num_unbounded() const { return unbounded.size(); }
+    size_t num_culled() const { return num_lights - unbounded.size() - spheres.size(); }
+
+    /// calls f(light) for every light that reaches point
+    template <typename F>
+    void for_each_light(const Vector3& point, F& f) const;
+
+    /**
+     * Picks the lights to shade a point with, calling f(light, scale) for
+     * each. If at most samples lights reach the point (or samples is 0),
+     * that is every one of them with a scale of 1. Otherwise samples lights
+     * are drawn at random, each in proportion to its unoccluded contribution
+     * to the point, and scale weighs them so the expected sum is the same.
+     * The draws are seeded by the point, so images don't change from run to
+     * run.
+     * @return The number of lights that reach the point.
+     */
+    template <typename F>
+    size_t sample(const Vector3& point, const Vector3& normal, int samples, F& f) const;
+
+    /// the unoccluded contribution of a light to a point, in its brightest channel
+    real_t importance(size_t light, const Vector3& point, const Vector3& normal) const;
+
+private:
+
+    struct Node
+    {
+        // bounds of the spheres of the node's lights
+        Vector3 min_corner, max_corner;
+        // inner nodes: index of the right child (the left one follows the
+        // node); leaves: first of their spheres
+        uint32_t offset;
+        // spheres in a leaf, 0 for inner nodes
+        uint32_t count;
+    };
+
+    struct LightSphere
+    {
+        Vector3 center;
+        real_t radius2;
+        uint32_t light;
+    };
+
+    const PointLight* lights;
+    size_t num_lights;
+    std::vector<Node> nodes;
+    // the spheres of the tree's lights, in leaf order
+    std::vector<LightSphere> spheres;
+    // lights that reach everywhere
+    std::vector<uint32_t> unbounded;
+
+    uint32_t build_node(size_t start, size_t end);
+};
+
+template <typename F>
+void LightTree::for_each_light(const Vector3& point, F& f) const
+{
+    for (size_t i = 0; i < unbounded.size(); i++)
+    {
+        f(unbounded[i]);
+    }
+
+    if (nodes.empty())
+    {
+        return;
+    }
+
+    // halving splits keep the tree far shallower than this
+    uint32_t stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        uint32_t index = stack[--top];
+        const Node& node = nodes[index];
+
+        if (point.x < node.min_corner.x || point.x > node.max_corner.x ||
+            point.y < node.min_corner.y || point.y > node.max_corner.y ||
+            point.z < node.min_corner.z || point.z > node.max_corner.z)
+        {
+            continue;
+        }
+
+        if (node.count == 0)
+        {
+            stack[top++] = node.offset;
+            stack[top++] = index + 1;
+            continue;
+        }
+
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+        {
+            if (squared_length(point - spheres[i].center) <= spheres[i].radius2)
+            {
+                f(spheres[i].light);
+            }
+        }
+    }
+}
+
+// draws one light per reservoir, each in proportion to its importance, in a
+// single pass over the lights. the first few are also kept as they come, in
+// case there are no more of them than samples.
+struct LightReservoirs
+{
+    LightReservoirs(const LightTree& _tree, const Vector3& point, const Vector3& _normal,
+                    int _samples, uint32_t seed)
+        : tree(_tree), position(point), normal(_normal), samples(_samples),
+          rng(seed | 1), count(0), total(0) { }
+
+    const LightTree& tree;
+    const Vector3& position;
+    const Vector3& normal;
+    int samples;
+    uint32_t rng;
+    size_t count;
+    real_t total;
+    uint32_t first[max_light_samples];
+    uint32_t chosen[max_light_samples];
+    real_t chosen_importance[max_light_samples];
+
+    void operator()(uint32_t light)
+    {
+        if (count < (size_t) samples)
+        {
+            first[count] = light;
+        }
+        count++;
+
+        real_t w = tree.importance(light, position, normal);
+        if (w <= 0)
+        {
+            return;
+        }
+
+        total += w;
+        for (int s = 0; s < samples; s++)
+        {
+            // xorshift; the first light with any importance fills every
+            // reservoir since w / total is 1
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            if (rng * (1.0 / 4294967296.0) * total < w)
+            {
+                chosen[s] = light;
+                chosen_importance[s] = w;
+            }
+        }
+    }
+};
+
+// passes the lights picked for a point on, counting them. lights handed
+// over by for_each_light without a scale are shaded in full.
+template <typename F>
+struct LightCounter
+{
+    LightCounter(F& _f) : f(_f), count(0) { }
+    F& f;
+    size_t count;
+
+    void operator()(size_t light, real_t scale)
+    {
+        f(light, scale);
+        count++;
+    }
+
+    void operator()(uint32_t light)
+    {
+        (*this)(light, 1.0);
+    }
+};
+
+template <typename F>
+size_t LightTree::sample(const Vector3& point, const Vector3& normal, int samples, F& f) const
+{
+    if (samples <= 0)
+    {
+        LightCounter<F> counter(f);
+        for_each_light(point, counter);
+        return counter.count;
+    }
+
+    // seed with the bits of the point
+    uint64_t bits[3];
+    memcpy(&bits[0], &point.x, sizeof bits[0]);
+    memcpy(&bits[1], &point.y, sizeof bits[1]);
+    memcpy(&bits[2], &point.z, sizeof bits[2]);
+    uint64_t h = (bits[0] * 0x9E3779B97F4A7C15ull) ^ (bits[1] * 0xC2B2AE3D27D4EB4Full)
+                 ^ (bits[2] * 0x165667B19E3779F9ull);
+
+    LightReservoirs reservoirs(*this, point, normal, samples, (uint32_t) (h ^ (h >> 32)));
+    for_each_light(point, reservoirs);
+
+    if (reservoirs.count <= (size_t) samples)
+    {
+        for (size_t i = 0; i < reservoirs.count; i++)
+        {
+            f(reservoirs.first[i], 1.0);
+        }
+    }
+    else if (reservoirs.total > 0)
+    {
+        // each draw stands for total / (samples * importance) of its light.
+        // lights drawn more than once are shaded once with their draws
+        // added up.
+        for (int s = 0; s < samples; s++)
+        {
+            bool seen = false;
+            for (int t = 0; t < s && !seen; t++)
+            {
+                seen = reservoirs.chosen[t] == reservoirs.chosen[s];
+            }
+
+            if (!seen)
+            {
+                real_t scale = 0;
+                for (int t = s; t < samples; t++)
+                {
+                    if (reservoirs.chosen[t] == reservoirs.chosen[s])
+                    {
+                        scale += reservoirs.total /
+                            (samples * reservoirs.chosen_importance[t]);
+                    }
+                }
+                f(reservoirs.chosen[s], scale);
+            }
+        }
+    }
+
+    return reservoirs.count;
+}
+
+}
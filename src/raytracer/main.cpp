@@ -5,9 +5,20 @@
 #include "application/camera_roam.hpp"
 #include "application/imageio.hpp"
 #include "application/scene_loader.hpp"
+#include "application/scene_file.hpp"
 #include "application/opengl.hpp"
 #include "scene/scene.hpp"
+#include "scene/tile_cache.hpp"
+#include "scene/mesh.hpp"
+#include "scene/asset_loader.hpp"
+#include "raytracer/bvh.hpp"
+#include "raytracer/CycleTimer.hpp"
 #include "raytracer/raytracer.hpp"
+#include "raytracer/numa.hpp"
+#include "raytracer/distributed.hpp"
+#include "raytracer/batch.hpp"
+#include "raytracer/stream_output.hpp"
+#include "raytracer/benchmark.hpp"
 
 #ifdef __APPLE__
 #include <GLUT/glut.h>
@@ -20,8 +31,10 @@ namespace _462
 
 #define DEFAULT_WIDTH 800
 #define DEFAULT_HEIGHT 600
+#define DEFAULT_JOB_TIMEOUT 60.0
 
 #define BUFFER_SIZE(w,h) ( (size_t) ( 4 * (w) * (h) ) )
+#define HDR_BUFFER_SIZE(w,h) ( sizeof( float ) * 3 * (size_t) (w) * (h) )
 
 #define KEY_RAYTRACE SDLK_r
 #define KEY_SCREENSHOT SDLK_f
@@ -52,6 +65,32 @@ struct Options
     int width, height;
     // number of threads
     int numthreads;
+    // number of worker processes, 0 to trace in this process
+    int num_workers;
+    // seconds a worker process may take over a band before it is killed
+    double job_timeout;
+    // whether input_filename is a sequence file to render frame by frame
+    bool batch;
+    // whether meshes load in the background while the window already traces
+    bool streaming;
+    // zlib compression level of saved png images
+    int png_level;
+    // passes accumulated into the float framebuffer, 0 for just one pass
+    // without it unless the output file is a pfm
+    int passes;
+    // rows per band of the image streamed to the output file, 0 to trace
+    // the whole image into memory
+    int band_rows;
+    // micro benchmark to run instead of rendering, and its arguments
+    const char* benchmark;
+    int benchmark_argc;
+    char** benchmark_argv;
+    // obj file to compile into a mesh file instead of rendering, and the
+    // mesh file, null to name it after the obj file
+    const char* compile_input;
+    const char* compile_output;
+    // how the raytrace is scheduled across the threads
+    RaytraceOptions raytrace;
 };
 
 bool extras = false;
@@ -61,10 +100,12 @@ class RaytracerApplication : public Application
 public:
 
     RaytracerApplication( const Options& opt )
-        : options( opt ), buffer( 0 ), buf_width( 0 ), buf_height( 0 ), raytracing( false ) { }
+        : options( opt ), buffer( 0 ), hdr_buffer( 0 ), buf_width( 0 ), buf_height( 0 ),
+          raytracing( false ), streamed( false ) { }
     virtual ~RaytracerApplication()
     {
-        free( buffer );
+        framebuffer_free( buffer, BUFFER_SIZE( buf_width, buf_height ) );
+        framebuffer_free( (unsigned char*) hdr_buffer, HDR_BUFFER_SIZE( buf_width, buf_height ) );
     }
 
     virtual bool initialize();
@@ -77,11 +118,22 @@ public:
     void toggle_raytracing( int width, int height );
     // writes the current raytrace buffer to the output file
     void output_image();
+    // whether the passes are accumulated into hdr_buffer
+    bool accumulating() const
+    {
+        return options.passes > 0 ||
+               ( options.output_filename && imageio_is_pfm( options.output_filename ) );
+    }
 
     Raytracer raytracer;
 
     // the scene to render
     Scene scene;
+    // loads the meshes of the scene with -S; declared after the scene so
+    // it stops before the scene goes away
+    AssetStreamer streamer;
+    // meshes that have their opengl data, with -S
+    std::vector< bool > mesh_gl_ready;
 
     // options
     Options options;
@@ -91,6 +143,8 @@ public:
 
     // the image buffer for raytracing
     unsigned char* buffer;
+    // the passes accumulated so far, 3 floats per pixel, if accumulating
+    float* hdr_buffer;
     // width and height of the buffer
     int buf_width, buf_height;
 // true if we are in raytrace mode.
@@ -101,6 +155,9 @@ public:
     bool raytrace_finished;
 
     bool raytrace_key_update;
+
+    // whether the streamer has finished and been reported on
+    bool streamed;
 };
 
 bool RaytracerApplication::initialize()
@@ -116,24 +173,45 @@ bool RaytracerApplication::initialize()
         Material* const* materials = scene.get_materials();
         Mesh* const* meshes = scene.get_meshes();
 
-        // load all textures
-        for ( size_t i = 0; i < scene.num_materials(); ++i )
+        // load all textures and meshes at once, building the bvh of each
+        // model as soon as its mesh is in. streamed meshes are left to load
+        // while the window already traces.
+        bool streaming = options.streaming && load_gl;
+        std::vector< AssetEvent > timeline;
+        bool loaded = load_scene_assets( &scene, options.numthreads,
+                                         streaming ? LOAD_TEXTURES : LOAD_ALL, 0, &timeline );
+        print_asset_timeline( timeline );
+        if ( !loaded )
+        {
+            std::cout << "Error loading scene assets, aborting.\n";
+            return false;
+        }
+
+        if ( streaming && !streamer.start( &scene, options.numthreads ) )
+        {
+            std::cout << "Error finding the bounds of the meshes, aborting.\n";
+            return false;
+        }
+        mesh_gl_ready.assign( scene.num_meshes(), false );
+
+        // opengl data can only be made on this thread
+        for ( size_t i = 0; i < scene.num_materials() && load_gl; ++i )
         {
-            if ( !materials[i]->load() || ( load_gl && !materials[i]->create_gl_data() ) )
+            if ( !materials[i]->create_gl_data() )
             {
                 std::cout << "Error loading texture, aborting.\n";
                 return false;
             }
         }
 
-        // load all meshes
-        for ( size_t i = 0; i < scene.num_meshes(); ++i )
+        for ( size_t i = 0; i < scene.num_meshes() && load_gl && !streaming; ++i )
         {
-            if ( !meshes[i]->load() || ( load_gl && !meshes[i]->create_gl_data() ) )
+            if ( !meshes[i]->create_gl_data() )
             {
                 std::cout << "Error loading mesh, aborting.\n";
                 return false;
             }
+            mesh_gl_ready[i] = true;
         }
     }
     catch ( std::bad_alloc const& )
@@ -186,6 +264,32 @@ void RaytracerApplication::destroy()
 
 void RaytracerApplication::update( real_t delta_time )
 {
+    // meshes streamed in since the last frame get their opengl data here,
+    // on the thread with the context
+    if ( options.streaming && options.open_window )
+    {
+        Mesh* const* meshes = scene.get_meshes();
+        for ( size_t i = 0; i < mesh_gl_ready.size(); ++i )
+        {
+            if ( !mesh_gl_ready[i] && !meshes[i]->is_streaming() )
+            {
+                meshes[i]->create_gl_data();
+                mesh_gl_ready[i] = true;
+            }
+        }
+
+        if ( !streamed && streamer.done() )
+        {
+            std::vector< AssetEvent > timeline;
+            if ( !streamer.finish( &timeline ) )
+            {
+                std::cout << "Some meshes failed to load and stay boxes.\n";
+            }
+            print_asset_timeline( timeline );
+            streamed = true;
+        }
+    }
+
     if ( raytracing )
     {
         // do part of the raytrace
@@ -197,9 +301,24 @@ void RaytracerApplication::update( real_t delta_time )
 
         else //if (raytrace_key_update) // comment stuff after else on this line for continuous tracing
         {
+            Vector3 position = scene.camera.position;
+            Quaternion orientation = scene.camera.orientation;
             camera_control.update( delta_time );
             scene.camera = camera_control.camera;
-            raytrace_finished = raytracer.raytrace(buffer, &delta_time, options.numthreads);
+
+            // passes only add up while the camera stands still, and stop
+            // once there are enough of them
+            bool moved = position != scene.camera.position ||
+                         orientation != scene.camera.orientation;
+            if ( moved )
+            {
+                raytracer.reset_accumulation();
+            }
+            if ( moved || !hdr_buffer ||
+                 raytracer.accumulated_passes() < (size_t) std::max( 1, options.passes ) )
+            {
+                raytrace_finished = raytracer.raytrace(buffer, &delta_time, options.numthreads);
+            }
             raytrace_key_update = false;
         }
     }
@@ -288,11 +407,18 @@ void RaytracerApplication::toggle_raytracing( int width, int height )
     if ( !raytracing )
     {
 
-        // only re-allocate if the dimensions changed
-        if ( buf_width != width || buf_height != height )
+        // only re-allocate if the dimensions changed. streamed output
+        // traces into bands of its own.
+        if ( options.band_rows > 0 )
+        {
+            assert( !options.open_window );
+        }
+        else if ( buf_width != width || buf_height != height )
         {
-            free( buffer );
-            buffer = (unsigned char*) malloc( BUFFER_SIZE( width, height ) );
+            framebuffer_free( buffer, BUFFER_SIZE( buf_width, buf_height ) );
+            framebuffer_free( (unsigned char*) hdr_buffer, HDR_BUFFER_SIZE( buf_width, buf_height ) );
+            hdr_buffer = 0;
+            buffer = framebuffer_alloc( BUFFER_SIZE( width, height ) );
             if ( !buffer )
             {
                 std::cout << "Unable to allocate buffer.\n";
@@ -302,14 +428,25 @@ void RaytracerApplication::toggle_raytracing( int width, int height )
             buf_height = height;
         }
 
+        if ( accumulating() && !hdr_buffer )
+        {
+            hdr_buffer = (float*) framebuffer_alloc( HDR_BUFFER_SIZE( width, height ) );
+            if ( !hdr_buffer )
+            {
+                std::cout << "Unable to allocate hdr buffer.\n";
+                return;
+            }
+        }
+
         // initialize the raytracer (first make sure camera aspect is correct)
         scene.camera.aspect = real_t( width ) / real_t( height );
 
-        if ( !raytracer.initialize(&scene, width, height, extras) )
+        if ( !raytracer.initialize(&scene, width, height, extras, options.raytrace) )
         {
             std::cout << "Raytracer initialization failed.\n";
             return; // leave untoggled since initialization failed.
         }
+        raytracer.set_hdr_buffer( hdr_buffer );
 
         // reset flag that says we are done
         raytrace_finished = false;
@@ -341,9 +478,36 @@ void RaytracerApplication::output_image()
         filename = buf;
     }
 
-    if ( imageio_save_image( filename, buffer, buf_width, buf_height ) )
+    if ( imageio_is_pfm( filename ) )
+    {
+        double start = CycleTimer::currentSeconds();
+        if ( hdr_buffer && imageio_save_pfm( filename, hdr_buffer, buf_width, buf_height ) )
+        {
+            std::cout << "Saved " << raytracer.accumulated_passes() << " accumulated passes to '"
+                      << filename << "' in " << CycleTimer::currentSeconds() - start << "s.\n";
+        }
+        else
+        {
+            std::cout << "Error saving raytraced image to '" << filename << "'.\n";
+        }
+        return;
+    }
+
+    ImageioPngStats stats = ImageioPngStats();
+    double start = CycleTimer::currentSeconds();
+    if ( imageio_save_image( filename, buffer, buf_width, buf_height, &stats ) )
     {
         std::cout << "Saved raytraced image to '" << filename << "'.\n";
+        if ( stats.strips > 0 )
+        {
+            int threads = options.numthreads;
+            std::cout << threads << " Png time:      " << CycleTimer::currentSeconds() - start << std::endl
+                      << threads << " Filter time:   " << stats.filter_time << std::endl
+                      << threads << " Deflate time:  " << stats.deflate_time << std::endl
+                      << threads << " Write time:    " << stats.write_time << std::endl
+                      << threads << " Png size:      " << stats.bytes << " bytes ("
+                      << stats.strips << " strips, level " << options.png_level << ")" << std::endl;
+        }
     }
     else
     {
@@ -456,21 +620,253 @@ static void render_scene( const Scene& scene )
 
 using namespace _462;
 
+/**
+ * Compiles an obj file into a mesh file with its normals and bvh, which
+ * scenes can then load in place of the obj file.
+ */
+static bool compile_mesh( const char* input, const char* output )
+{
+    std::string filename = output ? output : input;
+    if ( !output )
+    {
+        size_t dot = filename.rfind( '.' );
+        if ( dot != std::string::npos && filename.compare( dot, std::string::npos, ".obj" ) == 0 )
+        {
+            filename.erase( dot );
+        }
+        filename += ".mesh";
+    }
+
+    double start = CycleTimer::currentSeconds();
+
+    Mesh mesh;
+    mesh.filename = input;
+    if ( !mesh.load( std::thread::hardware_concurrency() ) )
+    {
+        std::cout << "Error loading mesh " << input << "\n";
+        return false;
+    }
+    mesh.compute_normals();
+
+    double bvh_start = CycleTimer::currentSeconds();
+    BvhNode bvh( &mesh, 0, 0, 0 );
+    std::vector< unsigned char > bvh_data;
+    bvh.save( bvh_data );
+
+    double save_start = CycleTimer::currentSeconds();
+    if ( !mesh.save_compiled( filename, bvh_data ) )
+    {
+        std::cout << "Error writing mesh file " << filename << "\n";
+        return false;
+    }
+    double done = CycleTimer::currentSeconds();
+
+    std::cout << "Compiled " << input << " into " << filename << ": "
+              << mesh.num_vertices() << " vertices, " << mesh.num_triangles()
+              << " triangles, " << bvh_data.size() << " bytes of bvh\n"
+              << "Loading took  " << ( bvh_start - start ) << "s\n"
+              << "Bvh took      " << ( save_start - bvh_start ) << "s\n"
+              << "Writing took  " << ( done - save_start ) << "s\n";
+    return true;
+}
+
+static bool has_extension( const std::string& filename, const char* extension )
+{
+    size_t length = strlen( extension );
+    return filename.size() >= length &&
+        filename.compare( filename.size() - length, length, extension ) == 0;
+}
+
+/**
+ * Compiles a .scene file into a compiled scene file, which load_scene reads
+ * without parsing any xml.
+ */
+static bool compile_scene( const char* input, const char* output )
+{
+    std::string filename = output ? output : input;
+    if ( !output )
+    {
+        filename.erase( filename.size() - strlen( ".scene" ) );
+        filename += ".bscene";
+    }
+
+    double start = CycleTimer::currentSeconds();
+
+    Scene scene;
+    if ( !load_scene( &scene, input ) )
+    {
+        std::cout << "Error loading scene " << input << "\n";
+        return false;
+    }
+
+    double save_start = CycleTimer::currentSeconds();
+    if ( !save_compiled_scene( scene, filename.c_str() ) )
+    {
+        std::cout << "Error writing scene file " << filename << "\n";
+        return false;
+    }
+    double load_start = CycleTimer::currentSeconds();
+
+    // load it back, to time it against the xml
+    Scene compiled;
+    if ( !load_scene( &compiled, filename.c_str() ) )
+    {
+        std::cout << "Error loading scene file " << filename << " back\n";
+        return false;
+    }
+    double done = CycleTimer::currentSeconds();
+
+    std::cout << "Compiled " << input << " into " << filename << ": "
+              << scene.num_geometries() << " geometries, " << scene.num_materials()
+              << " materials, " << scene.num_meshes() << " meshes, "
+              << scene.num_lights() << " lights\n"
+              << "Loading took  " << ( save_start - start ) << "s\n"
+              << "Writing took  " << ( load_start - save_start ) << "s\n"
+              << "Reloading took " << ( done - load_start ) << "s\n";
+    return true;
+}
+
+/**
+ * Writes the tile file -M streams an image's texels from, without holding
+ * the image in memory.
+ */
+static bool compile_texture( const char* input, const char* output )
+{
+    std::string filename = output ? output : tile_file_name( input );
+
+    double start = CycleTimer::currentSeconds();
+    if ( !write_image_tile_file( filename, input ) )
+    {
+        std::cout << "Error making tile file " << filename << " from " << input
+                  << " (it must be a png that isn't interlaced)\n";
+        return false;
+    }
+    double done = CycleTimer::currentSeconds();
+
+    std::cout << "Compiled " << input << " into " << filename << "\n"
+              << "Writing took  " << ( done - start ) << "s\n";
+    return true;
+}
+
 /**
  * Prints program usage.
  */
 static void print_usage( const char* progname )
 {
-    std::cout << "Usage: " << progname << " [-r] [-d width height] input_scene [output_file]\n"
+    std::cout << "Usage: " << progname << " -B benchmark [args...]\n"
+              "       " << progname << " -P obj_file [mesh_file]\n"
+              "       " << progname << " -P scene_file [compiled_scene_file]\n"
+              "       " << progname << " -P png_image [tile_file]\n"
+              "       " << progname << " [-r] [-x] [-d width height] [-t order] [-s] [-a] [-p] [-N] [-w workers] [-W seconds] [-b] [-m mode] [-o] [-D depth] [-c weight] [-l cutoff] [-L samples] [-C] [-M megabytes] [-S] [-z level] [-A passes] [-R rows] input_scene [output_file]\n"
               "\n" \
               "Options:\n" \
               "\n" \
               "\t-r:\n" \
               "\t\tRaytraces the scene and saves to the output file without\n" \
               "\t\tloading a window or creating an opengl context.\n" \
+              "\t-x:\n" \
+              "\t\tEnables extras: adaptive anti-aliasing of edges and\n" \
+              "\t\thigh contrast pixels (packet mode only).\n" \
               "\t-d width height\n" \
               "\t\tThe dimensions of image to raytrace (and window if using\n" \
               "\t\tand opengl context. Defaults to width=800, height=600.\n" \
+              "\t-t order\n" \
+              "\t\tThe order tiles are handed to the worker threads, one of\n" \
+              "\t\traster, morton or hilbert. Defaults to raster.\n" \
+              "\t-s:\n" \
+              "\t\tGives each worker thread its own contiguous run of tiles\n" \
+              "\t\tinstead of sharing a single queue.\n" \
+              "\t-a:\n" \
+              "\t\tAdaptive tiling. Starts from large tiles and splits the ones\n" \
+              "\t\tthat are expensive or still queued at the end of a frame.\n" \
+              "\t-p:\n" \
+              "\t\tPins each worker thread to its own cpu.\n" \
+              "\t-N:\n" \
+              "\t\tNUMA aware scheduling. Each node traces its own band of the\n" \
+              "\t\timage with pinned workers and node-local framebuffer pages.\n" \
+              "\t-w workers\n" \
+              "\t\tWith -r, splits the image into bands of rows and renders them\n" \
+              "\t\tin the given number of worker processes. Bands of workers\n" \
+              "\t\tthat die are rendered again by a fresh worker.\n" \
+              "\t-W seconds\n" \
+              "\t\tWith -w, how long a worker may take over a band before it\n" \
+              "\t\tis taken for hung, killed and replaced. Defaults to 60.\n" \
+              "\t-b:\n" \
+              "\t\tBatch mode, implies -r. input_scene is a sequence file listing\n" \
+              "\t\tthe scene of each frame, and each frame is saved to its own\n" \
+              "\t\tnumbered output file. The next frame is loaded while the\n" \
+              "\t\tcurrent one is traced.\n" \
+              "\t-m mode\n" \
+              "\t\tHow rays are traced, one of packet (depth first, one packet\n" \
+              "\t\tat a time) or wavefront (breadth first, one bounce of a\n" \
+              "\t\twhole tile at a time). Defaults to packet.\n" \
+              "\t-o:\n" \
+              "\t\tSorts each bounce of secondary rays by direction and origin\n" \
+              "\t\tbefore tracing it. Implies -m wavefront.\n" \
+              "\t-D depth\n" \
+              "\t\tThe number of reflections and refractions followed from\n" \
+              "\t\teach primary ray, at most 16. Defaults to 3.\n" \
+              "\t-c weight\n" \
+              "\t\tReflected and refracted rays that would add less than this\n" \
+              "\t\tshare of their light to a pixel are not traced. Defaults to\n" \
+              "\t\t1/512; 0 traces every ray.\n" \
+              "\t-l cutoff\n" \
+              "\t\tLights are skipped where their attenuation leaves them\n" \
+              "\t\tadding less than this to a pixel. Defaults to 1/512; 0\n" \
+              "\t\tnever skips a light.\n" \
+              "\t-L samples\n" \
+              "\t\tShades each point with at most this many of the lights\n" \
+              "\t\treaching it, picked at random by brightness (at most 64).\n" \
+              "\t\tDefaults to 0, every light.\n" \
+              "\t-C\n" \
+              "\t\tTests every shadow ray against the whole scene, without\n" \
+              "\t\ttrying the last occluder of the light first.\n" \
+              "\t-M megabytes\n" \
+              "\t\tStreams textures from tile files on disk (made next to\n" \
+              "\t\teach image on first use), keeping at most this much of\n" \
+              "\t\tthem in memory.\n" \
+              "\t-S\n" \
+              "\t\tStreams meshes in the background while the window already\n" \
+              "\t\ttraces, showing models as their bounding boxes until their\n" \
+              "\t\tmesh and bvh are in. Has no effect with -r.\n" \
+              "\t-z level\n" \
+              "\t\tThe zlib compression level of saved png images, 0 (none)\n" \
+              "\t\tto 9 (smallest). Strips of rows are compressed on every\n" \
+              "\t\tthread. Defaults to 6.\n" \
+              "\t-A passes\n" \
+              "\t\tAccumulates this many passes, each through other points\n" \
+              "\t\tof the pixels, into a float framebuffer (the window keeps\n" \
+              "\t\tthem while the camera stands still). An output_file ending\n" \
+              "\t\tin .pfm gets the float framebuffer, unclamped.\n" \
+              "\t-R rows\n" \
+              "\t\tWith -r, traces the image in bands of this many rows from\n" \
+              "\t\tthe top down and writes each band to the output png as\n" \
+              "\t\tsoon as it is done, keeping only two bands in memory.\n" \
+              "\t\tRounded up to a multiple of 8 rows.\n" \
+              "\t-B benchmark [args...]\n" \
+              "\t\tRuns a micro benchmark and exits instead of rendering:\n" \
+              "\t\ttexture [image...] times filtered texture fetches from\n" \
+              "\t\tthe row by row and the tiled texture layouts.\n" \
+              "\t\tobj [file or directory...] times loading obj files with\n" \
+              "\t\tthe mapped and the stream parser.\n" \
+              "\t\tdedup [file or directory...] times sharing the vertices\n" \
+              "\t\tof obj files with a hash table and with a map.\n" \
+              "\t\tscene [count or file...] times loading scenes, generated\n" \
+              "\t\twith count objects or given, from xml and compiled.\n" \
+              "\t-P obj_file [mesh_file]\n" \
+              "\t\tCompiles an obj file into a binary mesh file with its\n" \
+              "\t\tnormals and bvh, and exits. Scenes may name the mesh file\n" \
+              "\t\tin place of the obj file. Defaults to the obj file with a\n" \
+              "\t\t.mesh extension.\n" \
+              "\t-P scene_file [compiled_scene_file]\n" \
+              "\t\tCompiles a .scene file into a binary scene file and exits.\n" \
+              "\t\tThe binary file loads anywhere the .scene file does,\n" \
+              "\t\twithout parsing xml. Defaults to the scene file with a\n" \
+              "\t\t.bscene extension.\n" \
+              "\t-P png_image [tile_file]\n" \
+              "\t\tWrites the tile file -M streams the image's texels from and\n" \
+              "\t\texits. Defaults to the image with .tiles appended, which\n" \
+              "\t\tis where -M looks for it.\n" \
               "\tinput_scene:\n" \
               "\t\tThe scene file to load and raytrace.\n" \
               "\toutput_file:\n" \
@@ -500,80 +896,403 @@ static bool parse_args( Options* opt, int argc, char* argv[] )
 {
     int input_index = 1;
 
-    if ( argc < 2 )
+    opt->open_window = true;
+    opt->width = DEFAULT_WIDTH;
+    opt->height = DEFAULT_HEIGHT;
+    opt->num_workers = 0;
+    opt->job_timeout = DEFAULT_JOB_TIMEOUT;
+    opt->batch = false;
+    opt->streaming = false;
+    opt->png_level = 6;
+    opt->passes = 0;
+    opt->band_rows = 0;
+    opt->benchmark = 0;
+    opt->compile_input = 0;
+
+    // flags come before the scene and may be given in any order
+    while ( input_index < argc && argv[input_index][0] == '-' )
     {
-        print_usage( argv[0] );
-        return false;
-    }
+        const char* flag = argv[input_index];
 
-    if ( strcmp( argv[1], "-r" ) == 0 )
-    {
-        opt->open_window = false;
-        ++input_index;
-    }
-    else
-    {
-        opt->open_window = true;
-    }
+        if ( strcmp( flag, "-r" ) == 0 )
+        {
+            opt->open_window = false;
+            ++input_index;
+        }
+        else if ( strcmp( flag, "-x" ) == 0 )
+        {
+            extras = true;
+            ++input_index;
+        }
+        else if ( strcmp( flag, "-d" ) == 0 )
+        {
+            if ( argc <= input_index + 2 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
 
-    if (strcmp( argv[1], "-x" ) == 0 )
-    {
-        extras = true;
-        ++input_index;
-    }
+            // parse window dimensions
+            opt->width = -1;
+            opt->height = -1;
+            sscanf( argv[input_index + 1], "%d", &opt->width );
+            sscanf( argv[input_index + 2], "%d", &opt->height );
+            // check for valid width/height
+            if ( opt->width < 1 || opt->height < 1 )
+            {
+                std::cout << "Invalid window dimensions\n";
+                return false;
+            }
 
-    if ( argc <= input_index )
-    {
-        print_usage( argv[0] );
-        return false;
-    }
+            input_index += 3;
+        }
+        else if ( strcmp( flag, "-t" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
 
-    // check if it's a -d, if so then get window dimensions
-    if ( strcmp( argv[input_index], "-d" ) == 0 )
-    {
-        if ( argc <= input_index + 3 )
+            if ( !parse_tile_order( argv[input_index + 1], &opt->raytrace.tile_order ) )
+            {
+                std::cout << "Unknown tile order '" << argv[input_index + 1] << "'\n";
+                return false;
+            }
+
+            input_index += 2;
+        }
+        else if ( strcmp( flag, "-s" ) == 0 )
         {
-            print_usage( argv[0] );
-            return false;
+            opt->raytrace.segmented = true;
+            ++input_index;
         }
+        else if ( strcmp( flag, "-a" ) == 0 )
+        {
+            opt->raytrace.adaptive = true;
+            ++input_index;
+        }
+        else if ( strcmp( flag, "-p" ) == 0 )
+        {
+            opt->raytrace.pin_threads = true;
+            ++input_index;
+        }
+        else if ( strcmp( flag, "-N" ) == 0 )
+        {
+            opt->raytrace.numa = true;
+            ++input_index;
+        }
+        else if ( strcmp( flag, "-w" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
 
-        // parse window dimensions
-        opt->width = -1;
-        opt->height = -1;
-        sscanf( argv[input_index + 1], "%d", &opt->width );
-        sscanf( argv[input_index + 2], "%d", &opt->height );
-        // check for valid width/height
-        if ( opt->width < 1 || opt->height < 1 )
+            opt->num_workers = -1;
+            sscanf( argv[input_index + 1], "%d", &opt->num_workers );
+            if ( opt->num_workers < 1 )
+            {
+                std::cout << "Invalid number of workers\n";
+                return false;
+            }
+
+            input_index += 2;
+        }
+        else if ( strcmp( flag, "-W" ) == 0 )
         {
-            std::cout << "Invalid window dimensions\n";
-            return false;
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            opt->job_timeout = -1;
+            sscanf( argv[input_index + 1], "%lf", &opt->job_timeout );
+            if ( !( opt->job_timeout > 0 ) )
+            {
+                std::cout << "Invalid worker timeout\n";
+                return false;
+            }
+
+            input_index += 2;
+        }
+        else if ( strcmp( flag, "-m" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            const char* mode = argv[input_index + 1];
+            if ( strcmp( mode, "wavefront" ) == 0 )
+            {
+                opt->raytrace.wavefront = true;
+            }
+            else if ( strcmp( mode, "packet" ) == 0 )
+            {
+                opt->raytrace.wavefront = false;
+            }
+            else
+            {
+                std::cout << "Unknown trace mode '" << mode << "'\n";
+                return false;
+            }
+
+            input_index += 2;
+        }
+        else if ( strcmp( flag, "-o" ) == 0 )
+        {
+            opt->raytrace.wavefront = true;
+            opt->raytrace.sort_rays = true;
+            ++input_index;
+        }
+        else if ( strcmp( flag, "-D" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            opt->raytrace.max_depth = -1;
+            sscanf( argv[input_index + 1], "%d", &opt->raytrace.max_depth );
+            if ( opt->raytrace.max_depth < 0 || opt->raytrace.max_depth > max_trace_depth )
+            {
+                std::cout << "Invalid trace depth\n";
+                return false;
+            }
+
+            input_index += 2;
+        }
+        else if ( strcmp( flag, "-c" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            opt->raytrace.min_weight = -1;
+            sscanf( argv[input_index + 1], "%lf", &opt->raytrace.min_weight );
+            if ( opt->raytrace.min_weight < 0 || opt->raytrace.min_weight >= 1 )
+            {
+                std::cout << "Invalid minimum ray weight\n";
+                return false;
+            }
+
+            input_index += 2;
+        }
+        else if ( strcmp( flag, "-l" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            opt->raytrace.light_cutoff = -1;
+            sscanf( argv[input_index + 1], "%lf", &opt->raytrace.light_cutoff );
+            if ( opt->raytrace.light_cutoff < 0 )
+            {
+                std::cout << "Invalid light cutoff\n";
+                return false;
+            }
+
+            input_index += 2;
+        }
+        else if ( strcmp( flag, "-L" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            opt->raytrace.light_samples = -1;
+            sscanf( argv[input_index + 1], "%d", &opt->raytrace.light_samples );
+            if ( opt->raytrace.light_samples < 0 ||
+                 opt->raytrace.light_samples > max_light_samples )
+            {
+                std::cout << "Invalid number of light samples\n";
+                return false;
+            }
+
+            input_index += 2;
+        }
+        else if ( strcmp( flag, "-S" ) == 0 )
+        {
+            opt->streaming = true;
+            ++input_index;
+        }
+        else if ( strcmp( flag, "-z" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            opt->png_level = -1;
+            sscanf( argv[input_index + 1], "%d", &opt->png_level );
+            if ( opt->png_level < 0 || opt->png_level > 9 )
+            {
+                std::cout << "Invalid png compression level\n";
+                return false;
+            }
+
+            input_index += 2;
+        }
+        else if ( strcmp( flag, "-A" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            opt->passes = 0;
+            sscanf( argv[input_index + 1], "%d", &opt->passes );
+            if ( opt->passes <= 0 )
+            {
+                std::cout << "Invalid number of passes\n";
+                return false;
+            }
+
+            input_index += 2;
+        }
+        else if ( strcmp( flag, "-R" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            opt->band_rows = 0;
+            sscanf( argv[input_index + 1], "%d", &opt->band_rows );
+            if ( opt->band_rows <= 0 )
+            {
+                std::cout << "Invalid number of rows per band\n";
+                return false;
+            }
+
+            input_index += 2;
         }
+        else if ( strcmp( flag, "-C" ) == 0 )
+        {
+            opt->raytrace.occluder_cache = false;
+            ++input_index;
+        }
+        else if ( strcmp( flag, "-M" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            int megabytes = 0;
+            sscanf( argv[input_index + 1], "%d", &megabytes );
+            if ( megabytes <= 0 )
+            {
+                std::cout << "Invalid texture memory budget\n";
+                return false;
+            }
 
-        input_index += 3;
+            get_tile_cache().set_budget( (size_t) megabytes << 20 );
+            input_index += 2;
+        }
+        else if ( strcmp( flag, "-B" ) == 0 )
+        {
+            if ( argc <= input_index + 1 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            // the rest of the command line belongs to the benchmark
+            opt->benchmark = argv[input_index + 1];
+            opt->benchmark_argc = argc - input_index - 2;
+            opt->benchmark_argv = argv + input_index + 2;
+            return true;
+        }
+        else if ( strcmp( flag, "-P" ) == 0 )
+        {
+            if ( argc <= input_index + 1 || argc > input_index + 3 )
+            {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            opt->compile_input = argv[input_index + 1];
+            opt->compile_output = argc > input_index + 2 ? argv[input_index + 2] : 0;
+            return true;
+        }
+        else if ( strcmp( flag, "-b" ) == 0 )
+        {
+            opt->batch = true;
+            opt->open_window = false;
+            ++input_index;
+        }
+        else
+        {
+            std::cout << "Unknown option '" << flag << "'\n";
+            print_usage( argv[0] );
+            return false;
+        }
     }
-    else
+
+    if ( argc <= input_index )
     {
-        opt->width = DEFAULT_WIDTH;
-        opt->height = DEFAULT_HEIGHT;
+        print_usage( argv[0] );
+        return false;
     }
 
     opt->input_filename = argv[input_index++];
 
-    if ( argc > input_index + 1 )
+    if ( argc > input_index )
     {
-        opt->output_filename = argv[input_index + 1];
+        opt->output_filename = argv[input_index++];
     }
     else
     {
         opt->output_filename = 0;
     }
 
-    if ( argc > input_index + 2 )
+    if ( argc > input_index )
     {
         std::cout << "Too many arguments.\n";
         return false;
     }
 
+    if ( opt->batch && opt->num_workers > 0 )
+    {
+        std::cout << "-b and -w cannot be combined.\n";
+        return false;
+    }
+
+    // workers send back 8-bit rows, and frames of a sequence aren't kept
+    bool hdr = opt->passes > 0 || ( opt->output_filename && imageio_is_pfm( opt->output_filename ) );
+    if ( hdr && ( opt->batch || opt->num_workers > 0 ) )
+    {
+        std::cout << "-A and .pfm output cannot be combined with -b or -w.\n";
+        return false;
+    }
+
+    if ( opt->band_rows > 0 )
+    {
+        size_t len = opt->output_filename ? strlen( opt->output_filename ) : 0;
+        if ( opt->open_window || opt->batch || opt->num_workers > 0 || hdr ||
+             ( len > 0 && ( len < 4 || strcmp( opt->output_filename + len - 4, ".png" ) != 0 ) ) )
+        {
+            std::cout << "-R needs -r and a .png output file, and cannot be combined with -b, -w or -A.\n";
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -599,6 +1318,29 @@ int main( int argc, char* argv[] )
         return 1;
     }
 
+    imageio_set_png_compression( opt.png_level, opt.numthreads );
+
+    if ( opt.benchmark )
+    {
+        return run_benchmark( opt.benchmark, opt.benchmark_argc, opt.benchmark_argv ) ? 0 : 1;
+    }
+
+    if ( opt.compile_input )
+    {
+        bool ok = has_extension( opt.compile_input, ".scene" ) ?
+            compile_scene( opt.compile_input, opt.compile_output ) :
+            has_extension( opt.compile_input, ".png" ) ?
+            compile_texture( opt.compile_input, opt.compile_output ) :
+            compile_mesh( opt.compile_input, opt.compile_output );
+        return ok ? 0 : 1;
+    }
+
+    if ( opt.batch )
+    {
+        return render_sequence( opt.input_filename, opt.output_filename, opt.width, opt.height,
+                                extras, opt.raytrace, opt.numthreads ) ? 0 : 1;
+    }
+
     RaytracerApplication app( opt );
 
     // load the given scene
@@ -624,9 +1366,39 @@ int main( int argc, char* argv[] )
         {
             return 1; // some error occurred
         }
+        if ( opt.band_rows > 0 )
+        {
+            char buf[256];
+            const char* filename = opt.output_filename;
+            if ( !filename )
+            {
+                imageio_gen_name( buf, sizeof buf );
+                filename = buf;
+            }
+            return raytrace_streamed( &app.raytracer, filename, opt.width, opt.height,
+                                      opt.band_rows, opt.numthreads ) ? 0 : 1;
+        }
         assert( app.buffer );
         // raytrace until done
-        app.raytracer.raytrace( app.buffer, 0, opt.numthreads);
+        if ( opt.num_workers > 0 )
+        {
+            // share the cpus between the worker processes
+            int threads = std::max( 1, opt.numthreads / opt.num_workers );
+            if ( !raytrace_distributed( &app.raytracer, app.buffer, opt.width, opt.height,
+                                        opt.num_workers, threads, opt.job_timeout ) )
+            {
+                std::cout << "Distributed raytrace failed. Aborting.\n";
+                return 1;
+            }
+        }
+        else
+        {
+            // each pass adds to the float framebuffer
+            for ( int i = 0; i < std::max( 1, opt.passes ); i++ )
+            {
+                app.raytracer.raytrace( app.buffer, 0, opt.numthreads);
+            }
+        }
         // output result
         app.output_image();
         return 0;
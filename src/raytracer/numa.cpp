@@ -0,0 +1,146 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include "raytracer/numa.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+namespace _462
+{
+
+// parses a sysfs cpu list such as "0-3,8-11"
+static vector<int> parse_cpu_list(FILE* fp)
+{
+    vector<int> cpus;
+    int first, last;
+
+    while (fscanf(fp, "%d", &first) == 1)
+    {
+        last = first;
+
+        if (fscanf(fp, "-%d", &last) != 1)
+        {
+            last = first;
+        }
+
+        for (int cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back(cpu);
+        }
+
+        if (fgetc(fp) != ',')
+        {
+            break;
+        }
+    }
+
+    return cpus;
+}
+
+static NumaTopology read_numa_topology()
+{
+    NumaTopology topology;
+
+#ifdef __linux__
+    // node ids can have holes, so give up only after a run of missing ones
+    for (int node = 0, missing = 0; missing < 64; node++)
+    {
+        char path[64];
+        snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* fp = fopen(path, "r");
+
+        if (!fp)
+        {
+            missing++;
+            continue;
+        }
+
+        missing = 0;
+        vector<int> cpus = parse_cpu_list(fp);
+        fclose(fp);
+
+        if (!cpus.empty())
+        {
+            topology.node_cpus.push_back(cpus);
+        }
+    }
+#endif
+
+    if (topology.node_cpus.empty())
+    {
+        int num_cpus = std::thread::hardware_concurrency();
+        topology.node_cpus.push_back(vector<int>());
+
+        for (int i = 0; i < (num_cpus > 0 ? num_cpus : 1); i++)
+        {
+            topology.node_cpus[0].push_back(i);
+        }
+    }
+
+    return topology;
+}
+
+const NumaTopology& get_numa_topology()
+{
+    static const NumaTopology topology = read_numa_topology();
+    return topology;
+}
+
+bool pin_current_thread(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof set, &set) == 0;
+#else
+    (void) cpu;
+    return false;
+#endif
+}
+
+static atomic<unsigned long> framebuffer_allocs(0);
+
+unsigned char* framebuffer_alloc(size_t size)
+{
+    framebuffer_allocs++;
+
+#ifdef __linux__
+    // fresh anonymous pages are only placed once written; malloc may hand
+    // back memory the main thread already touched
+    void* ret = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ret == MAP_FAILED ? NULL : (unsigned char*) ret;
+#else
+    return (unsigned char*) malloc(size);
+#endif
+}
+
+void framebuffer_free(unsigned char* buffer, size_t size)
+{
+    if (!buffer)
+    {
+        return;
+    }
+
+#ifdef __linux__
+    munmap(buffer, size);
+#else
+    (void) size;
+    free(buffer);
+#endif
+}
+
+unsigned long framebuffer_generation()
+{
+    return framebuffer_allocs;
+}
+
+}
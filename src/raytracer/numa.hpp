@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace _462
+{
+
+/**
+ * The cpus of each NUMA node that has any, read from sysfs. Machines (or
+ * platforms) without NUMA information show up as a single node holding
+ * every hardware thread.
+ */
+struct NumaTopology
+{
+    std::vector< std::vector<int> > node_cpus;
+
+    size_t num_nodes() const { return node_cpus.size(); }
+};
+
+const NumaTopology& get_numa_topology();
+
+// pins the calling thread to the given cpu. returns false if the platform
+// does not support it or the call failed.
+bool pin_current_thread(int cpu);
+
+// allocates memory that has not been touched yet, so each page ends up on
+// the node of the first thread that writes to it. release with
+// framebuffer_free.
+unsigned char* framebuffer_alloc(size_t size);
+
+void framebuffer_free(unsigned char* buffer, size_t size);
+
+// how many framebuffers framebuffer_alloc has handed out so far. a buffer
+// at the same address as an earlier one but allocated after it is new
+// memory, which only a change in this count gives away.
+unsigned long framebuffer_generation();
+
+}
@@ -2,21 +2,52 @@
 
 #include "raytracer/geom_utils.hpp"
 #include "math/color.hpp"
+#include <algorithm>
 
 namespace _462
 {
 
 const int packet_dim = 8;
 const int rays_per_packet = (packet_dim * packet_dim);
+const int adaptive_tile_dim = 8 * packet_dim; // starting tile size for adaptive tiling
+const int adaptive_tiles_per_thread = 16; // target tile count per worker when pre-splitting
+const int wavefront_tile_dim = 8 * packet_dim; // pixels per side of a wavefront
 const float eps = 0.0001; // "slop factor"
-const int max_recursion_depth = 3;
+const int default_max_depth = 3; // bounces followed from each primary ray
+const int max_trace_depth = 16; // upper limit of the configurable depth
+const real_t default_min_weight = 1.0 / 512; // half a step of an 8-bit channel
+const int aa_grid = 3; // strata per side of the extra samples of an anti-aliased pixel
+const real_t aa_contrast = 0.1; // neighbours further apart than this in a channel are anti-aliased
 
 struct Ray
 {
+    Ray() : width(0), spread(0) { }
+
     Vector3 eye;
     Vector3 dir;
+
+    // cone around the ray used to filter textures: at distance t along the
+    // (unit) direction it is width + spread * t wide. camera rays start out
+    // as wide as a pixel and reflections keep the width they hit with.
+    real_t width;
+    real_t spread;
+
+    // width of the cone where the ray hits at distance t
+    real_t width_at(real_t t) const { return width + spread * t; }
 };
 
+/**
+ * Width in texture coordinates of the patch of surface the cone of a ray
+ * covers where it hits at distance t. uv_per_unit is how much of the texture
+ * one unit of the surface spans; the patch stretches on slanted surfaces.
+ */
+inline real_t texture_footprint(const Ray& ray, real_t t, const Vector3& normal,
+                                real_t uv_per_unit)
+{
+    real_t cos_angle = fabs(dot(ray.dir, normal)) / length(ray.dir);
+    return ray.width_at(t) * uv_per_unit / std::max(cos_angle, (real_t) 0.01);
+}
+
 struct PacketRegion
 {
     PacketRegion() {}
@@ -27,12 +58,67 @@ struct PacketRegion
     Int2 ll, lr, ul, ur;
 };
 
+// how full packets were at the bvh nodes they visited
+struct PacketOccupancy
+{
+    PacketOccupancy() : node_visits(0), active_rays(0) { }
+    long node_visits;
+    long active_rays;
+};
+
+// branches of pixel paths that were traced, and cut off for their weight,
+// and the lights at the points they shaded
+struct PathCounts
+{
+    PathCounts() : traced(0), pruned(0), shaded(0), lights_reached(0),
+                   lights_shaded(0), shadow_tests(0), shadow_blocked(0),
+                   occluder_hits(0), occluder_misses(0) { }
+    long traced;
+    long pruned;
+    // points lit, lights reaching them and lights they were shaded with
+    long shaded;
+    long lights_reached;
+    long lights_shaded;
+    // shadow rays tested and blocked, and those the light's last occluder
+    // blocked or was tried on in vain
+    long shadow_tests;
+    long shadow_blocked;
+    long occluder_hits;
+    long occluder_misses;
+};
+
 struct Packet
 {
+    Packet() : has_frustum(true), num_rays(rays_per_packet), occupancy(NULL) { }
     Frustum frustum;
+    // packets of secondary rays share no frustum, so nothing is culled
+    bool has_frustum;
+    // rays from num_rays on are padding and are not traced
+    int num_rays;
+    // if set, bvh traversal counts the active rays at each node it visits
+    PacketOccupancy* occupancy;
     Ray rays[rays_per_packet];
 };
 
+/**
+ * The closest hit of a ray found so far, all that intersection tests keep.
+ * The shading attributes are only looked up for the final hit, by
+ * Geometry::shade.
+ */
+struct HitRecord
+{
+    HitRecord() : time(INFINITY), geometry(-1), primitive(0), beta(0), gamma(0) { }
+    float time;
+    // index of the geometry in the scene, -1 for none
+    int geometry;
+    // part of the geometry that was hit, e.g. the triangle of a model
+    unsigned int primitive;
+    // barycentric coordinates of the hit on triangles
+    float beta;
+    float gamma;
+};
+
+// the shading attributes of a hit
 struct IsectInfo
 {
     IsectInfo() : time(INFINITY), normal(Vector3::Zero), ambient(Color3::Black), 
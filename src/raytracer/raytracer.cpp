@@ -3,8 +3,11 @@
 #include <math.h>
 #include <algorithm>
 #include <thread>
+#include <cstring>
 #include "raytracer.hpp"
 #include "CycleTimer.hpp"
+#include "numa.hpp"
+#include "scene/tile_cache.hpp"
 
 using namespace std;
 
@@ -12,7 +15,10 @@ namespace _462
 {
 
 Raytracer::Raytracer()
-    : scene( 0 ), width( 0 ), height( 0 ) { }
+    : scene( 0 ), width( 0 ), height( 0 ), frame_cost( 0 ), tile_queues( 0 ),
+      num_tile_queues( 0 ), num_workers( 0 ), tile_budget( INFINITY ),
+      frame_id( 0 ), first_touched( 0 ), first_touched_generation( 0 ), buffer_row( 0 ),
+      hdr_buffer( 0 ), num_passes( 0 ), pixel_offset_x( 0.5 ), pixel_offset_y( 0.5 ) { }
 
 Raytracer::~Raytracer() { }
 
@@ -22,16 +28,93 @@ Raytracer::~Raytracer() { }
  * @param scene The scene to raytrace.
  * @param width The width of the image being raytraced.
  * @param height The height of the image being raytraced.
+ * @param options How the image is split up among the worker threads.
  * @return true on success, false on error. The raytrace will abort if
  *  false is returned.
  */
-bool Raytracer::initialize(Scene* _scene, size_t _width, size_t _height, bool _extras)
+bool Raytracer::initialize(Scene* _scene, size_t _width, size_t _height, bool _extras,
+                           const RaytraceOptions& _options, bool scene_built)
 {
+    // the cost map only means anything for the same image size
+    if (_width != width || _height != height)
+    {
+        packet_costs.clear();
+        frame_cost = 0;
+    }
+
     this->scene = _scene;
     this->width = _width;
     this->height = _height;
     this->extras = _extras;
+    this->options = _options;
+    this->num_passes = 0;
+
+    // wavefronts are traced whole, there is nothing to split
+    if (options.wavefront)
+    {
+        options.adaptive = false;
+    }
+
+    if (!scene_built)
+    {
+        build_scene(scene);
+    }
+
+    light_tree.build(scene->get_lights(), scene->num_lights(), options.light_cutoff);
+
+    //cout << scene->camera.orientation << endl;
+
+    return true;
+}
+
+void Raytracer::set_hdr_buffer(float* hdr)
+{
+    hdr_buffer = hdr;
+    num_passes = 0;
+}
+
+void Raytracer::store_pixel(unsigned char* buffer, size_t index, const Color3& color)
+{
+    index -= buffer_row * width;
+
+    if (!hdr_buffer)
+    {
+        color.to_array(&buffer[4 * index]);
+        return;
+    }
+
+    float* mean = &hdr_buffer[3 * index];
+    if (num_passes == 0)
+    {
+        color.to_array(mean);
+        color.to_array(&buffer[4 * index]);
+        return;
+    }
+
+    // running mean, so the buffer is always the image so far
+    float weight = 1.0f / (num_passes + 1);
+    mean[0] += (float(color.r) - mean[0]) * weight;
+    mean[1] += (float(color.g) - mean[1]) * weight;
+    mean[2] += (float(color.b) - mean[2]) * weight;
+    Color3(mean[0], mean[1], mean[2]).to_array(&buffer[4 * index]);
+}
+
+// the radical inverse of i in a base, the halton sequence of that base
+static real_t radical_inverse(size_t i, size_t base)
+{
+    real_t inverse = 0;
+    real_t digit = 1.0 / base;
+
+    for (; i > 0; i /= base, digit /= base)
+    {
+        inverse += (i % base) * digit;
+    }
+
+    return inverse;
+}
 
+void Raytracer::build_scene(Scene* scene)
+{
     size_t num_geometries = scene->num_geometries();
 
     // invert scene transformation matrices
@@ -52,206 +135,193 @@ bool Raytracer::initialize(Scene* _scene, size_t _width, size_t _height, bool _e
         scene->get_geometries()[i]->make_bounding_volume();
         cout << "Created bounding volume for geometry " << i << endl;
     }
-
-    //cout << scene->camera.orientation << endl;
-
-    return true;
 }
 
 
+// a branch of a pixel's path waiting to be traced
+struct PathEntry
+{
+    Ray ray;
+    // share of the pixel's color the branch accounts for
+    Color3 weight;
+    // refractive index of the medium the ray travels in
+    float refractive;
+    int depth;
+};
+
 /**
  * Performs a raytrace on the given pixel on the current scene.
  * The pixel is relative to the bottom-left corner of the image.
+ *
+ * Instead of recursing into the reflected and transmitted rays of every hit,
+ * they are pushed on a stack with their share of the weight and the light
+ * they pick up is added to the pixel directly. Every entry pushes at most
+ * two entries one bounce deeper, so the stack never holds more than one
+ * entry per bounce plus one.
  */
-Color3 Raytracer::trace_pixel(int recursions, const Ray& ray, float refractive)
+Color3 Raytracer::trace_pixel(const Ray& ray, float refractive,
+                              const HitRecord* first_hit, PathCounts& counts)
 {
+    PathEntry stack[max_trace_depth + 1];
+    int top = 0;
+    Color3 color = Color3::Black;
     size_t num_geometries = scene->num_geometries();
-    bool hit_any = false; // if any geometries were hit
-    IsectInfo min_info; // everything we're calculating from intersection
-    Vector3 intersection_point = Vector3::Zero;
 
-    // run intersection test on every object in scene
-    for (size_t i = 0; i < num_geometries; i++)
+    stack[top].ray = ray;
+    stack[top].weight = Color3::White;
+    stack[top].refractive = refractive;
+    stack[top].depth = 0;
+    top++;
+
+    while (top > 0)
     {
-        IsectInfo info;
-        // intersect returns true if there's a hit, false if not, and sets
-        // values in info struct
-        bool hit = scene->get_geometries()[i]->intersect_ray(ray, info);
+        PathEntry entry = stack[--top];
+        HitRecord min_hit; // the closest hit, time initializes to inf
 
-        if (hit && info.time < min_info.time) // min_info.time initializes to inf
+        if (first_hit)
         {
-            min_info = info;
-            intersection_point = ray.eye + (min_info.time * ray.dir);
-            hit_any = true;
+            min_hit = *first_hit;
+            first_hit = NULL;
         }
-    }
+        else
+        {
+            bool hit_any = false; // if any geometries were hit
 
-    // found a hit
-    if (hit_any)
-    {
-        Color3 direct;
-        Color3 diffuse = Color3::Black;
+            // run intersection test on every object in scene; each only
+            // replaces hits further away than its own
+            for (size_t i = 0; i < num_geometries; i++)
+            {
+                if (scene->get_geometries()[i]->intersect_ray(entry.ray, min_hit))
+                {
+                    hit_any = true;
+                }
+            }
+
+            // didn't hit anything - add background color
+            if (!hit_any)
+            {
+                color += entry.weight * scene->background_color;
+                continue;
+            }
+        }
+
+        // everything we're calculating from intersection, looked up only
+        // for the closest hit
+        IsectInfo min_info;
+        scene->get_geometries()[min_hit.geometry]->shade(entry.ray, min_hit, min_info);
+
+        const Ray& r = entry.ray;
         Color3 ambient = scene->ambient_light * min_info.ambient;
-        float angle = dot(ray.dir, min_info.normal);
+        float angle = dot(r.dir, min_info.normal);
+        bool bounces_left = entry.depth < options.max_depth;
+
         // compute reflected ray
-        Ray incident_ray;
-        incident_ray.dir = ray.dir - 2 * angle * min_info.normal;
-        incident_ray.dir = normalize(incident_ray.dir);
-        incident_ray.eye = intersection_point + eps * incident_ray.dir;
+        Vector3 intersection_point = r.eye + (min_info.time * r.dir);
+        PathEntry reflected;
+        reflected.ray.dir = r.dir - 2 * angle * min_info.normal;
+        reflected.ray.dir = normalize(reflected.ray.dir);
+        reflected.ray.eye = intersection_point + eps * reflected.ray.dir;
+        reflected.ray.width = r.width_at(min_info.time);
+        reflected.ray.spread = r.spread;
+        reflected.refractive = entry.refractive;
+        reflected.depth = entry.depth + 1;
 
         // no-refraction case
         if (min_info.refractive == 0.0)
         {
-            diffuse = get_diffuse(incident_ray.eye, min_info.normal,
-                    min_info.diffuse, eps);
-            direct = min_info.texture * (ambient + diffuse);
+            Color3 diffuse = get_diffuse(reflected.ray.eye, min_info.normal,
+                                         min_info.diffuse, eps, counts);
+            Color3 surface = entry.weight * min_info.texture;
+            color += surface * (ambient + diffuse);
+
+            // add reflected light if we have bounces left
+            reflected.weight = surface * min_info.specular;
 
-            // return direct light and reflected light if we have recursions left
-            if (recursions >= max_recursion_depth)
+            if (bounces_left && worth_tracing(reflected.weight))
             {
-                return direct;
+                stack[top++] = reflected;
+                counts.traced++;
             }
-
-            return direct + min_info.texture * min_info.specular *
-                trace_pixel(recursions + 1, incident_ray, refractive);
-
-        }
-        // refraction case
-        else
-        {
-            // return black if no more recursions
-            if (recursions >= max_recursion_depth)
+            else if (bounces_left && reflected.weight != Color3::Black)
             {
-                return Color3::Black;
+                counts.pruned++;
             }
-
+        }
+        // refraction case, black once out of bounces
+        else if (bounces_left)
+        {
             float c;
-            Ray transmitted_ray;
-            float refract_ratio = refractive / min_info.refractive;
+            PathEntry transmitted;
+            float refract_ratio = entry.refractive / min_info.refractive;
 
             // negative dot product between ray and normal indicates entering object
             if (angle < 0.0)
             {
-                refract(ray.dir, min_info.normal, refract_ratio, &transmitted_ray.dir);
-                c = dot(-1.0 * ray.dir, min_info.normal);
+                refract(r.dir, min_info.normal, refract_ratio, &transmitted.ray.dir);
+                c = dot(-1.0 * r.dir, min_info.normal);
             }
             else
             {
                 // exiting object
-                if (refract(ray.dir, (-1.0 * min_info.normal), min_info.refractive,
-                            &transmitted_ray.dir))
+                if (refract(r.dir, (-1.0 * min_info.normal), min_info.refractive,
+                            &transmitted.ray.dir))
                 {
-                    c = dot(transmitted_ray.dir, min_info.normal);
+                    c = dot(transmitted.ray.dir, min_info.normal);
                 }
                 // total internal reflection
                 else
                 {
-                    return trace_pixel(recursions + 1, incident_ray, refractive);
+                    reflected.weight = entry.weight;
+                    stack[top++] = reflected;
+                    counts.traced++;
+                    continue;
                 }
             }
 
             // schlick approximation to fresnel equations
             float R_0 = pow(refract_ratio - 1, 2) / pow(refract_ratio + 1, 2);
             float R = R_0 + (1 - R_0) * pow(1 - c, 5);
-            transmitted_ray.eye = intersection_point + eps * transmitted_ray.dir;
-
-            // return reflected and refracted rays
-            return R * trace_pixel(recursions + 1, incident_ray, refractive) +
-                (1.0 - R) * trace_pixel(recursions + 1, transmitted_ray,
-                        min_info.refractive);
-        }
-    }
-    // didn't hit anything - return background color
-    else
-    {
-        return scene->background_color;
-    }
-}
-
-
-Color3 Raytracer::trace_pixel_end(int recursions, const Ray& ray, float refractive, 
-        IsectInfo min_info)
-{
-    Color3 direct;
-    Color3 diffuse = Color3::Black;
-    Color3 ambient = scene->ambient_light * min_info.ambient;
-    float angle = dot(ray.dir, min_info.normal);
-
-    // compute reflected ray
-    Vector3 intersection_point = ray.eye + (min_info.time * ray.dir);
-    Ray incident_ray;
-    incident_ray.dir = ray.dir - 2 * angle * min_info.normal;
-    incident_ray.dir = normalize(incident_ray.dir);
-    incident_ray.eye = intersection_point + eps * incident_ray.dir;
-
-    // no-refraction case
-    if (min_info.refractive == 0.0)
-    {
-        diffuse = get_diffuse(incident_ray.eye, min_info.normal,
-                min_info.diffuse, eps);
-        direct = min_info.texture * (ambient + diffuse);
-
-        // return direct light and reflected light if we have recursions left
-        if (recursions >= max_recursion_depth)
-        {
-            return direct;
-        }
-
-        return direct + min_info.texture * min_info.specular *
-            trace_pixel(recursions + 1, incident_ray, refractive);
-
-    }
-    // refraction case
-    else
-    {
-        // return black if no more recursions
-        if (recursions >= max_recursion_depth)
-        {
-            return Color3::Black;
-        }
-
-        float c;
-        Ray transmitted_ray;
-        float refract_ratio = refractive / min_info.refractive;
+            transmitted.ray.eye = intersection_point + eps * transmitted.ray.dir;
+            transmitted.ray.width = reflected.ray.width;
+            transmitted.ray.spread = r.spread;
+            transmitted.refractive = min_info.refractive;
+            transmitted.depth = entry.depth + 1;
+            transmitted.weight = (1.0 - R) * entry.weight;
+            reflected.weight = R * entry.weight;
+
+            // trace the reflected and refracted rays that still matter
+            if (worth_tracing(transmitted.weight))
+            {
+                stack[top++] = transmitted;
+                counts.traced++;
+            }
+            else
+            {
+                counts.pruned++;
+            }
 
-        // negative dot product between ray and normal indicates entering object
-        if (angle < 0.0)
-        {
-            refract(ray.dir, min_info.normal, refract_ratio, &transmitted_ray.dir);
-            c = dot(-1.0 * ray.dir, min_info.normal);
-        }
-        else
-        {
-            // exiting object
-            if (refract(ray.dir, (-1.0 * min_info.normal), min_info.refractive,
-                        &transmitted_ray.dir))
+            if (worth_tracing(reflected.weight))
             {
-                c = dot(transmitted_ray.dir, min_info.normal);
+                stack[top++] = reflected;
+                counts.traced++;
             }
-            // total internal reflection
             else
             {
-                return trace_pixel(recursions + 1, incident_ray, refractive);
+                counts.pruned++;
             }
         }
-
-        // schlick approximation to fresnel equations
-        float R_0 = pow(refract_ratio - 1, 2) / pow(refract_ratio + 1, 2);
-        float R = R_0 + (1 - R_0) * pow(1 - c, 5);
-        transmitted_ray.eye = intersection_point + eps * transmitted_ray.dir;
-
-        // return reflected and refracted rays
-        return R * trace_pixel(recursions + 1, incident_ray, refractive) +
-            (1.0 - R) * trace_pixel(recursions + 1, transmitted_ray,
-                    min_info.refractive);
     }
-}
-
-
 
+    return color;
+}
 
 // calculate direction of initial viewing ray from camera
 Vector3 Raytracer::get_viewing_ray(Int2 pixel)
+{
+    return get_viewing_ray(pixel.x + pixel_offset_x, pixel.y + pixel_offset_y);
+}
+
+Vector3 Raytracer::get_viewing_ray(real_t x, real_t y)
 {
     // normalized camera direction
     Vector3 gaze = normalize(scene->camera.get_direction());
@@ -266,16 +336,26 @@ Vector3 Raytracer::get_viewing_ray(Int2 pixel)
     real_t r = (t * width) / height;
     real_t b = -1.0 * t;
     real_t l = -1.0 * r;
-    // the pixel's horizontal coordinate on image plane
-    real_t u = l + (r - l) * (pixel.x + 0.5) / width;
-    // the pixel's vertical coordinate on image plane
-    real_t v = b + (t - b) * (pixel.y + 0.5) / height;
+    // the point's horizontal coordinate on image plane
+    real_t u = l + (r - l) * x / width;
+    // the point's vertical coordinate on image plane
+    real_t v = b + (t - b) * y / height;
     // Shirley uses the near plane for the below calculation; we'll just use 1
     Vector3 view_ray = gaze + (u * right) + (v * up);
 
     return normalize(view_ray); // viewing ray direction
 }
 
+// angle between the viewing rays of neighbouring pixels, the spread of
+// their cones
+real_t Raytracer::get_pixel_spread()
+{
+    float fov = scene->camera.get_fov_radians();
+    // height of the image plane at distance 1, as in get_viewing_ray
+    real_t t = tan((width / height) * fov / 2.0);
+    return 2 * t / height;
+}
+
 // parameters are the four ray origin coordinates on the screen, the camera/eye
 // position, the dimensions of the screen, and a place to store the frustum.
 void Raytracer::get_viewing_frustum(Int2 ll, Int2 lr, Int2 ul, Int2 ur,
@@ -317,12 +397,29 @@ void Raytracer::get_viewing_frustum(Int2 ll, Int2 lr, Int2 ul, Int2 ur,
     frustum.planes[RIGHT].point = eye;
 }
 
-// calculate contribution of all lights to diffuse light
-Color3 Raytracer::get_diffuse(Vector3 intersection_point, Vector3 min_normal,
-                              Color3 min_diffuse, float eps)
+// adds up the diffuse light of the lights picked for a point
+struct DiffuseLighting
+{
+    DiffuseLighting(Raytracer* _raytracer, const Scene* _scene, Vector3 point,
+                    Vector3 normal, Color3 _min_diffuse, float _eps, PathCounts& _counts)
+        : raytracer(_raytracer), scene(_scene), intersection_point(point),
+          min_normal(normal), min_diffuse(_min_diffuse), eps(_eps),
+          counts(_counts), diffuse(Color3::Black) { }
+
+    Raytracer* raytracer;
+    const Scene* scene;
+    Vector3 intersection_point;
+    Vector3 min_normal;
+    Color3 min_diffuse;
+    float eps;
+    PathCounts& counts;
+    Color3 diffuse;
+
+    void operator()(size_t j, real_t scale);
+};
+
+void DiffuseLighting::operator()(size_t j, real_t scale)
 {
-    size_t num_geometries = scene->num_geometries();
-    size_t num_lights = scene->num_lights();
     Vector3 light_direction;
     Vector3 light_direction_norm;
     real_t light_distance;
@@ -331,51 +428,129 @@ Color3 Raytracer::get_diffuse(Vector3 intersection_point, Vector3 min_normal,
     Color3 light_color;
     real_t light_attenuation;
     Color3 attenuated_color;
-    Color3 diffuse = Color3::Black;
 
-    for (size_t j = 0; j < num_lights; j++)
+    light_direction = scene->get_lights()[j].position -
+                      intersection_point;
+    light_distance = length(light_direction);
+    light_direction_norm = normalize(light_direction);
+    front_face = std::max(dot(min_normal,
+                              light_direction_norm), 0.0);
+    Ray shadow_ray;
+    shadow_ray.eye = intersection_point + (eps * light_direction);
+    shadow_ray.dir = light_direction; 
+
+    // first check if it's front facing the light
+    if (front_face > 0)
     {
-        light_direction = scene->get_lights()[j].position -
-                          intersection_point;
-        light_distance = length(light_direction);
-        light_direction_norm = normalize(light_direction);
-        front_face = std::max(dot(min_normal,
-                                  light_direction_norm), 0.0);
-        Ray shadow_ray;
-        shadow_ray.eye = intersection_point + (eps * light_direction);
-        shadow_ray.dir = light_direction; 
+        // second, check if the light is blocked; if any object blocks the
+        // ray, that light contributes 0
+        in_shadow = raytracer->shadow_test(shadow_ray, j, counts);
 
-        // first check if it's front facing the light
-        if (front_face > 0)
+        // third, get attenuated color
+        if (!in_shadow)
         {
-            // second, check if the light is blocked:
-            for (size_t k = 0; k < num_geometries; k++)
-            {
-                //  send a ray from intersection point to that light
-                in_shadow = scene->get_geometries()[k]->shadow_test(shadow_ray);
+            light_color = scene->get_lights()[j].color;
+            light_attenuation =
+                scene->get_lights()[j].attenuation.constant +
+                scene->get_lights()[j].attenuation.linear * light_distance +
+                scene->get_lights()[j].attenuation.quadratic * pow(light_distance, 2);
+            attenuated_color = light_color * (scale / light_attenuation);
+            diffuse += front_face * attenuated_color * min_diffuse;
+        }
+    }
+}
 
-                //  if any object blocks the ray, that light contributes 0
-                if (in_shadow)
-                {
-                    break;
-                }
+// calculate contribution of the lights reaching a point to diffuse light
+Color3 Raytracer::get_diffuse(Vector3 intersection_point, Vector3 min_normal,
+                              Color3 min_diffuse, float eps, PathCounts& counts)
+{
+    DiffuseLighting lighting(this, scene, intersection_point, min_normal, min_diffuse,
+                             eps, counts);
+    LightCounter<DiffuseLighting> counter(lighting);
+
+    counts.shaded++;
+    counts.lights_reached += light_tree.sample(intersection_point, min_normal,
+                                               options.light_samples, counter);
+    counts.lights_shaded += counter.count;
+
+    return lighting.diffuse;
+}
+
+// the geometry and primitive that last blocked a thread's shadow rays to each
+// light, in the frame they were found in
+struct OccluderCache
+{
+    struct Occluder
+    {
+        // -1 if none yet
+        int geometry;
+        size_t primitive;
+    };
+
+    OccluderCache() : frame(0) { }
+    std::vector<Occluder> occluders;
+    unsigned frame;
+};
+
+static thread_local OccluderCache occluder_cache;
+
+bool Raytracer::shadow_test(const Ray& shadow_ray, size_t light, PathCounts& counts)
+{
+    size_t num_geometries = scene->num_geometries();
+    Geometry* const* geometries = scene->get_geometries();
+    OccluderCache::Occluder* cached = NULL;
+
+    counts.shadow_tests++;
+
+    if (options.occluder_cache)
+    {
+        // geometries and primitives of earlier frames may be gone
+        if (occluder_cache.frame != frame_id)
+        {
+            OccluderCache::Occluder none = { -1, 0 };
+            occluder_cache.occluders.assign(scene->num_lights(), none);
+            occluder_cache.frame = frame_id;
+        }
+
+        cached = &occluder_cache.occluders[light];
+
+        if (cached->geometry >= 0)
+        {
+            if (geometries[cached->geometry]->shadow_test_primitive(shadow_ray,
+                                                                   cached->primitive))
+            {
+                counts.occluder_hits++;
+                counts.shadow_blocked++;
+                return true;
             }
 
-            // third, get attenuated color
-            if (!in_shadow)
+            counts.occluder_misses++;
+        }
+    }
+
+    for (size_t k = 0; k < num_geometries; k++)
+    {
+        size_t primitive = 0;
+
+        if (geometries[k]->shadow_test(shadow_ray, &primitive))
+        {
+            if (cached)
             {
-                light_color = scene->get_lights()[j].color;
-                light_attenuation =
-                    scene->get_lights()[j].attenuation.constant +
-                    scene->get_lights()[j].attenuation.linear * light_distance +
-                    scene->get_lights()[j].attenuation.quadratic * pow(light_distance, 2);
-                attenuated_color = light_color * (1.0 / light_attenuation);
-                diffuse += front_face * attenuated_color * min_diffuse;
+                cached->geometry = k;
+                cached->primitive = primitive;
             }
+            counts.shadow_blocked++;
+            return true;
         }
     }
 
-    return diffuse;
+    // lit points tend to come in runs too; don't try the occluder on each
+    if (cached)
+    {
+        cached->geometry = -1;
+    }
+
+    return false;
 }
 
 // return false if there is total internal reflection
@@ -394,19 +569,190 @@ bool Raytracer::refract(Vector3 d, Vector3 normal, float n, Vector3 *t)
     return true;
 }
 
-void Raytracer::trace_packet_worker(tsqueue<PacketRegion> *packet_queue, unsigned char *buffer)
+void Raytracer::trace_packet_worker(int id, unsigned char *buffer)
 {
+    if (worker_cpu[id] >= 0)
+    {
+        pin_current_thread(worker_cpu[id]);
+    }
+
+    int own = worker_queue[id];
+    int node = worker_node[id];
+    tsqueue<PacketRegion> *own_queue = &tile_queues[own];
+
     while (true)
     {
         bool empty;
-        PacketRegion packet = packet_queue->Pop(empty);
+        PacketRegion packet = own_queue->Pop(empty);
+
+        // our own run is done, take from the far end of someone else's,
+        // trying the queues on our own node before going off-node
+        for (int pass = 0; empty && pass < 2; pass++)
+        {
+            for (int i = 1; empty && i < num_tile_queues; i++)
+            {
+                int victim = (own + i) % num_tile_queues;
+
+                if ((queue_node[victim] == node) == (pass == 0))
+                {
+                    packet = tile_queues[victim].Steal(empty);
+                }
+            }
+        }
 
         if (empty)
         {
             break;
         }
 
-        trace_packet(packet, 1.0, buffer);
+        trace_tile(packet, own_queue, buffer);
+    }
+}
+
+// splits a tile into up to four quadrants along packet boundaries. returns
+// the number of pieces, which is 1 if the tile is a single packet.
+static int split_tile(const PacketRegion& tile, PacketRegion pieces[4])
+{
+    int w = tile.lr.x - tile.ll.x + 1;
+    int h = tile.ul.y - tile.ll.y + 1;
+    // size of the lower left piece, rounded up to whole packets
+    int half_w = ((w / 2 + packet_dim - 1) / packet_dim) * packet_dim;
+    int half_h = ((h / 2 + packet_dim - 1) / packet_dim) * packet_dim;
+    int xs[3] = { tile.ll.x, tile.ll.x + half_w, tile.lr.x + 1 };
+    int ys[3] = { tile.ll.y, tile.ll.y + half_h, tile.ul.y + 1 };
+    int nx = w > packet_dim ? 2 : 1;
+    int ny = h > packet_dim ? 2 : 1;
+    int n = 0;
+
+    if (nx == 1)
+    {
+        xs[1] = xs[2];
+    }
+
+    if (ny == 1)
+    {
+        ys[1] = ys[2];
+    }
+
+    for (int j = 0; j < ny; j++)
+    {
+        for (int i = 0; i < nx; i++)
+        {
+            Int2 ll(xs[i], ys[j]);
+            Int2 lr(xs[i + 1] - 1, ys[j]);
+            Int2 ul(xs[i], ys[j + 1] - 1);
+            Int2 ur(xs[i + 1] - 1, ys[j + 1] - 1);
+            pieces[n++] = PacketRegion(ll, lr, ul, ur);
+        }
+    }
+
+    return n;
+}
+
+size_t Raytracer::tiles_remaining()
+{
+    size_t ret = 0;
+
+    for (int i = 0; i < num_tile_queues; i++)
+    {
+        ret += tile_queues[i].Size();
+    }
+
+    return ret;
+}
+
+double Raytracer::estimate_cost(const PacketRegion& tile) const
+{
+    double cost = 0;
+
+    for (int y = tile.ll.y / packet_dim; y <= tile.ul.y / packet_dim; y++)
+    {
+        for (int x = tile.ll.x / packet_dim; x <= tile.lr.x / packet_dim; x++)
+        {
+            cost += packet_costs[y * packets_x() + x];
+        }
+    }
+
+    return cost;
+}
+
+// splits tiles that were expensive last frame before the frame starts
+void Raytracer::presplit_tile(const PacketRegion& tile, vector<PacketRegion>& tiles) const
+{
+    PacketRegion pieces[4];
+    int n = 1;
+
+    if (estimate_cost(tile) > tile_budget)
+    {
+        n = split_tile(tile, pieces);
+    }
+
+    if (n == 1)
+    {
+        tiles.push_back(tile);
+        return;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        presplit_tile(pieces[i], tiles);
+    }
+}
+
+/**
+ * Traces every packet in the tile. With adaptive tiling, a tile that is
+ * still running once the queues are nearly drained or that has gone over
+ * its time budget pushes its untraced quadrants back on the worker's queue
+ * so idle workers can pick them up.
+ */
+void Raytracer::trace_tile(PacketRegion tile, tsqueue<PacketRegion> *own_queue,
+                           unsigned char *buffer)
+{
+    if (options.wavefront)
+    {
+        trace_wavefront(tile, buffer);
+        return;
+    }
+
+    PacketRegion pieces[4];
+    int n = split_tile(tile, pieces);
+
+    if (n == 1)
+    {
+        if (!options.adaptive)
+        {
+            trace_packet(tile, 1.0, buffer);
+            return;
+        }
+
+        double start = CycleTimer::currentSeconds();
+        trace_packet(tile, 1.0, buffer);
+        packet_costs[(tile.ll.y / packet_dim) * packets_x() + tile.ll.x / packet_dim] =
+            CycleTimer::currentSeconds() - start;
+        return;
+    }
+
+    double start = CycleTimer::currentSeconds();
+
+    for (int i = 0; i < n; i++)
+    {
+        bool shed = options.adaptive && i + 1 < n &&
+            (CycleTimer::currentSeconds() - start > tile_budget ||
+             tiles_remaining() < (size_t)num_workers);
+
+        if (shed)
+        {
+            for (int j = i + 1; j < n; j++)
+            {
+                own_queue->Push(pieces[j]);
+            }
+
+            num_splits++;
+            trace_tile(pieces[i], own_queue, buffer);
+            return;
+        }
+
+        trace_tile(pieces[i], own_queue, buffer);
     }
 }
 
@@ -417,11 +763,12 @@ void Raytracer::trace_packet(PacketRegion region, float refractive, unsigned cha
     Int2 ul = region.ul;
     Int2 ur = region.ur;
 
-    IsectInfo infos[rays_per_packet];
+    HitRecord hits[rays_per_packet];
     bool intersected[rays_per_packet];
     Packet packet;
     get_viewing_frustum(ll, lr, ul, ur, packet.frustum);
     Vector3 eye = scene->camera.get_position();
+    real_t spread = get_pixel_spread();
     Int2 pixels[rays_per_packet];
     int r = 0; // counter for rays in packet
 
@@ -432,32 +779,297 @@ void Raytracer::trace_packet(PacketRegion region, float refractive, unsigned cha
             Int2 pixel(x, y);
             packet.rays[r].eye = eye;
             packet.rays[r].dir = get_viewing_ray(pixel);
+            packet.rays[r].spread = spread;
             pixels[r] = pixel;
             intersected[r] = false;
             r++;
         }
     }
 
+    // packets on the image border may be partial; pad them with copies of
+    // the first ray so the geometry never sees uninitialized rays
+    int num_rays = r;
+    packet.num_rays = num_rays;
+
+    for (; r < rays_per_packet; r++)
+    {
+        packet.rays[r] = packet.rays[0];
+        pixels[r] = pixels[0];
+        intersected[r] = false;
+    }
+
     for (size_t i = 0; i < scene->num_geometries(); i++)
     {
-        scene->get_geometries()[i]->intersect_packet(packet, infos, intersected);
+        scene->get_geometries()[i]->intersect_packet(packet, hits, intersected);
     }
 
-    for (int i = 0; i < rays_per_packet; i++)
+    PathCounts counts;
+    Color3 colors[rays_per_packet];
+
+    for (int i = 0; i < num_rays; i++)
     {
         if (intersected[i])
         {
-            Color3 color = trace_pixel_end(0, packet.rays[i], refractive, infos[i]);
-            color.to_array(&buffer[4 * (pixels[i].y * width + pixels[i].x)]);
+            colors[i] = trace_pixel(packet.rays[i], refractive, &hits[i], counts);
         }
         else
         {
-            Color3 color = scene->background_color;
-            color.to_array(&buffer[4 * (pixels[i].y * width + pixels[i].x)]);
+            colors[i] = scene->background_color;
+        }
+    }
+
+    if (extras)
+    {
+        // the geometry each ray hit, -1 for none
+        int hit_geometry[rays_per_packet];
+        for (int i = 0; i < num_rays; i++)
+        {
+            hit_geometry[i] = hits[i].geometry;
+        }
+
+        int refined = supersample_edges(region, refractive, colors, hit_geometry, counts);
+        num_refined_pixels += refined;
+        num_extra_samples += refined * aa_grid * aa_grid;
+    }
+
+    for (int i = 0; i < num_rays; i++)
+    {
+        store_pixel(buffer, pixels[i].y * width + pixels[i].x, colors[i]);
+    }
+
+    num_path_rays += counts.traced;
+    num_pruned_rays += counts.pruned;
+    num_shading_points += counts.shaded;
+    num_lights_reached += counts.lights_reached;
+    num_lights_shaded += counts.lights_shaded;
+    num_shadow_tests += counts.shadow_tests;
+    num_shadow_blocked += counts.shadow_blocked;
+    num_occluder_hits += counts.occluder_hits;
+    num_occluder_misses += counts.occluder_misses;
+}
+
+// whether two neighbouring pixels differ enough to need anti-aliasing, as
+// they will be written out
+static bool high_contrast(Color3 a, Color3 b)
+{
+    a = clamp(a, 0.0, 1.0);
+    b = clamp(b, 0.0, 1.0);
+    return fabs(a.r - b.r) > aa_contrast || fabs(a.g - b.g) > aa_contrast ||
+        fabs(a.b - b.b) > aa_contrast;
+}
+
+// a repeatable jitter in [0, 1) for a sample of a pixel
+static real_t sample_jitter(int x, int y, int sample)
+{
+    uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u ^ sample * 0xcb1ab31fu;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (h >> 8) / real_t(1 << 24);
+}
+
+int Raytracer::supersample_edges(const PacketRegion& region, float refractive,
+                                 Color3* colors, const int* geometry, PathCounts& counts)
+{
+    int w = region.lr.x - region.ll.x + 1;
+    int h = region.ul.y - region.ll.y + 1;
+    bool refine[rays_per_packet];
+    fill(refine, refine + w * h, false);
+
+    // compare each pixel with its right and upper neighbour
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            int i = y * w + x;
+            int neighbours[2] = { x + 1 < w ? i + 1 : -1, y + 1 < h ? i + w : -1 };
+
+            for (int n = 0; n < 2; n++)
+            {
+                int j = neighbours[n];
+
+                if (j >= 0 && (geometry[i] != geometry[j] ||
+                               high_contrast(colors[i], colors[j])))
+                {
+                    refine[i] = true;
+                    refine[j] = true;
+                }
+            }
+        }
+    }
+
+    Vector3 eye = scene->camera.get_position();
+    real_t spread = get_pixel_spread();
+    Color3 sums[rays_per_packet];
+    Packet packet;
+    int owner[rays_per_packet];
+    int refined = 0;
+
+    // the extra samples are scattered over the packet, so they share no
+    // frustum
+    packet.has_frustum = false;
+    packet.num_rays = 0;
+
+    for (int i = 0; i < w * h; i++)
+    {
+        if (!refine[i])
+        {
+            continue;
+        }
+
+        int px = region.ll.x + i % w;
+        int py = region.ll.y + i / w;
+        sums[i] = colors[i];
+        refined++;
+
+        // one jittered sample in each stratum of the pixel
+        for (int s = 0; s < aa_grid * aa_grid; s++)
+        {
+            real_t sx = (s % aa_grid + sample_jitter(px, py, 2 * s)) / aa_grid;
+            real_t sy = (s / aa_grid + sample_jitter(px, py, 2 * s + 1)) / aa_grid;
+            Ray& ray = packet.rays[packet.num_rays];
+            ray = Ray();
+            ray.eye = eye;
+            ray.dir = get_viewing_ray(px + sx, py + sy);
+            ray.spread = spread;
+            owner[packet.num_rays++] = i;
+
+            if (packet.num_rays == rays_per_packet)
+            {
+                trace_samples(packet, owner, refractive, sums, counts);
+                packet.num_rays = 0;
+            }
+        }
+    }
+
+    if (packet.num_rays > 0)
+    {
+        trace_samples(packet, owner, refractive, sums, counts);
+    }
+
+    for (int i = 0; i < w * h; i++)
+    {
+        if (refine[i])
+        {
+            colors[i] = sums[i] * (1.0 / (1 + aa_grid * aa_grid));
+        }
+    }
+
+    return refined;
+}
+
+void Raytracer::trace_samples(Packet& packet, const int* owner, float refractive,
+                              Color3* sums, PathCounts& counts)
+{
+    HitRecord hits[rays_per_packet];
+    bool intersected[rays_per_packet];
+
+    // pad partial packets like trace_packet does
+    for (int r = 0; r < rays_per_packet; r++)
+    {
+        if (r >= packet.num_rays)
+        {
+            packet.rays[r] = packet.rays[0];
         }
+        intersected[r] = false;
+    }
+
+    for (size_t i = 0; i < scene->num_geometries(); i++)
+    {
+        scene->get_geometries()[i]->intersect_packet(packet, hits, intersected);
+    }
+
+    for (int r = 0; r < packet.num_rays; r++)
+    {
+        sums[owner[r]] += intersected[r] ?
+            trace_pixel(packet.rays[r], refractive, &hits[r], counts) :
+            scene->background_color;
     }
 }
 
+// cuts rows [y_start, y_end) into tiles of tile_dim pixels, pre-splitting
+// them with last frame's costs if there are any
+void Raytracer::make_tiles(size_t y_start, size_t y_end, int tile_dim,
+                           bool have_costs, vector<PacketRegion>& tiles) const
+{
+    for (size_t y = y_start; y < y_end; y += tile_dim)
+    {
+        size_t ymax = y + tile_dim - 1;
+
+        if (ymax >= y_end)
+        {
+            ymax = y_end - 1;
+        }
+
+        for (size_t x = 0; x < width; x += tile_dim )
+        {
+            size_t xmax = x + tile_dim - 1;
+
+            if (xmax >= width)
+            {
+                xmax = width - 1;
+            }
+
+            Int2 ll(x, y);
+            Int2 lr(xmax, y);
+            Int2 ul(x, ymax);
+            Int2 ur(xmax, ymax);
+
+            if (have_costs)
+            {
+                presplit_tile(PacketRegion(ll, lr, ul, ur), tiles);
+            }
+            else
+            {
+                tiles.push_back(PacketRegion(ll, lr, ul, ur));
+            }
+        }
+    }
+}
+
+// decides which cpu (or -1 for any) and which node each worker runs on.
+// returns the number of nodes in use.
+int Raytracer::assign_workers(int numthreads)
+{
+    const NumaTopology& topology = get_numa_topology();
+    vector<int> cpus;
+    vector<int> cpu_nodes;
+
+    for (size_t n = 0; n < topology.num_nodes(); n++)
+    {
+        for (size_t c = 0; c < topology.node_cpus[n].size(); c++)
+        {
+            cpus.push_back(topology.node_cpus[n][c]);
+            cpu_nodes.push_back(n);
+        }
+    }
+
+    worker_cpu.assign(numthreads, -1);
+    worker_node.assign(numthreads, 0);
+
+    if (!options.numa && !options.pin_threads)
+    {
+        return 1;
+    }
+
+    // spread the workers over the nodes so each gets a share even when
+    // there are fewer workers than cpus
+    vector<size_t> next_cpu(topology.num_nodes(), 0);
+    int num_nodes = min((int)topology.num_nodes(), numthreads);
+
+    for (int i = 0; i < numthreads; i++)
+    {
+        int n = i % num_nodes;
+        const vector<int>& node_cpus = topology.node_cpus[n];
+        worker_cpu[i] = node_cpus[next_cpu[n]++ % node_cpus.size()];
+        worker_node[i] = options.numa ? n : 0;
+    }
+
+    return options.numa ? num_nodes : 1;
+}
+
 /**
  * Raytraces some portion of the scene. Should raytrace for about
  * max_time duration and then return, even if the raytrace is not complete.
@@ -471,38 +1083,164 @@ void Raytracer::trace_packet(PacketRegion region, float refractive, unsigned cha
  *  work to be done.
  */
 bool Raytracer::raytrace(unsigned char *buffer, real_t* max_time, int numthreads)
+{
+    return raytrace_rows(buffer, max_time, numthreads, 0, height);
+}
+
+bool Raytracer::raytrace_band(unsigned char* band, int numthreads, size_t y_start, size_t y_end)
+{
+    buffer_row = y_start;
+    bool finished = raytrace_rows(band, 0, numthreads, y_start, y_end);
+    buffer_row = 0;
+    return finished;
+}
+
+/**
+ * Like raytrace, but only traces rows [y_start, y_end) of the image. The
+ * rest of the buffer is left untouched.
+ */
+bool Raytracer::raytrace_rows(unsigned char *buffer, real_t* max_time, int numthreads,
+                              size_t y_start, size_t y_end)
 {
     (void) max_time; // unused parameter
     std::thread *thread = new std::thread[numthreads];
-    tsqueue<PacketRegion> packet_queue;
+    vector<PacketRegion> tiles;
+    int tile_dim = options.wavefront ? wavefront_tile_dim :
+        options.adaptive ? adaptive_tile_dim : packet_dim;
 
     double tot_start = CycleTimer::currentSeconds();
 
-    for (size_t y = 0; y < height; y += packet_dim)
+    // the passes after the first spread their primary rays evenly over the
+    // pixels, along a 2,3 halton sequence. the whole image moves by the same
+    // offset, so the frusta of the packets still bound their rays.
+    bool jitter = hdr_buffer && num_passes > 0;
+    pixel_offset_x = jitter ? radical_inverse(num_passes, 2) : 0.5;
+    pixel_offset_y = jitter ? radical_inverse(num_passes, 3) : 0.5;
+
+    // budget per tile so each worker gets a fair number of them, based on
+    // what the last frame cost. without a previous frame only running out
+    // of queued tiles causes splits.
+    bool have_costs = options.adaptive && !packet_costs.empty() && frame_cost > 0;
+    tile_budget = have_costs ?
+        frame_cost / (numthreads * adaptive_tiles_per_thread) : INFINITY;
+
+    if (options.adaptive && packet_costs.empty())
     {
-        size_t ymax = y + packet_dim - 1;
+        packet_costs.assign(packets_x() * packets_y(), 0.0f);
+    }
+
+    // with numa each node gets a band of rows in proportion to its workers,
+    // so its part of the framebuffer and the work on it stay local
+    int num_nodes = assign_workers(numthreads);
+    vector<int> node_workers(num_nodes, 0);
+    vector<size_t> band_start(num_nodes + 1, y_start);
 
-        if (ymax >= height)
+    for (int i = 0; i < numthreads; i++)
+    {
+        node_workers[worker_node[i]]++;
+    }
+
+    for (int n = 0, workers = 0; n < num_nodes; n++)
+    {
+        workers += node_workers[n];
+        size_t rows = (y_end - y_start) * workers / numthreads;
+        band_start[n + 1] = n + 1 == num_nodes ? y_end :
+            min(y_end, y_start + ((rows + tile_dim - 1) / tile_dim) * tile_dim);
+    }
+
+    // either one queue shared by each node's workers, or one contiguous
+    // run of the node's tile order per worker
+    int num_queues = options.segmented ? numthreads : num_nodes;
+    tsqueue<PacketRegion> *packet_queues = new tsqueue<PacketRegion>[num_queues];
+    tile_queues = packet_queues;
+    num_tile_queues = num_queues;
+    num_workers = numthreads;
+    num_splits = 0;
+    num_secondary_rays = 0;
+    num_shadow_rays = 0;
+    num_secondary_packets = 0;
+    num_node_visits = 0;
+    num_active_rays = 0;
+    num_path_rays = 0;
+
+    // every raytracer's frames get their own id, so no thread mistakes the
+    // occluders it cached for another scene for this one's
+    static std::atomic<unsigned> num_frames(0);
+    frame_id = ++num_frames;
+
+    num_pruned_rays = 0;
+    num_shading_points = 0;
+    num_lights_reached = 0;
+    num_lights_shaded = 0;
+    num_shadow_tests = 0;
+    num_shadow_blocked = 0;
+    num_occluder_hits = 0;
+    num_occluder_misses = 0;
+    num_refined_pixels = 0;
+    num_extra_samples = 0;
+    get_tile_cache().reset_stats();
+    queue_node.assign(num_queues, 0);
+    worker_queue.assign(numthreads, 0);
+
+    for (int n = 0, q = 0; n < num_nodes; n++)
+    {
+        vector<PacketRegion> band_tiles;
+        make_tiles(band_start[n], band_start[n + 1], tile_dim, have_costs, band_tiles);
+
+        if (options.tile_order != TILE_ORDER_RASTER)
         {
-            ymax = height - 1;
+            order_tiles(band_tiles, options.tile_order);
         }
 
-        for (size_t x = 0; x < width; x += packet_dim )
+        int band_queues = options.segmented ? node_workers[n] : 1;
+
+        for (int i = 0, w = 0; i < numthreads; i++)
         {
-            size_t xmax = x + packet_dim - 1;
+            if (worker_node[i] == n)
+            {
+                worker_queue[i] = q + (options.segmented ? w++ : 0);
+            }
+        }
 
-            if (xmax >= width)
+        for (int i = 0; i < band_queues; i++, q++)
+        {
+            size_t seg_start = band_tiles.size() * i / band_queues;
+            size_t seg_end = band_tiles.size() * (i + 1) / band_queues;
+            queue_node[q] = n;
+
+            for (size_t j = seg_start; j < seg_end; j++)
             {
-                xmax = width - 1;
+                packet_queues[q].Push(band_tiles[j]);
             }
+        }
 
-            Int2 ll(x, y);
-            Int2 lr(xmax, y);
-            Int2 ul(x, ymax);
-            Int2 ur(xmax, ymax);
-            PacketRegion packet(ll, lr, ul, ur);
-            packet_queue.Push(packet);
+        tiles.insert(tiles.end(), band_tiles.begin(), band_tiles.end());
+    }
+
+    // place each band of a new framebuffer on its node by writing it from
+    // a thread pinned there before anyone else does
+    if (options.numa && (buffer != first_touched ||
+                         framebuffer_generation() != first_touched_generation))
+    {
+        for (int n = 0; n < num_nodes; n++)
+        {
+            int cpu = get_numa_topology().node_cpus[n][0];
+            unsigned char* band = buffer + 4 * width * (band_start[n] - buffer_row);
+            size_t band_size = 4 * width * (band_start[n + 1] - band_start[n]);
+            thread[n] = std::thread([cpu, band, band_size]()
+            {
+                pin_current_thread(cpu);
+                memset(band, 0, band_size);
+            });
         }
+
+        for (int n = 0; n < num_nodes; n++)
+        {
+            thread[n].join();
+        }
+
+        first_touched = buffer;
+        first_touched_generation = framebuffer_generation();
     }
 
     double push_duration = CycleTimer::currentSeconds() - tot_start;
@@ -511,7 +1249,7 @@ bool Raytracer::raytrace(unsigned char *buffer, real_t* max_time, int numthreads
     for (int i = 0; i < numthreads; i++)
     {
         //cout << "Launching thread " << i << endl;
-        thread[i] = std::thread(&Raytracer::trace_packet_worker, this, &packet_queue, buffer);
+        thread[i] = std::thread(&Raytracer::trace_packet_worker, this, i, buffer);
     }
 
     for (int i = 0; i < numthreads; i++)
@@ -525,8 +1263,116 @@ bool Raytracer::raytrace(unsigned char *buffer, real_t* max_time, int numthreads
 
     cout << numthreads << " Total time:    " << tot_duration    << endl
          << numthreads << " Push time:     " << push_duration   << endl
-         << numthreads << " Thread time:   " << thread_duration << endl;
+         << numthreads << " Thread time:   " << thread_duration << endl
+         << numthreads << " Primary rays/s: " << (width * (y_end - y_start)) / thread_duration
+         << " (" << tile_order_name(options.tile_order)
+         << (options.wavefront ? ", wavefront" : "")
+         << (options.segmented ? ", segmented" : "")
+         << (options.pin_threads ? ", pinned" : "");
+
+    if (options.numa)
+    {
+        cout << ", " << num_nodes << " numa node" << (num_nodes > 1 ? "s" : "");
+    }
+
+    cout << ")" << endl;
+
+    cout << numthreads << " Bounce rays:   " << num_path_rays << " traced, "
+         << num_pruned_rays << " pruned (depth " << options.max_depth
+         << ", min weight " << options.min_weight << ")" << endl;
+
+    long shading_points = max(1L, (long) num_shading_points);
+    cout << numthreads << " Lights:        " << scene->num_lights() << " in scene, "
+         << light_tree.num_culled() << " never bright enough, "
+         << light_tree.num_unbounded() << " reaching everywhere, "
+         << light_tree.num_nodes() << " tree nodes (cutoff " << options.light_cutoff
+         << "); per shading point " << (double) num_lights_reached / shading_points
+         << " reached, " << (double) num_lights_shaded / shading_points << " shaded";
+
+    if (options.light_samples > 0)
+    {
+        cout << " (at most " << options.light_samples << " sampled)";
+    }
+
+    cout << endl;
+
+    cout << numthreads << " Shadow rays:   " << num_shadow_tests << " tested, "
+         << num_shadow_blocked << " blocked";
+
+    if (options.occluder_cache)
+    {
+        long blocked = max(1L, (long) num_shadow_blocked);
+        cout << ", " << num_occluder_hits << " of them by the light's last occluder ("
+             << 100.0 * num_occluder_hits / blocked << "% hit rate), "
+             << num_occluder_misses << " tried it in vain";
+    }
+    else
+    {
+        cout << " (occluder cache off)";
+    }
+
+    cout << endl;
+
+    if (extras && !options.wavefront)
+    {
+        long pixels = width * (y_end - y_start);
+        cout << numthreads << " Anti-aliasing: " << num_refined_pixels << " of " << pixels
+             << " pixels refined (" << 100.0 * num_refined_pixels / pixels << "%), "
+             << num_extra_samples << " extra samples, "
+             << 1.0 + (double) num_extra_samples / pixels
+             << " samples per pixel against " << 1 + aa_grid * aa_grid
+             << " for every pixel" << endl;
+    }
+
+    if (get_tile_cache().enabled())
+    {
+        TileCacheStats tiles = get_tile_cache().get_stats();
+        size_t lookups = tiles.hits + tiles.misses;
+        cout << numthreads << " Texture tiles: " << tiles.hits << " hits, "
+             << tiles.misses << " misses ("
+             << (lookups > 0 ? 100.0 * tiles.hits / lookups : 0) << "% hit rate), "
+             << tiles.evictions << " evicted, " << (tiles.resident >> 20)
+             << " MB resident of " << (get_tile_cache().get_budget() >> 20)
+             << " MB" << endl;
+    }
+
+    if (options.wavefront)
+    {
+        cout << numthreads << " Wavefront rays: " << num_secondary_rays << " secondary, "
+             << num_shadow_rays << " shadow" << endl;
+
+        // share of the packet's rays still active at the average bvh node
+        double occupancy = num_node_visits > 0 ?
+            100.0 * num_active_rays / ((double) num_node_visits * rays_per_packet) : 0;
+        cout << numthreads << " Secondary packets: " << num_secondary_packets
+             << ", " << occupancy << "% occupancy over " << num_node_visits
+             << " bvh node visits (" << (options.sort_rays ? "sorted" : "unsorted")
+             << ")" << endl;
+    }
+
+    if (options.adaptive)
+    {
+        frame_cost = 0;
+
+        for (size_t i = 0; i < packet_costs.size(); i++)
+        {
+            frame_cost += packet_costs[i];
+        }
+
+        cout << numthreads << " Tiles:         " << tiles.size() << " queued, "
+             << num_splits << " split while tracing" << endl;
+    }
+
+    if (hdr_buffer)
+    {
+        num_passes++;
+        cout << numthreads << " Accumulation:  " << num_passes << " passes, this one through ("
+             << pixel_offset_x << ", " << pixel_offset_y << ") of each pixel" << endl;
+    }
 
+    tile_queues = NULL;
+    num_tile_queues = 0;
+    delete [] packet_queues;
     delete [] thread;
 
     return true;
@@ -5,10 +5,72 @@
 #include "scene/scene.hpp"
 #include "tsqueue.hpp"
 #include "geom_utils.hpp"
+#include "tile_order.hpp"
+#include "light_tree.hpp"
+#include <atomic>
+#include <vector>
 
 namespace _462
 {
 
+struct RaytraceOptions
+{
+    RaytraceOptions() : tile_order(TILE_ORDER_RASTER), segmented(false),
+                        adaptive(false), pin_threads(false), numa(false),
+                        wavefront(false), sort_rays(false),
+                        max_depth(default_max_depth),
+                        min_weight(default_min_weight),
+                        light_cutoff(default_light_cutoff), light_samples(0),
+                        occluder_cache(true) { }
+
+    // order in which tiles are handed out to the workers
+    TileOrder tile_order;
+
+    // give each worker its own contiguous run of the tile order (stealing
+    // from the other runs once its own is done) instead of a shared queue
+    bool segmented;
+
+    // start from large tiles and split them up based on their measured cost
+    bool adaptive;
+
+    // pin each worker to a single cpu
+    bool pin_threads;
+
+    // give each NUMA node its own band of the image, with the workers and
+    // framebuffer pages of that band kept on the node. implies pinning.
+    bool numa;
+
+    // trace each tile breadth first, one bounce at a time, instead of
+    // following each pixel's path to the end per packet
+    bool wavefront;
+
+    // in wavefront mode, sort each bounce of secondary rays by direction
+    // octant and origin before tracing it
+    bool sort_rays;
+
+    // reflections and refractions followed from each primary ray, at most
+    // max_trace_depth
+    int max_depth;
+
+    // reflected and transmitted rays whose weight falls below this in every
+    // channel are dropped instead of traced
+    real_t min_weight;
+
+    // lights are culled beyond the distance at which they add less than
+    // this to a pixel; 0 never culls
+    real_t light_cutoff;
+
+    // lights sampled at random per shading point when more reach it, at
+    // most max_light_samples; 0 shades with every light that reaches it
+    int light_samples;
+
+    // test each shadow ray against the last thing that blocked the thread's
+    // shadow rays to the same light before the whole scene
+    bool occluder_cache;
+};
+
+struct WavefrontState;
+
 class Raytracer
 {
 public:
@@ -17,29 +79,111 @@ public:
 
     ~Raytracer();
 
-    bool initialize(Scene* _scene, size_t _width, size_t _height, bool _extras);
+    /**
+     * Prepares the raytracer to render the given scene.
+     * @param scene_built true if build_scene was already run on the scene,
+     *  e.g. by a loader thread, so the bounding volumes are not rebuilt.
+     */
+    bool initialize(Scene* _scene, size_t _width, size_t _height, bool _extras,
+                    const RaytraceOptions& _options, bool scene_built = false);
+
+    /**
+     * Computes the transformation matrices and bounding volumes of every
+     * geometry in the scene. Touches nothing but the scene, so it can run on
+     * one scene while another is being traced.
+     */
+    static void build_scene(Scene* scene);
+
+    /**
+     * Makes every raytrace also accumulate the image into hdr, a float
+     * framebuffer of width x height RGB pixels in the same row order as the
+     * 8-bit one, or stops it if hdr is null. hdr holds the mean of the
+     * passes traced since the last reset, unclamped, and the 8-bit
+     * framebuffer shows that mean. Every pass after the first sends the
+     * primary rays through another point of their pixels, so the passes add
+     * up to an anti-aliased image. hdr has to outlive the raytraces.
+     */
+    void set_hdr_buffer(float* hdr);
+
+    /// starts the accumulation over, e.g. after the camera moved
+    void reset_accumulation() { num_passes = 0; }
+
+    /// passes accumulated in the hdr buffer since the last reset
+    size_t accumulated_passes() const { return num_passes; }
 
     bool raytrace(unsigned char* buffer, real_t* max_time, int numthreads);
 
-    void trace_packet_worker(tsqueue<PacketRegion> *packet_queue, unsigned char *buffer);
+    bool raytrace_rows(unsigned char* buffer, real_t* max_time, int numthreads,
+                       size_t y_start, size_t y_end);
+
+    /**
+     * Like raytrace_rows, but band only holds rows [y_start, y_end) of the
+     * image, so an image can be traced a band at a time into a buffer of
+     * just a few bands.
+     */
+    bool raytrace_band(unsigned char* band, int numthreads, size_t y_start, size_t y_end);
+
+    void trace_packet_worker(int id, unsigned char *buffer);
+
+    void trace_tile(PacketRegion tile, tsqueue<PacketRegion> *own_queue,
+                    unsigned char *buffer);
 
     void trace_packet(PacketRegion packet, float refractive, unsigned char* buffer);
 
+    /**
+     * Adaptive anti-aliasing of a traced packet: pixels that hit a different
+     * geometry than a neighbour in the packet, or differ from it by more
+     * than aa_contrast in a channel, get aa_grid x aa_grid stratified extra
+     * samples averaged in with the first.
+     * @param colors The colors of the packet's pixels, row by row; refined
+     *  in place.
+     * @param geometry The geometry each pixel's ray hit, -1 for none.
+     * @return The number of pixels refined.
+     */
+    int supersample_edges(const PacketRegion& region, float refractive, Color3* colors,
+                          const int* geometry, PathCounts& counts);
+
+    /// traces the first num_rays rays of a packet of primary rays, adding each to sums[owner]
+    void trace_samples(Packet& packet, const int* owner, float refractive,
+                       Color3* sums, PathCounts& counts);
+
+    void trace_wavefront(PacketRegion tile, unsigned char* buffer);
+
+    void shade_wavefront(const Ray& ray, const Color3& weight, float refractive,
+                         int pixel, int depth, const HitRecord& hit,
+                         WavefrontState& state, PathCounts& counts);
+
     void get_viewing_frustum(Int2 ll, Int2 lr, Int2 ul, Int2 ur,
                              Frustum& frustum);
 
     Vector3 get_viewing_ray(Int2 pixel);
 
-    Color3 trace_pixel(int recursions, const Ray& ray, float refractive);
+    /// the viewing ray through a point of the image, in pixels from its bottom-left corner
+    Vector3 get_viewing_ray(real_t x, real_t y);
+
+    real_t get_pixel_spread();
 
-    Color3 trace_pixel_end(int recursions, const Ray& ray, float refractive,
-            IsectInfo min_info);
+    /**
+     * Traces the path of a pixel: the reflections and refractions of a ray,
+     * followed up to options.max_depth bounces with an explicit stack.
+     * @param first_hit The closest hit of the ray, if already known.
+     */
+    Color3 trace_pixel(const Ray& ray, float refractive, const HitRecord* first_hit,
+                       PathCounts& counts);
 
     Color3 get_diffuse(Vector3 intersection_point, Vector3 min_normal,
-                       Color3 min_diffuse, float eps);
+                       Color3 min_diffuse, float eps, PathCounts& counts);
 
     bool refract(Vector3 d, Vector3 normal, float n, Vector3 *t);
 
+    /**
+     * Whether anything blocks a shadow ray towards a light. The geometry
+     * and primitive that last blocked one of the calling thread's shadow
+     * rays to the light are tested first, since neighbouring points mostly
+     * share them.
+     */
+    bool shadow_test(const Ray& shadow_ray, size_t light, PathCounts& counts);
+
 private:
 
     // the scene to trace
@@ -50,6 +194,93 @@ private:
 
     // for things like anti-aliasing
     bool extras;
+
+    // scheduling options
+    RaytraceOptions options;
+
+    // the spheres of the scene's lights, to find the ones reaching a point
+    LightTree light_tree;
+
+    // seconds spent on each packet in the last frame, in raster order of
+    // packets. empty until a frame has been traced with adaptive tiling.
+    std::vector<float> packet_costs;
+
+    // total of packet_costs
+    double frame_cost;
+
+    // state shared by the workers during a frame
+    tsqueue<PacketRegion> *tile_queues;
+    int num_tile_queues;
+    int num_workers;
+    // a tile that has taken longer than this sheds its untraced parts
+    double tile_budget;
+    std::atomic<int> num_splits;
+    // rays queued by the wavefront tracer beyond the primary ones
+    std::atomic<long> num_secondary_rays;
+    std::atomic<long> num_shadow_rays;
+    // packets of secondary rays and how full they were in the bvh
+    std::atomic<long> num_secondary_packets;
+    std::atomic<long> num_node_visits;
+    std::atomic<long> num_active_rays;
+    // reflected and transmitted rays traced and pruned
+    std::atomic<long> num_path_rays;
+    std::atomic<long> num_pruned_rays;
+    // shading points, lights reaching them and lights they were shaded with
+    std::atomic<long> num_shading_points;
+    std::atomic<long> num_lights_reached;
+    std::atomic<long> num_lights_shaded;
+    // shadow rays tested and blocked, and blocked or not by the cached
+    // occluder
+    std::atomic<long> num_shadow_tests;
+    std::atomic<long> num_shadow_blocked;
+    std::atomic<long> num_occluder_hits;
+    std::atomic<long> num_occluder_misses;
+    // pixels anti-aliased and the extra samples they took
+    std::atomic<long> num_refined_pixels;
+    std::atomic<long> num_extra_samples;
+    // tells the threads' occluder caches apart from those of earlier frames
+    unsigned frame_id;
+    // cpu each worker is pinned to, or -1
+    std::vector<int> worker_cpu;
+    // numa node of each worker and queue, and the queue each worker owns
+    std::vector<int> worker_node;
+    std::vector<int> queue_node;
+    std::vector<int> worker_queue;
+
+    // the last framebuffer whose pages were placed on the numa nodes, and
+    // the framebuffer_generation it was placed in; a later buffer reusing
+    // its address is placed again
+    unsigned char* first_touched;
+    unsigned long first_touched_generation;
+
+    // the row of the image the framebuffers being traced into start at
+    size_t buffer_row;
+
+    // float framebuffer the passes are accumulated into, or null
+    float* hdr_buffer;
+    size_t num_passes;
+    // where in its pixel the primary ray of every pixel goes through this
+    // pass, (0.5, 0.5) being the center
+    real_t pixel_offset_x, pixel_offset_y;
+
+    // writes a traced pixel to the framebuffer, through the hdr buffer
+    void store_pixel(unsigned char* buffer, size_t index, const Color3& color);
+
+    size_t packets_x() const { return (width + packet_dim - 1) / packet_dim; }
+    size_t packets_y() const { return (height + packet_dim - 1) / packet_dim; }
+    size_t tiles_remaining();
+    double estimate_cost(const PacketRegion& tile) const;
+    void presplit_tile(const PacketRegion& tile, std::vector<PacketRegion>& tiles) const;
+    void make_tiles(size_t y_start, size_t y_end, int tile_dim, bool have_costs,
+                    std::vector<PacketRegion>& tiles) const;
+    int assign_workers(int numthreads);
+
+    // whether a branch with this weight can still show up in the image
+    bool worth_tracing(const Color3& weight) const
+    {
+        return weight.r > options.min_weight || weight.g > options.min_weight ||
+            weight.b > options.min_weight;
+    }
 };
 
 } /* _462 */
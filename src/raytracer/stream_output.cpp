@@ -0,0 +1,141 @@
+#include <iostream>
+#include <thread>
+#include "raytracer/stream_output.hpp"
+#include "raytracer/numa.hpp"
+#include "raytracer/CycleTimer.hpp"
+#include "application/imageio.hpp"
+
+using namespace std;
+
+namespace _462
+{
+
+// a band being written on the writer thread
+struct WrittenBand
+{
+    WrittenBand() : png(0), rows(0), num_rows(0), ok(true), write_time(0) { }
+
+    ImageioPngWriter* png;
+    const unsigned char* rows;
+    int num_rows;
+    bool ok;
+    double write_time;
+};
+
+static void write_band(WrittenBand* band)
+{
+    double start = CycleTimer::currentSeconds();
+    band->ok = imageio_png_write_rows(band->png, band->rows, band->num_rows);
+    band->write_time = CycleTimer::currentSeconds() - start;
+}
+
+// waits for the band on the writer thread, if any, and adds up its times
+static bool finish_band(thread& writer, const WrittenBand& band,
+                        double* total_write, double* stalled)
+{
+    if (!writer.joinable())
+    {
+        return true;
+    }
+
+    // anything left to wait for here is write time not hidden behind
+    // tracing the next band
+    double wait_start = CycleTimer::currentSeconds();
+    writer.join();
+    *stalled += CycleTimer::currentSeconds() - wait_start;
+    *total_write += band.write_time;
+    return band.ok;
+}
+
+bool raytrace_streamed(Raytracer* raytracer, const char* filename, int width, int height,
+                       int band_rows, int numthreads)
+{
+    // bands of whole packets. a band a row high would trace packets with a
+    // flat frustum, which culls everything.
+    band_rows = ((band_rows + packet_dim - 1) / packet_dim) * packet_dim;
+    band_rows = min(band_rows, height);
+
+    // one band is traced into while the other one is written
+    size_t band_size = 4 * (size_t) width * band_rows;
+    unsigned char* buffers[2];
+    buffers[0] = framebuffer_alloc(band_size);
+    buffers[1] = buffers[0] ? framebuffer_alloc(band_size) : 0;
+    if (!buffers[1])
+    {
+        framebuffer_free(buffers[0], band_size);
+        cout << "Unable to allocate buffer.\n";
+        return false;
+    }
+
+    ImageioPngWriter* png = imageio_png_begin(filename, width, height);
+    if (!png)
+    {
+        framebuffer_free(buffers[0], band_size);
+        framebuffer_free(buffers[1], band_size);
+        cout << "Error creating '" << filename << "'.\n";
+        return false;
+    }
+
+    double start = CycleTimer::currentSeconds();
+    double total_trace = 0, total_write = 0, stalled = 0;
+    size_t num_bands = 0;
+    bool ok = true;
+
+    WrittenBand written;
+    thread writer;
+
+    // png rows go from the top down, the framebuffer's from the bottom up.
+    // bands start on multiples of band_rows, so their packets lie on the
+    // same grid as those of the whole image and only the top band is short.
+    int y_start = (height - 1) / band_rows * band_rows;
+    for (int y_end = height; y_end > 0 && ok; y_end = y_start, y_start -= band_rows, num_bands++)
+    {
+        unsigned char* buffer = buffers[num_bands % 2];
+
+        double trace_start = CycleTimer::currentSeconds();
+        raytracer->raytrace_band(buffer, numthreads, y_start, y_end);
+        total_trace += CycleTimer::currentSeconds() - trace_start;
+
+        ok = finish_band(writer, written, &total_write, &stalled);
+        written.png = png;
+        written.rows = buffer;
+        written.num_rows = y_end - y_start;
+        if (ok)
+        {
+            writer = thread(write_band, &written);
+        }
+    }
+
+    ok = finish_band(writer, written, &total_write, &stalled) && ok;
+
+    ImageioPngStats stats = ImageioPngStats();
+    ok = imageio_png_end(png, &stats) && ok;
+
+    framebuffer_free(buffers[0], band_size);
+    framebuffer_free(buffers[1], band_size);
+
+    if (ok)
+    {
+        cout << "Saved raytraced image to '" << filename << "'.\n";
+    }
+    else
+    {
+        cout << "Error saving raytraced image to '" << filename << "'.\n";
+    }
+
+    size_t full_size = 4 * (size_t) width * height;
+    cout << numthreads << " Stream time:   " << CycleTimer::currentSeconds() - start << endl
+         << numthreads << " Bands:         " << num_bands << " of " << band_rows << " rows, "
+         << (2 * band_size) / 1024 << " KB resident instead of " << full_size / 1024
+         << " KB" << endl
+         << numthreads << " Band trace:    " << total_trace << endl
+         << numthreads << " Band write:    " << total_write << " (" << stalled
+         << "s not hidden by tracing; filter " << stats.filter_time << ", deflate "
+         << stats.deflate_time << ", write " << stats.write_time << ")" << endl
+         << numthreads << " Png size:      " << stats.bytes << " bytes (" << stats.strips
+         << " strips)" << endl;
+
+    return ok;
+}
+
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "raytracer/raytracer.hpp"
+
+namespace _462
+{
+
+/**
+ * Traces an image a band of rows at a time, from the top down, and writes
+ * each band to a png as soon as every tile of it is done. A band is
+ * compressed and written on a writer thread while the next one is traced,
+ * so only two bands of the image are ever in memory, however large it is.
+ * @param raytracer Initialized for an image of width x height.
+ * @param band_rows Rows per band; rounding it to a multiple of the tile
+ *  size keeps tiles from being cut at the band edges.
+ * @return true if the whole image was traced and saved.
+ */
+bool raytrace_streamed(Raytracer* raytracer, const char* filename, int width, int height,
+                       int band_rows, int numthreads);
+
+}
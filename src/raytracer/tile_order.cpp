@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <cstring>
+#include "raytracer/tile_order.hpp"
+
+using namespace std;
+
+namespace _462
+{
+
+// spreads the low 16 bits of v out so there is a zero between each bit
+static uint32_t part_1_by_1(uint32_t v)
+{
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+uint32_t morton_encode(uint32_t x, uint32_t y)
+{
+    return part_1_by_1(x) | (part_1_by_1(y) << 1);
+}
+
+uint64_t hilbert_encode(uint32_t n, uint32_t x, uint32_t y)
+{
+    uint64_t d = 0;
+
+    for (uint32_t s = n / 2; s > 0; s /= 2)
+    {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ ry);
+
+        // rotate the quadrant so the sub-curve is in standard orientation
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+
+            swap(x, y);
+        }
+    }
+
+    return d;
+}
+
+struct TileKey
+{
+    uint64_t key;
+    PacketRegion tile;
+
+    bool operator<(const TileKey& rhs) const
+    {
+        return key < rhs.key;
+    }
+};
+
+void order_tiles(vector<PacketRegion>& tiles, TileOrder order)
+{
+    if (tiles.empty())
+    {
+        return;
+    }
+
+    // work in tile coordinates so the curve steps one tile at a time
+    uint32_t max_coord = 0;
+
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        max_coord = max(max_coord, (uint32_t)(tiles[i].ll.x / packet_dim));
+        max_coord = max(max_coord, (uint32_t)(tiles[i].ll.y / packet_dim));
+    }
+
+    uint32_t n = 1;
+
+    while (n <= max_coord)
+    {
+        n *= 2;
+    }
+
+    vector<TileKey> keys(tiles.size());
+
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        uint32_t tx = tiles[i].ll.x / packet_dim;
+        uint32_t ty = tiles[i].ll.y / packet_dim;
+
+        switch (order)
+        {
+        case TILE_ORDER_MORTON:
+            keys[i].key = morton_encode(tx, ty);
+            break;
+        case TILE_ORDER_HILBERT:
+            keys[i].key = hilbert_encode(n, tx, ty);
+            break;
+        case TILE_ORDER_RASTER:
+        default:
+            keys[i].key = (uint64_t)ty * n + tx;
+            break;
+        }
+
+        keys[i].tile = tiles[i];
+    }
+
+    stable_sort(keys.begin(), keys.end());
+
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        tiles[i] = keys[i].tile;
+    }
+}
+
+bool parse_tile_order(const char* name, TileOrder* order)
+{
+    if (strcmp(name, "raster") == 0)
+    {
+        *order = TILE_ORDER_RASTER;
+    }
+    else if (strcmp(name, "morton") == 0)
+    {
+        *order = TILE_ORDER_MORTON;
+    }
+    else if (strcmp(name, "hilbert") == 0)
+    {
+        *order = TILE_ORDER_HILBERT;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+const char* tile_order_name(TileOrder order)
+{
+    switch (order)
+    {
+    case TILE_ORDER_MORTON:
+        return "morton";
+    case TILE_ORDER_HILBERT:
+        return "hilbert";
+    case TILE_ORDER_RASTER:
+    default:
+        return "raster";
+    }
+}
+
+}
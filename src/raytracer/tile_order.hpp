@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include "raytracer/ray.hpp"
+
+namespace _462
+{
+
+// order in which image tiles are handed out to the worker threads
+enum TileOrder
+{
+    TILE_ORDER_RASTER,
+    TILE_ORDER_MORTON,
+    TILE_ORDER_HILBERT
+};
+
+// interleaves the low 16 bits of x and y (x in the even bits)
+uint32_t morton_encode(uint32_t x, uint32_t y);
+
+// distance of (x, y) along the hilbert curve filling an n x n grid, where n
+// is a power of two greater than every coordinate
+uint64_t hilbert_encode(uint32_t n, uint32_t x, uint32_t y);
+
+// reorders tiles (given in any order) so that consecutive tiles are adjacent
+// along the requested curve. tiles are identified by their lower left pixel.
+void order_tiles(std::vector<PacketRegion>& tiles, TileOrder order);
+
+// parses "raster", "morton" or "hilbert". returns false on anything else.
+bool parse_tile_order(const char* name, TileOrder* order);
+
+const char* tile_order_name(TileOrder order);
+
+}
@@ -1,21 +1,28 @@
 #pragma once
 
-#include <queue>
+#include <deque>
 #include <mutex>
 
 template<class T>
 class tsqueue
 {
 private:
-    std::queue<T> q;
+    std::deque<T> q;
     std::mutex mut;
 public:
     void Push(T item)
     {
         mut.lock();
-        q.push(item);
+        q.push_back(item);
         mut.unlock();
     }
+    size_t Size()
+    {
+        mut.lock();
+        size_t ret = q.size();
+        mut.unlock();
+        return ret;
+    }
     T Pop(bool& empty)
     {
         mut.lock();
@@ -29,7 +36,27 @@ public:
         }
 
         ret = q.front();
-        q.pop();
+        q.pop_front();
+
+        mut.unlock();
+        return ret;
+    }
+    // takes from the opposite end to Pop, so a thief works on the far end
+    // of another worker's run of items
+    T Steal(bool& empty)
+    {
+        mut.lock();
+        empty = q.empty();
+        T ret;
+
+        if (empty)
+        {
+            mut.unlock();
+            return ret;
+        }
+
+        ret = q.back();
+        q.pop_back();
 
         mut.unlock();
         return ret;
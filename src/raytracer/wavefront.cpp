@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <stdint.h>
+#include "raytracer/wavefront.hpp"
+#include "raytracer/raytracer.hpp"
+#include "scene/scene.hpp"
+
+using namespace std;
+
+namespace _462
+{
+
+void RayQueue::push(const Ray& ray, const Color3& w, float refr, int pix)
+{
+    eye_x.push_back(ray.eye.x);
+    eye_y.push_back(ray.eye.y);
+    eye_z.push_back(ray.eye.z);
+    dir_x.push_back(ray.dir.x);
+    dir_y.push_back(ray.dir.y);
+    dir_z.push_back(ray.dir.z);
+    width.push_back(ray.width);
+    spread.push_back(ray.spread);
+    weight_r.push_back(w.r);
+    weight_g.push_back(w.g);
+    weight_b.push_back(w.b);
+    refractive.push_back(refr);
+    pixel.push_back(pix);
+}
+
+void RayQueue::clear()
+{
+    eye_x.clear();
+    eye_y.clear();
+    eye_z.clear();
+    dir_x.clear();
+    dir_y.clear();
+    dir_z.clear();
+    width.clear();
+    spread.clear();
+    weight_r.clear();
+    weight_g.clear();
+    weight_b.clear();
+    refractive.clear();
+    pixel.clear();
+}
+
+void RayQueue::copy(const RayQueue& from, size_t i)
+{
+    eye_x.push_back(from.eye_x[i]);
+    eye_y.push_back(from.eye_y[i]);
+    eye_z.push_back(from.eye_z[i]);
+    dir_x.push_back(from.dir_x[i]);
+    dir_y.push_back(from.dir_y[i]);
+    dir_z.push_back(from.dir_z[i]);
+    width.push_back(from.width[i]);
+    spread.push_back(from.spread[i]);
+    weight_r.push_back(from.weight_r[i]);
+    weight_g.push_back(from.weight_g[i]);
+    weight_b.push_back(from.weight_b[i]);
+    refractive.push_back(from.refractive[i]);
+    pixel.push_back(from.pixel[i]);
+}
+
+void ShadowQueue::push(const Ray& ray, const Color3& light, int pix, int index)
+{
+    eye_x.push_back(ray.eye.x);
+    eye_y.push_back(ray.eye.y);
+    eye_z.push_back(ray.eye.z);
+    dir_x.push_back(ray.dir.x);
+    dir_y.push_back(ray.dir.y);
+    dir_z.push_back(ray.dir.z);
+    light_r.push_back(light.r);
+    light_g.push_back(light.g);
+    light_b.push_back(light.b);
+    pixel.push_back(pix);
+    light_index.push_back(index);
+}
+
+void ShadowQueue::clear()
+{
+    eye_x.clear();
+    eye_y.clear();
+    eye_z.clear();
+    dir_x.clear();
+    dir_y.clear();
+    dir_z.clear();
+    light_r.clear();
+    light_g.clear();
+    light_b.clear();
+    pixel.clear();
+    light_index.clear();
+}
+
+// queues live as long as the worker thread, so they only grow once
+static thread_local WavefrontState wavefront_state;
+
+// spreads the low 10 bits of x out to every third bit
+static uint64_t part_1_by_2(uint64_t x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+static uint32_t quantize(real_t v, real_t min, real_t scale)
+{
+    real_t q = (v - min) * scale;
+    return q <= 0 ? 0 : q >= 1023 ? 1023 : (uint32_t) q;
+}
+
+/**
+ * Reorders the rays so that rays heading the same way from nearby origins
+ * end up in the same packet: the key is the direction octant followed by
+ * the morton code of the origin on a 1024^3 grid over the origins' bounds.
+ */
+static void sort_rays(WavefrontState& state)
+{
+    RayQueue& rays = state.rays;
+    size_t num_rays = rays.size();
+    Vector3 min_eye(INFINITY, INFINITY, INFINITY);
+    Vector3 max_eye(-INFINITY, -INFINITY, -INFINITY);
+
+    for (size_t i = 0; i < num_rays; i++)
+    {
+        min_eye.x = std::min(min_eye.x, rays.eye_x[i]);
+        min_eye.y = std::min(min_eye.y, rays.eye_y[i]);
+        min_eye.z = std::min(min_eye.z, rays.eye_z[i]);
+        max_eye.x = std::max(max_eye.x, rays.eye_x[i]);
+        max_eye.y = std::max(max_eye.y, rays.eye_y[i]);
+        max_eye.z = std::max(max_eye.z, rays.eye_z[i]);
+    }
+
+    Vector3 extent = max_eye - min_eye;
+    real_t size = std::max(extent.x, std::max(extent.y, extent.z));
+    real_t scale = size > 0 ? 1024 / size : 0;
+
+    state.keys.resize(num_rays);
+
+    for (size_t i = 0; i < num_rays; i++)
+    {
+        uint64_t octant = (rays.dir_x[i] < 0) | (rays.dir_y[i] < 0) << 1 |
+                          (rays.dir_z[i] < 0) << 2;
+        uint64_t morton = part_1_by_2(quantize(rays.eye_x[i], min_eye.x, scale)) |
+                          part_1_by_2(quantize(rays.eye_y[i], min_eye.y, scale)) << 1 |
+                          part_1_by_2(quantize(rays.eye_z[i], min_eye.z, scale)) << 2;
+        state.keys[i] = std::make_pair(octant << 30 | morton, (uint32_t) i);
+    }
+
+    std::sort(state.keys.begin(), state.keys.end());
+
+    state.sorted_rays.clear();
+
+    for (size_t i = 0; i < num_rays; i++)
+    {
+        state.sorted_rays.copy(rays, state.keys[i].second);
+    }
+
+    swap(state.rays, state.sorted_rays);
+}
+
+/**
+ * Traces a tile breadth first: all rays of a bounce are intersected, then
+ * shaded, then their shadow rays are tested, before any ray of the next
+ * bounce. Produces the same colors as trace_packet, summed in a different
+ * order.
+ */
+void Raytracer::trace_wavefront(PacketRegion tile, unsigned char *buffer)
+{
+    WavefrontState& state = wavefront_state;
+    int tile_w = tile.lr.x - tile.ll.x + 1;
+    int tile_h = tile.ul.y - tile.ll.y + 1;
+    size_t num_geometries = scene->num_geometries();
+    Geometry* const* geometries = scene->get_geometries();
+    long secondary_rays = 0;
+    long shadow_rays = 0;
+    long secondary_packets = 0;
+    PacketOccupancy occupancy;
+    PathCounts counts;
+
+    state.accum.assign(tile_w * tile_h, Color3::Black);
+    state.rays.clear();
+
+    // generate the primary rays
+    Vector3 eye = scene->camera.get_position();
+    real_t spread = get_pixel_spread();
+
+    for (int y = 0; y < tile_h; y++)
+    {
+        for (int x = 0; x < tile_w; x++)
+        {
+            Ray ray;
+            ray.eye = eye;
+            ray.dir = get_viewing_ray(Int2(tile.ll.x + x, tile.ll.y + y));
+            ray.spread = spread;
+            state.rays.push(ray, Color3::White, 1.0, y * tile_w + x);
+        }
+    }
+
+    for (int depth = 0; state.rays.size() > 0; depth++)
+    {
+        if (depth > 0 && options.sort_rays)
+        {
+            sort_rays(state);
+        }
+
+        RayQueue& rays = state.rays;
+        size_t num_rays = rays.size();
+
+        // intersect the bounce in packets of consecutive rays. they have no
+        // common frustum, so only the bvh traversal benefits.
+        state.isects.assign(num_rays, HitRecord());
+        state.hit.assign(num_rays, 0);
+
+        for (size_t start = 0; start < num_rays; start += rays_per_packet)
+        {
+            Packet packet;
+            bool intersected[rays_per_packet];
+            packet.has_frustum = false;
+            packet.num_rays = std::min((size_t) rays_per_packet, num_rays - start);
+            packet.occupancy = depth > 0 ? &occupancy : NULL;
+
+            for (int i = 0; i < rays_per_packet; i++)
+            {
+                packet.rays[i] = rays.ray(start + std::min(i, packet.num_rays - 1));
+                intersected[i] = false;
+            }
+
+            for (size_t g = 0; g < num_geometries; g++)
+            {
+                geometries[g]->intersect_packet(packet, &state.isects[start], intersected);
+            }
+
+            for (int i = 0; i < packet.num_rays; i++)
+            {
+                state.hit[start + i] = intersected[i];
+            }
+
+            secondary_packets += depth > 0;
+        }
+
+        // shade, queueing the shadow rays and the next bounce
+        state.next_rays.clear();
+        state.shadow_rays.clear();
+
+        for (size_t i = 0; i < num_rays; i++)
+        {
+            Color3 weight = rays.weight(i);
+            int pixel = rays.pixel[i];
+
+            if (!state.hit[i])
+            {
+                state.accum[pixel] += weight * scene->background_color;
+                continue;
+            }
+
+            shade_wavefront(rays.ray(i), weight, rays.refractive[i], pixel,
+                            depth, state.isects[i], state, counts);
+        }
+
+        // shadow rays only add light, so their order doesn't matter
+        ShadowQueue& shadows = state.shadow_rays;
+
+        for (size_t i = 0; i < shadows.size(); i++)
+        {
+            if (!shadow_test(shadows.ray(i), shadows.light_index[i], counts))
+            {
+                state.accum[shadows.pixel[i]] +=
+                    Color3(shadows.light_r[i], shadows.light_g[i], shadows.light_b[i]);
+            }
+        }
+
+        shadow_rays += shadows.size();
+        secondary_rays += state.next_rays.size();
+        swap(state.rays, state.next_rays);
+    }
+
+    for (int y = 0; y < tile_h; y++)
+    {
+        for (int x = 0; x < tile_w; x++)
+        {
+            size_t index = (tile.ll.y + y) * width + tile.ll.x + x;
+            store_pixel(buffer, index, state.accum[y * tile_w + x]);
+        }
+    }
+
+    num_secondary_rays += secondary_rays;
+    num_shadow_rays += shadow_rays;
+    num_secondary_packets += secondary_packets;
+    num_node_visits += occupancy.node_visits;
+    num_active_rays += occupancy.active_rays;
+    num_path_rays += counts.traced;
+    num_pruned_rays += counts.pruned;
+    num_shading_points += counts.shaded;
+    num_lights_reached += counts.lights_reached;
+    num_lights_shaded += counts.lights_shaded;
+    num_shadow_tests += counts.shadow_tests;
+    num_shadow_blocked += counts.shadow_blocked;
+    num_occluder_hits += counts.occluder_hits;
+    num_occluder_misses += counts.occluder_misses;
+}
+
+// queues a shadow ray for each light picked for a point that faces it
+struct ShadowRayQueuer
+{
+    ShadowRayQueuer(const Scene* _scene, const Vector3& _eye, const Vector3& _normal,
+                    const Color3& _surface, const Color3& _diffuse, int _pixel,
+                    ShadowQueue& _shadow_rays)
+        : scene(_scene), eye(_eye), normal(_normal), surface(_surface),
+          diffuse(_diffuse), pixel(_pixel), shadow_rays(_shadow_rays) { }
+
+    const Scene* scene;
+    const Vector3& eye;
+    const Vector3& normal;
+    // the path's weight times the texture, and the material's diffuse color
+    Color3 surface;
+    Color3 diffuse;
+    int pixel;
+    ShadowQueue& shadow_rays;
+
+    void operator()(size_t j, real_t scale)
+    {
+        const PointLight& light = scene->get_lights()[j];
+        Vector3 light_direction = light.position - eye;
+        real_t light_distance = length(light_direction);
+        float front_face = std::max(dot(normal, normalize(light_direction)), 0.0);
+
+        if (front_face > 0)
+        {
+            Ray shadow_ray;
+            shadow_ray.eye = eye + (eps * light_direction);
+            shadow_ray.dir = light_direction;
+            real_t light_attenuation =
+                light.attenuation.constant +
+                light.attenuation.linear * light_distance +
+                light.attenuation.quadratic * pow(light_distance, 2);
+            Color3 attenuated_color = light.color * (scale / light_attenuation);
+            shadow_rays.push(shadow_ray, surface * (front_face * attenuated_color * diffuse),
+                             pixel, j);
+        }
+    }
+};
+
+/**
+ * The shading of trace_pixel for a single hit, except that the light from
+ * each visible light is queued as a shadow ray and the reflected and
+ * transmitted rays go into the queue of the next bounce instead of onto the
+ * pixel's stack.
+ */
+void Raytracer::shade_wavefront(const Ray& ray, const Color3& weight, float refractive,
+                                int pixel, int depth, const HitRecord& hit,
+                                WavefrontState& state, PathCounts& counts)
+{
+    bool bounces_left = depth < options.max_depth;
+
+    IsectInfo min_info;
+    scene->get_geometries()[hit.geometry]->shade(ray, hit, min_info);
+
+    Color3 ambient = scene->ambient_light * min_info.ambient;
+    float angle = dot(ray.dir, min_info.normal);
+
+    // compute reflected ray
+    Vector3 intersection_point = ray.eye + (min_info.time * ray.dir);
+    Ray incident_ray;
+    incident_ray.dir = ray.dir - 2 * angle * min_info.normal;
+    incident_ray.dir = normalize(incident_ray.dir);
+    incident_ray.eye = intersection_point + eps * incident_ray.dir;
+    incident_ray.width = ray.width_at(min_info.time);
+    incident_ray.spread = ray.spread;
+
+    // no-refraction case
+    if (min_info.refractive == 0.0)
+    {
+        Color3 surface = weight * min_info.texture;
+        state.accum[pixel] += surface * ambient;
+
+        ShadowRayQueuer queuer(scene, incident_ray.eye, min_info.normal,
+                               surface, min_info.diffuse, pixel, state.shadow_rays);
+        LightCounter<ShadowRayQueuer> counter(queuer);
+        counts.shaded++;
+        counts.lights_reached += light_tree.sample(incident_ray.eye, min_info.normal,
+                                                   options.light_samples, counter);
+        counts.lights_shaded += counter.count;
+
+        // rays too faint to show up are not worth tracing
+        Color3 reflected = surface * min_info.specular;
+
+        if (bounces_left && worth_tracing(reflected))
+        {
+            state.next_rays.push(incident_ray, reflected, refractive, pixel);
+            counts.traced++;
+        }
+        else if (bounces_left && reflected != Color3::Black)
+        {
+            counts.pruned++;
+        }
+    }
+    // refraction case, black once out of bounces
+    else if (bounces_left)
+    {
+        float c;
+        Ray transmitted_ray;
+        float refract_ratio = refractive / min_info.refractive;
+
+        // negative dot product between ray and normal indicates entering object
+        if (angle < 0.0)
+        {
+            refract(ray.dir, min_info.normal, refract_ratio, &transmitted_ray.dir);
+            c = dot(-1.0 * ray.dir, min_info.normal);
+        }
+        else
+        {
+            // exiting object
+            if (refract(ray.dir, (-1.0 * min_info.normal), min_info.refractive,
+                        &transmitted_ray.dir))
+            {
+                c = dot(transmitted_ray.dir, min_info.normal);
+            }
+            // total internal reflection
+            else
+            {
+                state.next_rays.push(incident_ray, weight, refractive, pixel);
+                counts.traced++;
+                return;
+            }
+        }
+
+        // schlick approximation to fresnel equations
+        float R_0 = pow(refract_ratio - 1, 2) / pow(refract_ratio + 1, 2);
+        float R = R_0 + (1 - R_0) * pow(1 - c, 5);
+        transmitted_ray.eye = intersection_point + eps * transmitted_ray.dir;
+        transmitted_ray.width = incident_ray.width;
+        transmitted_ray.spread = ray.spread;
+
+        Color3 reflected = R * weight;
+        Color3 transmitted = (1.0 - R) * weight;
+
+        if (worth_tracing(reflected))
+        {
+            state.next_rays.push(incident_ray, reflected, refractive, pixel);
+            counts.traced++;
+        }
+        else
+        {
+            counts.pruned++;
+        }
+
+        if (worth_tracing(transmitted))
+        {
+            state.next_rays.push(transmitted_ray, transmitted, min_info.refractive, pixel);
+            counts.traced++;
+        }
+        else
+        {
+            counts.pruned++;
+        }
+    }
+}
+
+}
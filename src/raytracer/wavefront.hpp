@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include "raytracer/ray.hpp"
+
+namespace _462
+{
+
+/**
+ * A queue of rays for the wavefront tracer, stored as a structure of arrays
+ * so each stage streams through only the fields it reads. Every ray carries
+ * the pixel (within the wavefront's tile) it contributes to, the weight of
+ * that contribution, the refractive index of the medium it travels in and
+ * its cone for texture filtering.
+ */
+struct RayQueue
+{
+    std::vector<real_t> eye_x, eye_y, eye_z;
+    std::vector<real_t> dir_x, dir_y, dir_z;
+    std::vector<real_t> width, spread;
+    std::vector<real_t> weight_r, weight_g, weight_b;
+    std::vector<float> refractive;
+    std::vector<int> pixel;
+
+    size_t size() const { return pixel.size(); }
+
+    Ray ray(size_t i) const
+    {
+        Ray ret;
+        ret.eye = Vector3(eye_x[i], eye_y[i], eye_z[i]);
+        ret.dir = Vector3(dir_x[i], dir_y[i], dir_z[i]);
+        ret.width = width[i];
+        ret.spread = spread[i];
+        return ret;
+    }
+
+    Color3 weight(size_t i) const
+    {
+        return Color3(weight_r[i], weight_g[i], weight_b[i]);
+    }
+
+    void push(const Ray& ray, const Color3& w, float refr, int pix);
+    // appends ray i of another queue
+    void copy(const RayQueue& from, size_t i);
+    void clear();
+};
+
+/**
+ * Shadow rays waiting for their occlusion test, with the light they add to
+ * their pixel if nothing is in the way.
+ */
+struct ShadowQueue
+{
+    std::vector<real_t> eye_x, eye_y, eye_z;
+    std::vector<real_t> dir_x, dir_y, dir_z;
+    std::vector<real_t> light_r, light_g, light_b;
+    std::vector<int> pixel;
+    // the light each ray heads for
+    std::vector<int> light_index;
+
+    size_t size() const { return pixel.size(); }
+
+    Ray ray(size_t i) const
+    {
+        Ray ret;
+        ret.eye = Vector3(eye_x[i], eye_y[i], eye_z[i]);
+        ret.dir = Vector3(dir_x[i], dir_y[i], dir_z[i]);
+        return ret;
+    }
+
+    void push(const Ray& ray, const Color3& light, int pix, int index);
+    void clear();
+};
+
+/**
+ * Per-thread state of the wavefront tracer, kept across tiles so the queues
+ * are allocated only once.
+ */
+struct WavefrontState
+{
+    // rays of the current bounce and the ones they spawn
+    RayQueue rays, next_rays;
+    // scratch space for reordering rays
+    RayQueue sorted_rays;
+    std::vector< std::pair<uint64_t, uint32_t> > keys;
+    ShadowQueue shadow_rays;
+    // closest hit of each ray in rays, shaded when the ray is
+    std::vector<HitRecord> isects;
+    std::vector<char> hit;
+    // color gathered so far for each pixel of the tile
+    std::vector<Color3> accum;
+};
+
+}
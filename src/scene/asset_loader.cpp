@@ -0,0 +1,394 @@
+#include "scene/asset_loader.hpp"
+#include "raytracer/CycleTimer.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace _462
+{
+
+struct AssetJob
+{
+    AssetKind kind;
+    // texture file, mesh or model to load, by index into the pool's lists
+    size_t index;
+};
+
+/**
+ * The jobs of loading one scene and the threads running them. Threads take
+ * jobs from a shared queue until it is empty and no running job can add
+ * more to it; finishing a mesh adds the bvhs of its models.
+ */
+class AssetPool
+{
+public:
+
+    AssetPool( Scene* scene, TextureCache* textures, int flags );
+
+    /// runs every job, returns false if any of them failed
+    bool run( int num_threads );
+
+    /// drops the jobs that haven't started yet
+    void cancel();
+
+    std::vector< AssetEvent > events;
+
+private:
+
+    Scene* scene;
+    TextureCache* textures;
+    int flags;
+    // the textures the pool owns if it wasn't given any
+    TextureCache scene_textures;
+
+    // distinct texture files, and the materials naming each of them
+    std::vector< std::string > texture_files;
+    std::vector< std::vector< Material* > > texture_materials;
+    // the geometries made of a mesh, and which of them each mesh makes
+    std::vector< Geometry* > models;
+    std::vector< std::vector< size_t > > mesh_models;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque< AssetJob > jobs;
+    // jobs queued or running
+    size_t pending;
+    // threads each mesh job may parse its file on, the pool's share of
+    // the threads it was given
+    int mesh_threads;
+    bool failed;
+    double start;
+
+    void push( AssetKind kind, size_t index );
+    void work( int thread );
+    bool run_job( const AssetJob& job, std::string* name );
+};
+
+AssetPool::AssetPool( Scene* scene, TextureCache* textures, int flags )
+    : scene( scene ), textures( textures ? textures : &scene_textures ), flags( flags ),
+      pending( 0 ), mesh_threads( 1 ), failed( false ), start( 0 )
+{
+    Material* const* materials = scene->get_materials();
+    std::map< std::string, size_t > texture_index;
+
+    for ( size_t i = 0; i < scene->num_materials(); ++i )
+    {
+        const std::string& filename = materials[i]->texture_filename;
+        if ( filename.empty() || !( flags & LOAD_TEXTURES ) )
+        {
+            continue;
+        }
+
+        std::map< std::string, size_t >::iterator iter = texture_index.find( filename );
+        if ( iter == texture_index.end() )
+        {
+            iter = texture_index.insert( std::make_pair( filename, texture_files.size() ) ).first;
+            texture_files.push_back( filename );
+            texture_materials.push_back( std::vector< Material* >() );
+        }
+        texture_materials[iter->second].push_back( materials[i] );
+    }
+
+    Mesh* const* meshes = scene->get_meshes();
+    std::map< const Mesh*, size_t > mesh_index;
+    for ( size_t i = 0; i < scene->num_meshes(); ++i )
+    {
+        mesh_index[meshes[i]] = i;
+    }
+
+    mesh_models.resize( scene->num_meshes() );
+    Geometry* const* geometries = scene->get_geometries();
+    for ( size_t i = 0; i < scene->num_geometries(); ++i )
+    {
+        std::map< const Mesh*, size_t >::iterator iter =
+            mesh_index.find( geometries[i]->get_mesh() );
+        if ( iter != mesh_index.end() )
+        {
+            mesh_models[iter->second].push_back( models.size() );
+            models.push_back( geometries[i] );
+        }
+    }
+}
+
+void AssetPool::push( AssetKind kind, size_t index )
+{
+    AssetJob job = { kind, index };
+    // bvhs jump the queue, their mesh is ready now
+    if ( kind == ASSET_BVH )
+    {
+        jobs.push_front( job );
+    }
+    else
+    {
+        jobs.push_back( job );
+    }
+    pending++;
+}
+
+bool AssetPool::run_job( const AssetJob& job, std::string* name )
+{
+    switch ( job.kind )
+    {
+    case ASSET_TEXTURE:
+        *name = texture_files[job.index];
+        // the first material decodes the file, the rest find it in the cache
+        for ( size_t i = 0; i < texture_materials[job.index].size(); i++ )
+        {
+            if ( !texture_materials[job.index][i]->load( textures ) )
+            {
+                return false;
+            }
+        }
+        return true;
+
+    case ASSET_MESH:
+        *name = scene->get_meshes()[job.index]->filename;
+        if ( !scene->get_meshes()[job.index]->load( mesh_threads ) )
+        {
+            return false;
+        }
+        // hands a streamed mesh over to the tracing threads
+        scene->get_meshes()[job.index]->set_streaming( false );
+        return true;
+
+    case ASSET_BVH:
+        *name = models[job.index]->get_mesh()->filename;
+        models[job.index]->make_bounding_volume();
+        return true;
+    }
+
+    return false;
+}
+
+void AssetPool::work( int thread )
+{
+    std::unique_lock< std::mutex > lock( mutex );
+
+    while ( true )
+    {
+        while ( jobs.empty() && pending > 0 )
+        {
+            changed.wait( lock );
+        }
+        if ( jobs.empty() )
+        {
+            return;
+        }
+
+        AssetJob job = jobs.front();
+        jobs.pop_front();
+
+        // after a failure the remaining jobs are dropped
+        if ( failed )
+        {
+            pending--;
+            changed.notify_all();
+            continue;
+        }
+
+        lock.unlock();
+
+        AssetEvent event;
+        event.kind = job.kind;
+        event.thread = thread;
+        event.start = CycleTimer::currentSeconds() - start;
+        try
+        {
+            event.ok = run_job( job, &event.name );
+        }
+        catch ( std::bad_alloc const& )
+        {
+            std::cout << "Out of memory error while loading " << event.name << "\n";
+            event.ok = false;
+        }
+        event.end = CycleTimer::currentSeconds() - start;
+
+        lock.lock();
+
+        if ( !event.ok )
+        {
+            failed = true;
+        }
+        else if ( job.kind == ASSET_MESH && ( flags & LOAD_BVHS ) )
+        {
+            for ( size_t i = 0; i < mesh_models[job.index].size(); i++ )
+            {
+                push( ASSET_BVH, mesh_models[job.index][i] );
+            }
+        }
+
+        events.push_back( event );
+        pending--;
+        changed.notify_all();
+    }
+}
+
+bool AssetPool::run( int num_threads )
+{
+    start = CycleTimer::currentSeconds();
+
+    // materials without a texture have nothing to load
+    Material* const* materials = scene->get_materials();
+    for ( size_t i = 0; i < scene->num_materials() && ( flags & LOAD_TEXTURES ); ++i )
+    {
+        if ( materials[i]->texture_filename.empty() )
+        {
+            materials[i]->load();
+        }
+    }
+
+    // meshes go first, so the bvhs they unlock can overlap the textures
+    for ( size_t i = 0; i < scene->num_meshes() && ( flags & LOAD_MESHES ); ++i )
+    {
+        push( ASSET_MESH, i );
+    }
+    for ( size_t i = 0; i < texture_files.size(); ++i )
+    {
+        push( ASSET_TEXTURE, i );
+    }
+
+    // there are never more jobs than meshes, textures and models
+    size_t num_bvhs = ( flags & LOAD_BVHS ) ? models.size() : 0;
+    size_t max_threads = std::max( (size_t) 1, jobs.size() + num_bvhs );
+    int budget = num_threads;
+    num_threads = (int) std::min( max_threads, (size_t) std::max( num_threads, min_asset_threads ) );
+    // jobs already run side by side, so a mesh only parses on the threads
+    // left over beyond one per job
+    mesh_threads = std::max( 1, budget / num_threads );
+
+    std::vector< std::thread > threads;
+    for ( int i = 1; i < num_threads; i++ )
+    {
+        threads.push_back( std::thread( &AssetPool::work, this, i ) );
+    }
+    work( 0 );
+    for ( size_t i = 0; i < threads.size(); i++ )
+    {
+        threads[i].join();
+    }
+
+    return !failed;
+}
+
+void AssetPool::cancel()
+{
+    std::lock_guard< std::mutex > lock( mutex );
+    failed = true;
+}
+
+static bool event_less( const AssetEvent& a, const AssetEvent& b )
+{
+    return a.start < b.start;
+}
+
+bool load_scene_assets( Scene* scene, int num_threads, int flags,
+                        TextureCache* textures, std::vector< AssetEvent >* timeline )
+{
+    AssetPool pool( scene, textures, flags );
+    bool ok = pool.run( num_threads );
+
+    if ( timeline )
+    {
+        timeline->swap( pool.events );
+        std::sort( timeline->begin(), timeline->end(), event_less );
+    }
+
+    return ok;
+}
+
+AssetStreamer::AssetStreamer() : pool( 0 ), finished( false ), ok( false ) { }
+
+AssetStreamer::~AssetStreamer()
+{
+    if ( pool )
+    {
+        pool->cancel();
+        finish( 0 );
+    }
+}
+
+bool AssetStreamer::start( Scene* scene, int num_threads )
+{
+    Mesh* const* meshes = scene->get_meshes();
+    for ( size_t i = 0; i < scene->num_meshes(); ++i )
+    {
+        if ( !meshes[i]->scan_bounds() )
+        {
+            return false;
+        }
+    }
+
+    // from here on the meshes belong to the loader until they are in
+    for ( size_t i = 0; i < scene->num_meshes(); ++i )
+    {
+        meshes[i]->set_streaming( true );
+    }
+
+    pool = new AssetPool( scene, 0, LOAD_MESHES | LOAD_BVHS );
+    thread = std::thread( &AssetStreamer::run, this, num_threads );
+    return true;
+}
+
+void AssetStreamer::run( int num_threads )
+{
+    ok = pool->run( num_threads );
+    finished.store( true, std::memory_order_release );
+}
+
+bool AssetStreamer::done() const
+{
+    return finished.load( std::memory_order_acquire );
+}
+
+bool AssetStreamer::finish( std::vector< AssetEvent >* timeline )
+{
+    if ( thread.joinable() )
+    {
+        thread.join();
+    }
+
+    if ( pool && timeline )
+    {
+        timeline->swap( pool->events );
+        std::sort( timeline->begin(), timeline->end(), event_less );
+    }
+
+    delete pool;
+    pool = 0;
+    return ok;
+}
+
+void print_asset_timeline( const std::vector< AssetEvent >& timeline )
+{
+    static const char* const kind_names[] = { "texture", "mesh", "bvh" };
+
+    double end = 0, busy = 0;
+    size_t counts[3] = { 0, 0, 0 };
+    int num_threads = 0;
+
+    std::cout << "Asset loading timeline (ms since loading started):\n";
+    for ( size_t i = 0; i < timeline.size(); i++ )
+    {
+        const AssetEvent& event = timeline[i];
+        std::cout << "    " << event.start * 1e3 << " - " << event.end * 1e3
+                  << " thread " << event.thread << ": " << kind_names[event.kind]
+                  << " " << event.name << ( event.ok ? "" : " (failed)" ) << "\n";
+
+        end = std::max( end, event.end );
+        busy += event.end - event.start;
+        counts[event.kind]++;
+        num_threads = std::max( num_threads, event.thread + 1 );
+    }
+
+    std::cout << "Loaded " << counts[ASSET_TEXTURE] << " textures, " << counts[ASSET_MESH]
+              << " meshes and " << counts[ASSET_BVH] << " bvhs in " << end << "s on "
+              << num_threads << " threads, " << busy << "s of jobs ("
+              << ( end > 0 ? busy / end : 0 ) << "x overlap)" << std::endl;
+}
+
+} /* _462 */
+
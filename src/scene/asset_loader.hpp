@@ -0,0 +1,115 @@
+#pragma once
+
+#include "scene/scene.hpp"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace _462
+{
+
+// loading jobs run on at least this many threads, so one job's file reads
+// overlap another's parsing even on a single cpu
+const int min_asset_threads = 2;
+
+// what load_scene_assets loads
+enum AssetFlags
+{
+    LOAD_TEXTURES = 1 << 0,
+    LOAD_MESHES = 1 << 1,
+    // the bvh of each model, as soon as its mesh is in; needs LOAD_MESHES
+    LOAD_BVHS = 1 << 2,
+    LOAD_ALL = LOAD_TEXTURES | LOAD_MESHES | LOAD_BVHS
+};
+
+enum AssetKind
+{
+    ASSET_TEXTURE,
+    ASSET_MESH,
+    ASSET_BVH
+};
+
+/// one job of loading a scene's assets, as it ran
+struct AssetEvent
+{
+    AssetKind kind;
+    // texture or mesh file the job loaded
+    std::string name;
+    // thread of the pool the job ran on
+    int thread;
+    // seconds since loading started
+    double start, end;
+    bool ok;
+};
+
+/**
+ * Loads the textures and meshes of a scene on a pool of threads. Every
+ * distinct texture file and every mesh is a job of its own, and the bvh of
+ * each model is built as a job of its own as soon as its mesh has loaded,
+ * while other files are still loading. Materials naming the same texture
+ * file share it through the texture cache. Nothing here touches opengl.
+ * @param num_threads Threads to load on in all; a large obj file is parsed
+ *  on this many divided by the jobs that may run at once.
+ * @param flags What to load, see AssetFlags.
+ * @param textures Cache the textures are loaded through, null to use one
+ *  for just this scene.
+ * @param timeline If not null, set to the jobs in the order they started.
+ * @return true on success, false if any job failed.
+ */
+bool load_scene_assets( Scene* scene, int num_threads, int flags,
+                        TextureCache* textures, std::vector< AssetEvent >* timeline );
+
+class AssetPool;
+
+/**
+ * Loads the meshes of a scene and the bvhs of its models in the background
+ * while the scene is already being traced. Until a model's bvh is in, it is
+ * traced as the bounding box of its mesh (see Model), and meshes are only
+ * drawn by opengl once they are in.
+ */
+class AssetStreamer
+{
+public:
+
+    AssetStreamer();
+    /// drops the jobs that haven't started and waits for the rest
+    ~AssetStreamer();
+
+    /**
+     * Finds the bounds of every mesh of the scene, which are quick to get
+     * from a compiled mesh file's header or a scan of an obj file's
+     * positions, then starts loading them.
+     * @return false if some mesh's bounds can't be had.
+     */
+    bool start( Scene* scene, int num_threads );
+
+    /// whether start was called and every job has finished
+    bool done() const;
+
+    /**
+     * Waits for every job to finish.
+     * @return false if any of them failed; the models of meshes that
+     *  didn't load stay boxes.
+     */
+    bool finish( std::vector< AssetEvent >* timeline );
+
+private:
+
+    AssetPool* pool;
+    std::thread thread;
+    std::atomic< bool > finished;
+    bool ok;
+
+    void run( int num_threads );
+
+    // prevent copy/assignment
+    AssetStreamer( const AssetStreamer& );
+    AssetStreamer& operator=( const AssetStreamer& );
+};
+
+/// prints when each job of a load_scene_assets ran, and how well they overlapped
+void print_asset_timeline( const std::vector< AssetEvent >& timeline );
+
+} /* _462 */
+
@@ -7,11 +7,31 @@ namespace _462
 Geometry::Geometry():
     position( Vector3::Zero ),
     orientation( Quaternion::Identity ),
-    scale( Vector3::Ones )
+    scale( Vector3::Ones ),
+    id( -1 )
 {
 
 }
 
 Geometry::~Geometry() { }
 
+bool Geometry::shadow_test_primitive(const Ray& ray, size_t) const
+{
+    return shadow_test(ray);
+}
+
+real_t Geometry::triangle_uv_per_unit(const Vector3& p0, const Vector3& p1, const Vector3& p2,
+                                      const Vector2& t0, const Vector2& t1,
+                                      const Vector2& t2) const
+{
+    Vector3 e1 = transform_matrix.transform_vector(p1 - p0);
+    Vector3 e2 = transform_matrix.transform_vector(p2 - p0);
+    real_t world_area = length(cross(e1, e2));
+    Vector2 u1 = t1 - t0;
+    Vector2 u2 = t2 - t0;
+    real_t uv_area = fabs(u1.x * u2.y - u1.y * u2.x);
+
+    return world_area > 0 ? sqrt(uv_area / world_area) : 0;
+}
+
 }
@@ -9,6 +9,8 @@
 namespace _462
 {
 
+class Mesh;
+
 class Geometry
 {
 public:
@@ -33,6 +35,9 @@ public:
     // The world scale of the object.
     Vector3 scale;
 
+    // index of the geometry in its scene, set by Scene::add_geometry
+    int id;
+
     // transformation matrices to precalculate in intialization
     Matrix4 inverse_transform_matrix;
     Matrix4 transform_matrix;
@@ -43,9 +48,42 @@ public:
      */
     virtual void render() const = 0;
     virtual void make_bounding_volume() = 0;
-    virtual bool shadow_test(const Ray& ray) const = 0;
-    virtual void intersect_packet(const Packet& packet, IsectInfo *infos, bool *intersected) const = 0;
-    virtual bool intersect_ray(const Ray& ray, IsectInfo& info) const = 0;
+
+    /// the mesh the geometry is made of, null if it isn't made of one
+    virtual const Mesh* get_mesh() const { return NULL; }
+
+    /**
+     * Whether the geometry blocks a shadow ray.
+     * @param primitive Set to the part of the geometry that blocked it (the
+     *  triangle of a model), if not null. Geometries that are a single
+     *  primitive leave it alone.
+     */
+    virtual bool shadow_test(const Ray& ray, size_t* primitive = NULL) const = 0;
+
+    /// shadow_test against just one part found by shadow_test
+    virtual bool shadow_test_primitive(const Ray& ray, size_t primitive) const;
+
+
+    /**
+     * Intersection tests replace hits that are further away than their own
+     * closest hit and report whether they did.
+     */
+    virtual void intersect_packet(const Packet& packet, HitRecord *hits, bool *intersected) const = 0;
+    virtual bool intersect_ray(const Ray& ray, HitRecord& hit) const = 0;
+
+    /// looks up the shading attributes of a hit found by intersect_ray
+    virtual void shade(const Ray& ray, const HitRecord& hit, IsectInfo& info) const = 0;
+
+protected:
+
+    /**
+     * How much of the texture one world unit spans on a triangle given in
+     * local space: the square root of its area in texture coordinates over
+     * its area in the world. 0 if either is degenerate.
+     */
+    real_t triangle_uv_per_unit(const Vector3& p0, const Vector3& p1, const Vector3& p2,
+                                const Vector2& t0, const Vector2& t1,
+                                const Vector2& t2) const;
 };
 
 }
@@ -1,42 +1,116 @@
 #include "scene/material.hpp"
+#include "scene/tile_cache.hpp"
 #include "application/imageio.hpp"
 
 namespace _462
 {
 
+TextureCache::TextureCache() : hits( 0 ), misses( 0 ) { }
+
+// opens the image's tile file if textures are streamed and it has one, or
+// decodes the image and builds its pyramid
+static std::shared_ptr< const Texture > load_texture( const std::string& filename )
+{
+    if ( get_tile_cache().enabled() )
+    {
+        std::shared_ptr< const Texture > texture = open_streamed_texture( filename );
+        if ( texture )
+        {
+            return texture;
+        }
+    }
+
+    int width, height;
+    // allocates data with malloc
+    unsigned char* data = imageio_load_image( filename.c_str(), &width, &height );
+    if ( !data )
+    {
+        return std::shared_ptr< const Texture >();
+    }
+
+    std::shared_ptr< const Texture > texture( new MemoryTexture( data, width, height ) );
+    free( data );
+    return texture;
+}
+
+bool TextureCache::get( const std::string& filename, std::shared_ptr< const Texture >* texture )
+{
+    {
+        std::lock_guard< std::mutex > lock( mutex );
+        TextureMap::iterator iter = textures.find( filename );
+        if ( iter != textures.end() )
+        {
+            hits++;
+            *texture = iter->second;
+            return true;
+        }
+        misses++;
+    }
+
+    // decode without holding the lock so other textures can load meanwhile.
+    // two threads missing on the same file both decode it; the first one to
+    // finish wins.
+    *texture = load_texture( filename );
+    if ( !*texture )
+    {
+        return false;
+    }
+
+    std::lock_guard< std::mutex > lock( mutex );
+    *texture = textures.insert( std::make_pair( filename, *texture ) ).first->second;
+    return true;
+}
+
+void TextureCache::prune()
+{
+    std::lock_guard< std::mutex > lock( mutex );
+    for ( TextureMap::iterator i = textures.begin(); i != textures.end(); )
+    {
+        if ( i->second.use_count() == 1 )
+        {
+            textures.erase( i++ );
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+size_t TextureCache::num_hits() const
+{
+    std::lock_guard< std::mutex > lock( mutex );
+    return hits;
+}
+
+size_t TextureCache::num_misses() const
+{
+    std::lock_guard< std::mutex > lock( mutex );
+    return misses;
+}
+
 Material::Material():
     ambient( Color3::White ),
     diffuse( Color3::White ),
     specular( Color3::Black ),
     shininess( 10.0 ),
-    refractive_index( 0.0 ),
-    tex_width( 0 ),
-    tex_height( 0 ),
-    tex_data( 0 )
+    refractive_index( 0.0 )
 {
     tex_handle = 0;
 }
 
 Material::~Material()
 {
-    if ( tex_data )
+    if ( tex_handle )
     {
-        free( tex_data );
-        if ( tex_handle )
-        {
-            glDeleteTextures( 1, &tex_handle );
-        }
+        glDeleteTextures( 1, &tex_handle );
     }
 }
 
-bool Material::load()
+bool Material::load( TextureCache* cache )
 {
     // if data has already been loaded, clear old data
-    if ( tex_data )
-    {
-        free( tex_data );
-        tex_data = 0;
-    }
+    texture.reset();
 
     // if no texture, nothing to do
     if ( texture_filename.empty() )
@@ -44,9 +118,16 @@ bool Material::load()
 
     std::cout << "Loading texture " << texture_filename << "...\n";
 
-    // allocates data with malloc
-    tex_data = imageio_load_image( texture_filename.c_str(), &tex_width, &tex_height );
-    if ( !tex_data )
+    if ( cache )
+    {
+        cache->get( texture_filename, &texture );
+    }
+    else
+    {
+        texture = load_texture( texture_filename );
+    }
+
+    if ( !texture )
     {
         std::cerr << "Cannot load texture file " << texture_filename << std::endl;
         return false;
@@ -56,21 +137,11 @@ bool Material::load()
     return true;
 }
 
-const unsigned char* Material::get_texture_data() const
-{
-    return tex_data;
-}
-
 void Material::get_texture_size( int* width, int* height ) const
 {
     assert( width && height );
-    *width = tex_width;
-    *height = tex_height;
-}
-
-Color3 Material::get_texture_pixel( int x, int y ) const
-{
-    return tex_data ? Color3( tex_data + 4 * (x + y * tex_width) ) : Color3::White;
+    *width = texture ? texture->width() : 0;
+    *height = texture ? texture->height() : 0;
 }
 
 bool Material::create_gl_data()
@@ -79,7 +150,7 @@ bool Material::create_gl_data()
     if ( texture_filename.empty() )
         return true;
 
-    if ( !tex_data )
+    if ( !texture )
     {
         return false;
     }
@@ -90,8 +161,6 @@ bool Material::create_gl_data()
         glDeleteTextures( 1, &tex_handle );
     }
 
-    assert( tex_width > 0 && tex_height > 0 );
-
     glGenTextures( 1, &tex_handle );
     if ( !tex_handle )
     {
@@ -99,12 +168,20 @@ bool Material::create_gl_data()
     }
 
     glBindTexture( GL_TEXTURE_2D, tex_handle );
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, tex_width, tex_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, tex_data );
+    // upload the same pyramid the raytracer samples, row by row
+    std::vector< unsigned char > rows( 4 * (size_t) texture->width() * texture->height() );
+    for ( size_t i = 0; i < texture->num_levels(); i++ )
+    {
+        texture->get_rows( i, &rows[0] );
+        glTexImage2D( GL_TEXTURE_2D, i, GL_RGBA, texture->level_width( i ),
+                      texture->level_height( i ), 0,
+                      GL_RGBA, GL_UNSIGNED_BYTE, &rows[0] );
+    }
 
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
 
     glBindTexture( GL_TEXTURE_2D, 0 );
     std::cout << "Loaded GL texture" << texture_filename << '\n';
@@ -2,12 +2,52 @@
 
 #include "math/color.hpp"
 #include "math/vector.hpp"
+#include "scene/texture.hpp"
 #include "application/opengl.hpp"
 #include <string>
+#include <map>
+#include <memory>
+#include <mutex>
 
 namespace _462
 {
 
+/**
+ * Decoded textures keyed by filename, so scenes that are loaded one after
+ * another (e.g. the frames of a sequence) decode each texture and build its
+ * mip pyramid once. Safe to use from several loading threads.
+ */
+class TextureCache
+{
+public:
+
+    TextureCache();
+
+    /**
+     * Looks up the texture, loading it on a miss.
+     * @return true on success, false if the file could not be loaded.
+     */
+    bool get( const std::string& filename, std::shared_ptr< const Texture >* texture );
+
+    /// drops the textures no material refers to anymore
+    void prune();
+
+    size_t num_hits() const;
+    size_t num_misses() const;
+
+private:
+
+    typedef std::map< std::string, std::shared_ptr< const Texture > > TextureMap;
+
+    TextureMap textures;
+    size_t hits, misses;
+    mutable std::mutex mutex;
+
+    // prevent copy/assignment
+    TextureCache( const TextureCache& );
+    TextureCache& operator=( const TextureCache& );
+};
+
 class Material
 {
 public:
@@ -36,24 +76,27 @@ public:
     std::string texture_filename;
 
     /**
-     * Loads the texture from a file and optionally create a gl texture handle
-     * for it. DO NOT CALL EVERY FRAME, as it will re-load the texture each time.
+     * Loads the texture from a file and builds its mip pyramid. DO NOT CALL
+     * EVERY FRAME, as it will re-load the texture each time.
+     * @param cache If not null, the texture is shared with other materials
+     *  that loaded the same file through the same cache.
      * @return true on success, false on error.
      */
-    bool load();
-
-    /// returns the raw texture data
-    const unsigned char* get_texture_data() const;
+    bool load( TextureCache* cache = 0 );
 
     /// puts the dimensions into width and height
     void get_texture_size( int* width, int* height ) const;
 
     /**
-     * returns the color of the (x,y) pixel, where
-     * x ranges from [0, width-1] and y ranges from [0, height-1].
+     * returns the filtered color of the texture at the given texture
+     * coordinate, which wraps around at 1. footprint is the width of the
+     * surface seen by the sample in texture coordinates, see Texture::sample.
      * Returns white if there is no texture.
      */
-    Color3 get_texture_pixel( int x, int y ) const;
+    Color3 sample_texture( const Vector2& coord, real_t footprint ) const
+    {
+        return texture ? texture->sample( coord, footprint ) : Color3::White;
+    }
 
     /// Creates opengl data for rendering
     bool create_gl_data();
@@ -67,11 +110,8 @@ public:
 
 private:
 
-    // dimensions of the texture
-    int tex_width, tex_height;
-
-    // raw texture data
-    unsigned char* tex_data;
+    // the texture and its mip pyramid, possibly shared with other materials
+    std::shared_ptr< const Texture > texture;
 
     // opengl descriptor of the texture
     GLuint tex_handle;
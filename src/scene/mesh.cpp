@@ -1,4 +1,5 @@
 #include "scene/mesh.hpp"
+#include "scene/mesh_file.hpp"
 #include "application/opengl.hpp"
 #include <iostream>
 #include <cstring>
@@ -6,6 +7,16 @@
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <thread>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace _462
 {
@@ -49,26 +60,121 @@ enum ObjFormat
     VERTEX_UV_NORMAL = 1 << 3
 };
 
-Mesh::Mesh()
+// the contents of an obj file, with 0-based face indices
+struct ObjData
 {
-    has_tcoords = false;
-    has_normals = false;
+    std::vector< Vector3 > positions;
+    std::vector< Vector3 > normals;
+    std::vector< Vector2 > uvs;
+    std::vector< Face > faces;
+    bool has_tcoords;
+    bool has_normals;
+};
+
+// the face format of a vertex of a face, like 1, 1/2, 1//3 or 1/2/3. the
+// format of the first face is taken for the whole file.
+static ObjFormat face_format( const char* begin, const char* end, ObjData& obj )
+{
+    const char* p1 = std::find( begin, end, '/' );
+
+    if ( p1 == end )
+    {
+        return VERTEX_ONLY;
+    }
+    else if ( p1 + 1 < end && p1[1] == '/' )
+    {
+        obj.has_normals = true;
+        return VERTEX_NORMAL;
+    }
+    else if ( std::find( p1 + 1, end, '/' ) == end )
+    {
+        obj.has_tcoords = true;
+        return VERTEX_UV;
+    }
+    else
+    {
+        obj.has_normals = true;
+        obj.has_tcoords = true;
+        return VERTEX_UV_NORMAL;
+    }
 }
 
-Mesh::~Mesh() { }
+// relative (negative) face indices refer back from the element read last.
+// until fix_relative_indices knows how many elements came before the part
+// of the file they were read in, they are kept as the index from the start
+// of that part plus this bias.
+static const int relative_index_bias = INT_MIN / 2;
 
-bool Mesh::load()
+// makes a face index 0-based, given how many elements of its kind have
+// been read so far. missing indices (0) become -1.
+static inline int resolve_index( int index, size_t count )
 {
-    std::cout << "Loading mesh from '" << filename << "'..." << std::endl;
+    if ( index > 0 )
+    {
+        return index - 1;
+    }
+    else if ( index == 0 )
+    {
+        return -1;
+    }
+    return relative_index_bias + (int) count + index;
+}
+
+static inline void fix_relative_index( int& index, size_t first )
+{
+    if ( index < relative_index_bias / 2 )
+    {
+        index = (int) first + ( index - relative_index_bias );
+        // before the start of the file
+        if ( index < 0 )
+        {
+            index = -2;
+        }
+    }
+}
+
+// makes the relative indices of faces read after the given numbers of
+// elements absolute
+static void fix_relative_indices( Face* faces, size_t num_faces, size_t first_position,
+                                  size_t first_normal, size_t first_uv )
+{
+    for ( size_t i = 0; i < num_faces; ++i )
+    {
+        for ( int j = 0; j < 3; ++j )
+        {
+            fix_relative_index( faces[i].v[j].vertex, first_position );
+            fix_relative_index( faces[i].v[j].normal, first_normal );
+            fix_relative_index( faces[i].v[j].tcoord, first_uv );
+        }
+    }
+}
+
+// adds the 1 or 2 triangles of a face, with indices as written in the file
+static void add_face( TriIndex* tri, size_t num_vertex, ObjData& obj )
+{
+    for ( size_t i = 0; i < num_vertex; ++i )
+    {
+        tri[i].vertex = resolve_index( tri[i].vertex, obj.positions.size() );
+        tri[i].normal = resolve_index( tri[i].normal, obj.normals.size() );
+        tri[i].tcoord = resolve_index( tri[i].tcoord, obj.uvs.size() );
+    }
+
+    Face f1 = { { tri[0], tri[1], tri[2] } };
+    obj.faces.push_back( f1 );
+
+    if ( num_vertex == 4 )
+    {
+        Face f2 = { { tri[2], tri[3], tri[0] } };
+        obj.faces.push_back( f2 );
+    }
+}
 
+// reads an obj file line by line through string streams
+static bool parse_obj_stream( const std::string& filename, ObjData& obj )
+{
     std::string line;
     std::ifstream file( filename.c_str() );
 
-    typedef std::vector< Vector3 > PositionList;
-    typedef std::vector< Vector3 > NormalList;
-    typedef std::vector< Vector2 > UVList;
-    typedef std::vector< Face > FaceList;
-
     static const char* scan_vertex = "%d";
     static const char* scan_vertex_uv = "%d/%d";
     static const char* scan_vertex_normal = "%d//%d";
@@ -76,22 +182,12 @@ bool Mesh::load()
 
     TriIndex tri[4];
 
-    FaceList face_list;
-    PositionList position_list;
-    NormalList normal_list;
-    UVList uv_list;
-
     int line_num = 0;
 
     std::string token;
 
-    triangles.clear();
-
     ObjFormat format = VERTEX_ONLY;
 
-    typedef std::map< TriIndex, unsigned int > VertexMap;
-    VertexMap vertex_map;
-
     if ( !file.is_open() )
     {
         std::cout << "Error opening file '" << filename << "' for mesh loading.\n";
@@ -116,7 +212,7 @@ bool Mesh::load()
                 return false;
             }
 
-            position_list.push_back( position );
+            obj.positions.push_back( position );
 
         }
         else if ( token == "vn" )
@@ -129,7 +225,7 @@ bool Mesh::load()
                 std::cerr << "normal syntax error on line " << line_num << std::endl;
                 return false;
             }
-            normal_list.push_back( normal );
+            obj.normals.push_back( normal );
 
         }
         else if ( token == "vt" )
@@ -144,7 +240,7 @@ bool Mesh::load()
                 return false;
             }
 
-            uv_list.push_back( uv );
+            obj.uvs.push_back( uv );
 
         }
         else if ( token == "f" )
@@ -161,38 +257,6 @@ bool Mesh::load()
                 face_tokens.push_back( vert );
             }
 
-            // if it's the first time parsing a face, figure out the face format
-            if ( face_list.size() == 0 )
-            {
-                std::string token = face_tokens[0];
-
-                if ( token.find( "//" ) != std::string::npos )
-                {
-                    format = VERTEX_NORMAL;
-                    has_normals = true;
-                }
-                else if ( token.find( '/' ) == std::string::npos )
-                {
-                    format = VERTEX_ONLY;
-                }
-                else
-                {
-                    size_t p1 = token.find( '/' );
-                    size_t p2 = token.rfind( '/' );
-                    if ( p1 == p2 )
-                    {
-                        format = VERTEX_UV;
-                        has_tcoords = true;
-                    }
-                    else
-                    {
-                        format = VERTEX_UV_NORMAL;
-                        has_normals = true;
-                        has_tcoords = true;
-                    }
-                }
-            }
-
             size_t num_vertex;
             num_vertex = face_tokens.size();
 
@@ -203,6 +267,13 @@ bool Mesh::load()
                 return false;
             }
 
+            // if it's the first time parsing a face, figure out the face format
+            if ( obj.faces.size() == 0 )
+            {
+                const std::string& token = face_tokens[0];
+                format = face_format( token.data(), token.data() + token.size(), obj );
+            }
+
             for ( size_t i = 0; i < num_vertex; ++i )
             {
                 switch ( format )
@@ -246,21 +317,7 @@ bool Mesh::load()
                 }
             }
 
-            for ( size_t i = 0; i < num_vertex; ++i )
-            {
-                tri[i].vertex--;
-                tri[i].normal--;
-                tri[i].tcoord--;
-            }
-
-            Face f1 = { { tri[0], tri[1], tri[2] } };
-            face_list.push_back( f1 );
-
-            if ( num_vertex == 4 )
-            {
-                Face f2 = { { tri[2], tri[3], tri[0] } };
-                face_list.push_back( f2 );
-            }
+            add_face( tri, num_vertex, obj );
 
         }
         else if ( token == " " )
@@ -276,131 +333,879 @@ bool Mesh::load()
         line.clear();
     }
 
-    // verify index list sanity
+    fix_relative_indices( obj.faces.empty() ? NULL : &obj.faces[0], obj.faces.size(), 0, 0, 0 );
+    return true;
+}
+
+// a read only mapping of a whole file
+class MappedFile
+{
+public:
+
+    MappedFile() : data( NULL ), size( 0 ) { }
+
+    ~MappedFile()
+    {
+        if ( data )
+        {
+            munmap( (void*) data, size );
+        }
+    }
+
+    bool open( const char* filename )
+    {
+        int fd = ::open( filename, O_RDONLY );
+        if ( fd < 0 )
+        {
+            return false;
+        }
+
+        struct stat st;
+        bool ok = fstat( fd, &st ) == 0;
+        size = ok ? st.st_size : 0;
+
+        // empty files can't be mapped and have nothing to parse anyway
+        if ( ok && size > 0 )
+        {
+            void* map = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+            ok = map != MAP_FAILED;
+            if ( ok )
+            {
+                data = (const char*) map;
+                madvise( map, size, MADV_SEQUENTIAL );
+            }
+        }
+
+        close( fd );
+        return ok;
+    }
+
+    const char* data;
+    size_t size;
+
+private:
+
+    // prevent copy/assignment
+    MappedFile( const MappedFile& );
+    MappedFile& operator=( const MappedFile& );
+};
+
+static inline bool is_blank( char c )
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool is_digit( char c )
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline const char* skip_blanks( const char* p, const char* end )
+{
+    while ( p < end && is_blank( *p ) )
+    {
+        ++p;
+    }
+    return p;
+}
+
+// the start of the line after the one p is in
+static inline const char* next_line( const char* p, const char* end )
+{
+    p = std::find( p, end, '\n' );
+    return p < end ? p + 1 : end;
+}
+
+// scans an integer that may have a sign, without skipping blanks
+static inline bool scan_index( const char*& p, const char* end, int& value )
+{
+    bool negative = p < end && *p == '-';
+    if ( p < end && ( *p == '-' || *p == '+' ) )
+    {
+        ++p;
+    }
+
+    if ( p == end || !is_digit( *p ) )
+    {
+        return false;
+    }
+
+    int v = 0;
+    while ( p < end && is_digit( *p ) )
+    {
+        v = v * 10 + ( *p++ - '0' );
+    }
+
+    value = negative ? -v : v;
+    return true;
+}
+
+/**
+ * Scans a number in the forms strtod accepts for decimal numbers, skipping
+ * blanks before it. Numbers with at most 2^53 as their digits and a
+ * decimal exponent of at most 22 either way, which is all of them in
+ * practice, are both exact doubles, so a single multiply or divide rounds
+ * them exactly like strtod does. Anything else is handed to strtod.
+ */
+static bool scan_real( const char*& p, const char* end, real_t& value )
+{
+    static const double powers[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    p = skip_blanks( p, end );
+    const char* start = p;
+
+    bool negative = p < end && *p == '-';
+    if ( p < end && ( *p == '-' || *p == '+' ) )
+    {
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    // digits that didn't fit in the mantissa
+    bool truncated = false;
+
+    for ( ; p < end && is_digit( *p ); ++p, ++digits )
+    {
+        if ( mantissa < 100000000000000000ull )
+        {
+            mantissa = mantissa * 10 + ( *p - '0' );
+        }
+        else
+        {
+            exponent++;
+            truncated = true;
+        }
+    }
+
+    if ( p < end && *p == '.' )
+    {
+        for ( ++p; p < end && is_digit( *p ); ++p, ++digits )
+        {
+            if ( mantissa < 100000000000000000ull )
+            {
+                mantissa = mantissa * 10 + ( *p - '0' );
+                exponent--;
+            }
+            else
+            {
+                truncated = true;
+            }
+        }
+    }
+
+    if ( digits == 0 )
+    {
+        return false;
+    }
+
+    if ( p < end && ( *p == 'e' || *p == 'E' ) )
+    {
+        const char* e = p + 1;
+        int exp;
+        if ( scan_index( e, end, exp ) )
+        {
+            exponent += exp;
+            p = e;
+        }
+    }
+
+    if ( !truncated && mantissa <= ( 1ull << 53 ) && exponent >= -22 && exponent <= 22 )
+    {
+        double v = (double) mantissa;
+        v = exponent < 0 ? v / powers[-exponent] : v * powers[exponent];
+        value = negative ? -v : v;
+        return true;
+    }
+
+    char buffer[64];
+    size_t length = p - start;
+    if ( length >= sizeof buffer )
+    {
+        return false;
+    }
+    memcpy( buffer, start, length );
+    buffer[length] = '\0';
+    value = strtod( buffer, NULL );
+    return true;
+}
+
+// scans one vertex of a face, like 1, 1/2, 1//3 or 1/2/3. missing indices
+// are 0, as in the file they would be 1-based.
+static inline bool scan_face_vertex( const char*& p, const char* end, TriIndex& index )
+{
+    index.vertex = 0;
+    index.tcoord = 0;
+    index.normal = 0;
+
+    if ( !scan_index( p, end, index.vertex ) )
+    {
+        return false;
+    }
+
+    if ( p < end && *p == '/' )
+    {
+        ++p;
+        if ( p < end && *p != '/' && !scan_index( p, end, index.tcoord ) )
+        {
+            return false;
+        }
 
-    size_t num_vertex = position_list.size();
-    size_t num_normal = normal_list.size();
-    size_t num_tcoord = uv_list.size();
+        if ( p < end && *p == '/' )
+        {
+            ++p;
+            if ( !scan_index( p, end, index.normal ) )
+            {
+                return false;
+            }
+        }
+    }
+
+    return p == end || is_blank( *p ) || *p == '\n';
+}
+
+// the smallest piece of a file worth parsing on a thread of its own
+static const size_t obj_min_chunk_bytes = 1 << 20;
+
+// a piece of a mapped obj file, parsed on its own
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+    ObjData obj;
+    // the start of the line that failed to parse and why, if one did
+    const char* error_line;
+    const char* error;
+    // where the chunk's elements go in the merged lists
+    size_t first_position, first_normal, first_uv, first_face;
+};
+
+/**
+ * Parses a chunk of whole lines of a mapped file. Relative indices are
+ * kept relative to the start of the chunk, for merge_obj_chunk to fix.
+ * Nothing is allocated per line or number; only the lists of the chunk's
+ * contents grow.
+ */
+static void parse_obj_chunk( ObjChunk* chunk )
+{
+    ObjData& obj = chunk->obj;
+    const char* end = chunk->end;
+    obj.has_tcoords = false;
+    obj.has_normals = false;
+    chunk->error = NULL;
 
-    for (size_t i = 0; i < face_list.size(); ++i)
+    for ( const char* p = chunk->begin; p < end; p = next_line( p, end ) )
     {
-        Face& face = face_list[i];
-        for (int j = 0; j < 3; ++j)
+        const char* line = p;
+        p = skip_blanks( p, end );
+
+        // the keyword of the line, up to the first blank
+        const char* keyword = p;
+        while ( p < end && !is_blank( *p ) && *p != '\n' )
         {
-            int vidx = face.v[j].vertex;
-            int nidx = face.v[j].normal;
-            int tidx = face.v[j].tcoord;
+            ++p;
+        }
+        size_t length = p - keyword;
 
-            if (vidx <  0)
+        if ( length == 1 && keyword[0] == 'v' )
+        {
+            Vector3 position;
+            if ( !scan_real( p, end, position.x ) || !scan_real( p, end, position.y ) ||
+                 !scan_real( p, end, position.z ) )
+            {
+                chunk->error = "position syntax error";
+            }
+            obj.positions.push_back( position );
+        }
+        else if ( length == 2 && keyword[0] == 'v' && keyword[1] == 'n' )
+        {
+            Vector3 normal;
+            if ( !scan_real( p, end, normal.x ) || !scan_real( p, end, normal.y ) ||
+                 !scan_real( p, end, normal.z ) )
+            {
+                chunk->error = "normal syntax error";
+            }
+            obj.normals.push_back( normal );
+        }
+        else if ( length == 2 && keyword[0] == 'v' && keyword[1] == 't' )
+        {
+            Vector2 uv;
+            if ( !scan_real( p, end, uv.x ) || !scan_real( p, end, uv.y ) )
             {
-                face_list[i].v[j].vertex = num_vertex + 1 + vidx;
-                // adding 1 because it's 1-indexed???
+                chunk->error = "uv syntax error";
             }
+            obj.uvs.push_back( uv );
+        }
+        else if ( length == 1 && keyword[0] == 'f' )
+        {
+            TriIndex tri[4];
+            size_t num_vertex = 0;
 
-            if (nidx < -1)
+            for ( p = skip_blanks( p, end ); p < end && *p != '\n'; p = skip_blanks( p, end ) )
             {
-                face_list[i].v[j].normal = num_normal + 1 + nidx;
+                if ( num_vertex == 4 )
+                {
+                    num_vertex++;
+                    break;
+                }
+
+                const char* token = p;
+                if ( !scan_face_vertex( p, end, tri[num_vertex] ) )
+                {
+                    chunk->error = "face syntax error";
+                    break;
+                }
+
+                // if it's the first time parsing a face, figure out the face format
+                if ( obj.faces.size() == 0 && num_vertex == 0 )
+                {
+                    face_format( token, p, obj );
+                }
+
+                num_vertex++;
             }
 
-            if (tidx < -1)
+            if ( !chunk->error && ( num_vertex > 4 || num_vertex < 3 ) )
             {
-                face_list[i].v[j].tcoord = num_tcoord + 1 + tidx;
+                chunk->error = "face has incorrect number of vertices";
             }
 
-            Face& face = face_list[i];
-            vidx = face.v[j].vertex;
-            nidx = face.v[j].normal;
-            tidx = face.v[j].tcoord;
-
-            bool c1, c2, c3, c4, c5, c6;
-            c1 = vidx <  0;
-            c2 = vidx >= (int)num_vertex;
-            c3 = nidx < -1;
-            c4 = nidx >= (int)num_normal;
-            c5 = tidx < -1;
-            c6 = tidx >= (int)num_tcoord;
-            if (vidx <  0 ||
-                    vidx >= (int)num_vertex ||
-                    nidx < -1 ||
-                    nidx >= (int)num_normal ||
-                    tidx < -1 ||
-                    tidx >= (int)num_tcoord )
+            if ( !chunk->error )
             {
-                std::cout
-                        << c1 << " "
-                        << c2 << " "
-                        << c3 << " "
-                        << c4 << " "
-                        << c5 << " "
-                        << c6 << "    "
-                        << vidx << " "
-                        << nidx << " "
-                        << tidx << "    "
-                        << num_vertex << " "
-                        << num_normal << " "
-                        << num_tcoord << std::endl;
-                //std::cout << "Invalid index in face " << i << ".\n";
+                add_face( tri, num_vertex, obj );
             }
         }
+
+        if ( chunk->error )
+        {
+            chunk->error_line = line;
+            return;
+        }
+    }
+}
+
+// copies a chunk's lists to their place in the merged ones, fixing its
+// relative indices
+static void merge_obj_chunk( ObjChunk* chunk, ObjData* merged )
+{
+    const ObjData& obj = chunk->obj;
+    std::copy( obj.positions.begin(), obj.positions.end(),
+               merged->positions.begin() + chunk->first_position );
+    std::copy( obj.normals.begin(), obj.normals.end(),
+               merged->normals.begin() + chunk->first_normal );
+    std::copy( obj.uvs.begin(), obj.uvs.end(), merged->uvs.begin() + chunk->first_uv );
+
+    Face* faces = obj.faces.empty() ? NULL : &merged->faces[chunk->first_face];
+    std::copy( obj.faces.begin(), obj.faces.end(), faces );
+    fix_relative_indices( faces, obj.faces.size(), chunk->first_position,
+                          chunk->first_normal, chunk->first_uv );
+}
+
+/**
+ * Reads an obj file by mapping it into memory and scanning it in place.
+ * Large files are cut into about as many chunks of whole lines as there are
+ * threads, which are parsed at the same time into lists of their own. A
+ * prefix sum of the chunks' list sizes then places each chunk in the
+ * merged lists, and the chunks are copied there in parallel, making their
+ * relative indices absolute on the way.
+ */
+static bool parse_obj_mapped( const std::string& filename, ObjData& obj, int threads )
+{
+    MappedFile file;
+    if ( !file.open( filename.c_str() ) )
+    {
+        std::cout << "Error opening file '" << filename << "' for mesh loading.\n";
+        return false;
+    }
+
+    const char* end = file.data + file.size;
+    size_t num_chunks = std::max( (size_t) 1, std::min( (size_t) std::max( threads, 1 ),
+                                                        file.size / obj_min_chunk_bytes ) );
+    std::vector< ObjChunk > chunks( num_chunks );
+
+    // cut at the line breaks after evenly spaced offsets
+    const char* begin = file.data;
+    for ( size_t i = 0; i < num_chunks; ++i )
+    {
+        chunks[i].begin = begin;
+        chunks[i].end = i + 1 == num_chunks ? end :
+            next_line( file.data + file.size / num_chunks * ( i + 1 ), end );
+        chunks[i].end = std::max( chunks[i].end, begin );
+        begin = chunks[i].end;
+    }
+
+    std::vector< std::thread > workers;
+    for ( size_t i = 1; i < num_chunks; ++i )
+    {
+        workers.push_back( std::thread( parse_obj_chunk, &chunks[i] ) );
+    }
+    parse_obj_chunk( &chunks[0] );
+    for ( size_t i = 0; i < workers.size(); ++i )
+    {
+        workers[i].join();
+    }
+    workers.clear();
+
+    size_t num_positions = 0, num_normals = 0, num_uvs = 0, num_faces = 0;
+    obj.has_tcoords = false;
+    obj.has_normals = false;
+    bool have_format = false;
+
+    for ( size_t i = 0; i < num_chunks; ++i )
+    {
+        ObjChunk& chunk = chunks[i];
+
+        if ( chunk.error )
+        {
+            std::cerr << chunk.error << " on line "
+                      << std::count( file.data, chunk.error_line, '\n' ) + 1 << std::endl;
+            return false;
+        }
+
+        chunk.first_position = num_positions;
+        chunk.first_normal = num_normals;
+        chunk.first_uv = num_uvs;
+        chunk.first_face = num_faces;
+        num_positions += chunk.obj.positions.size();
+        num_normals += chunk.obj.normals.size();
+        num_uvs += chunk.obj.uvs.size();
+        num_faces += chunk.obj.faces.size();
+
+        // the first face of the file decides the format
+        if ( !have_format && !chunk.obj.faces.empty() )
+        {
+            obj.has_tcoords = chunk.obj.has_tcoords;
+            obj.has_normals = chunk.obj.has_normals;
+            have_format = true;
+        }
     }
 
-    // build vertex list using map for shared vertices
+    if ( num_chunks == 1 )
+    {
+        obj.positions.swap( chunks[0].obj.positions );
+        obj.normals.swap( chunks[0].obj.normals );
+        obj.uvs.swap( chunks[0].obj.uvs );
+        obj.faces.swap( chunks[0].obj.faces );
+        fix_relative_indices( obj.faces.empty() ? NULL : &obj.faces[0], obj.faces.size(),
+                              0, 0, 0 );
+        return true;
+    }
+
+    obj.positions.resize( num_positions );
+    obj.normals.resize( num_normals );
+    obj.uvs.resize( num_uvs );
+    obj.faces.resize( num_faces );
+
+    for ( size_t i = 1; i < num_chunks; ++i )
+    {
+        workers.push_back( std::thread( merge_obj_chunk, &chunks[i], &obj ) );
+    }
+    merge_obj_chunk( &chunks[0], &obj );
+    for ( size_t i = 0; i < workers.size(); ++i )
+    {
+        workers[i].join();
+    }
 
-    triangles.reserve( face_list.size() );
-    vertices.reserve( face_list.size() * 2 );
+    return true;
+}
 
-    // current vertex index, for creating new vertices
-    unsigned int vert_idx_counter = 0;
+// numbers the distinct vertices of faces in a tree, as meshes always did
+static void share_vertices_map( const std::vector< Face >& faces,
+                                std::vector< MeshTriangle >& triangles,
+                                std::vector< TriIndex >& unique )
+{
+    typedef std::map< TriIndex, unsigned int > VertexMap;
+    VertexMap vertex_map;
 
-    for ( size_t i = 0; i < face_list.size(); ++i )
+    for ( size_t i = 0; i < faces.size(); ++i )
     {
-        const Face& face = face_list[i];
-        MeshTriangle tri;
         for ( size_t j = 0; j < 3; ++j )
         {
-            // two vertices are only actually the same one if the vertex,
-            // normal, and tcoord are all the same. use the map to check this.
-            std::pair< VertexMap::iterator, bool > rv = vertex_map.insert( std::make_pair( face.v[j], vert_idx_counter ) );
+            std::pair< VertexMap::iterator, bool > rv =
+                vertex_map.insert( std::make_pair( faces[i].v[j], (unsigned int) unique.size() ) );
             if ( rv.second )
             {
-                MeshVertex v;
-                v.position = position_list[face.v[j].vertex];
-                int nidx = face.v[j].normal;
-                v.normal = nidx == -1 ? Vector3::Zero : normal_list[nidx];
-                int tidx = face.v[j].tcoord;
-                v.tex_coord = tidx == -1 ? Vector2::Zero : uv_list[tidx];
-                vertices.push_back( v );
-                vert_idx_counter++;
+                unique.push_back( faces[i].v[j] );
+            }
+
+            triangles[i].vertices[j] = rv.first->second;
+        }
+    }
+}
+
+/**
+ * An open addressing hash table from vertex triples to their number, with
+ * linear probing. Slots are 16 bytes and held in one array, which doubles
+ * whenever it gets 3/4 full.
+ */
+class TriIndexTable
+{
+public:
+
+    TriIndexTable( size_t expected )
+    {
+        size_t capacity = 16;
+        while ( capacity < expected + expected / 3 )
+        {
+            capacity *= 2;
+        }
+        slots.resize( capacity );
+        mask = capacity - 1;
+        count = 0;
+    }
+
+    /**
+     * Finds the number of a triple, giving it the number value if it is
+     * new.
+     * @return True if the triple was new.
+     */
+    bool insert( const TriIndex& key, unsigned int value, unsigned int& number )
+    {
+        if ( 4 * ( count + 1 ) > 3 * slots.size() )
+        {
+            grow();
+        }
+
+        for ( size_t i = hash( key ) & mask; ; i = ( i + 1 ) & mask )
+        {
+            Slot& slot = slots[i];
+
+            // vertex indices are never negative in a used slot
+            if ( slot.key.vertex < 0 )
+            {
+                slot.key = key;
+                slot.value = value;
+                count++;
+                number = value;
+                return true;
+            }
+
+            if ( slot.key.vertex == key.vertex && slot.key.normal == key.normal &&
+                 slot.key.tcoord == key.tcoord )
+            {
+                number = slot.value;
+                return false;
+            }
+        }
+    }
+
+private:
+
+    struct Slot
+    {
+        Slot() { key.vertex = -1; }
+
+        TriIndex key;
+        unsigned int value;
+    };
+
+    std::vector< Slot > slots;
+    size_t mask;
+    size_t count;
+
+    static size_t hash( const TriIndex& key )
+    {
+        uint64_t h = (uint32_t) key.vertex * 0x9E3779B97F4A7C15ull
+                     ^ (uint32_t) key.normal * 0xC2B2AE3D27D4EB4Full
+                     ^ (uint32_t) key.tcoord * 0x165667B19E3779F9ull;
+        return (size_t) ( h ^ ( h >> 29 ) );
+    }
+
+    void grow()
+    {
+        std::vector< Slot > old( slots.size() * 2 );
+        old.swap( slots );
+        mask = slots.size() - 1;
+
+        for ( size_t i = 0; i < old.size(); ++i )
+        {
+            if ( old[i].key.vertex >= 0 )
+            {
+                size_t j = hash( old[i].key ) & mask;
+                while ( slots[j].key.vertex >= 0 )
+                {
+                    j = ( j + 1 ) & mask;
+                }
+                slots[j] = old[i];
             }
+        }
+    }
+};
+
+// numbers the distinct vertices of faces in a hash table
+static void share_vertices_hash( const std::vector< Face >& faces,
+                                 std::vector< MeshTriangle >& triangles,
+                                 std::vector< TriIndex >& unique )
+{
+    // meshes mostly have about one vertex for every two triangles
+    TriIndexTable table( faces.size() / 2 );
 
-            tri.vertices[j] = rv.first->second;
+    for ( size_t i = 0; i < faces.size(); ++i )
+    {
+        for ( size_t j = 0; j < 3; ++j )
+        {
+            if ( table.insert( faces[i].v[j], unique.size(), triangles[i].vertices[j] ) )
+            {
+                unique.push_back( faces[i].v[j] );
+            }
         }
-        triangles.push_back( tri );
-        centroids.push_back( compute_triangle_centroid(triangles.size()-1) );
+    }
+}
+
+Mesh::Mesh() : mapping( NULL ), mapping_size( 0 ), bounds_min( Vector3::Zero ),
+    bounds_max( Vector3::Zero ), streaming( false )
+{
+    has_tcoords = false;
+    has_normals = false;
+    use_lists();
+}
+
+Mesh::~Mesh()
+{
+    unmap();
+}
+
+void Mesh::use_lists()
+{
+    unmap();
+    triangle_data = triangles.empty() ? NULL : &triangles[0];
+    position_data = positions.empty() ? NULL : &positions[0];
+    normal_data = normals.empty() ? NULL : &normals[0];
+    tex_coord_data = tex_coords.empty() ? NULL : &tex_coords[0];
+    centroid_data = centroids.empty() ? NULL : &centroids[0];
+    triangle_count = triangles.size();
+    vertex_count = positions.size();
+}
+
+void Mesh::unmap()
+{
+    if ( mapping )
+    {
+        munmap( mapping, mapping_size );
+    }
+    mapping = NULL;
+    mapping_size = 0;
+    bvh_data = NULL;
+    bvh_size = 0;
+}
+
+bool Mesh::load( int threads )
+{
+    std::cout << "Loading mesh from '" << filename << "'..." << std::endl;
+
+    bool loaded = is_compiled_mesh_file( filename ) ? load_compiled() :
+        load_obj( OBJ_PARSER_MAPPED, threads );
+    if ( !loaded )
+    {
+        return false;
     }
 
     std::cout << "Successfully loaded mesh '" << filename << "'.\n";
     return true;
 }
 
+bool Mesh::load_obj( ObjParser parser, int threads, VertexDedup dedup )
+{
+    ObjData obj;
+    obj.has_tcoords = false;
+    obj.has_normals = false;
+
+    triangles.clear();
+    positions.clear();
+    normals.clear();
+    tex_coords.clear();
+    centroids.clear();
+    use_lists();
+
+    bool parsed = parser == OBJ_PARSER_STREAM ? parse_obj_stream( filename, obj )
+                                              : parse_obj_mapped( filename, obj, threads );
+    if ( !parsed )
+    {
+        return false;
+    }
+
+    has_tcoords = obj.has_tcoords;
+    has_normals = obj.has_normals;
+
+    // verify index list sanity
+
+    size_t num_vertex = obj.positions.size();
+    size_t num_normal = obj.normals.size();
+    size_t num_tcoord = obj.uvs.size();
+
+    for ( size_t i = 0; i < obj.faces.size(); ++i )
+    {
+        const Face& face = obj.faces[i];
+        for ( int j = 0; j < 3; ++j )
+        {
+            const TriIndex& index = face.v[j];
+
+            if ( index.vertex < 0 || index.vertex >= (int) num_vertex ||
+                 index.normal < -1 || index.normal >= (int) num_normal ||
+                 index.tcoord < -1 || index.tcoord >= (int) num_tcoord )
+            {
+                std::cout << "Invalid index in face " << i << " of mesh '"
+                          << filename << "'.\n";
+                return false;
+            }
+        }
+    }
+
+    // two vertices are only actually the same one if the vertex, normal,
+    // and tcoord are all the same. number the distinct ones in the order
+    // they first appear.
+
+    triangles.resize( obj.faces.size() );
+    std::vector< TriIndex > unique;
+
+    if ( dedup == VERTEX_DEDUP_MAP )
+    {
+        share_vertices_map( obj.faces, triangles, unique );
+    }
+    else
+    {
+        share_vertices_hash( obj.faces, triangles, unique );
+    }
+
+    // build vertex list
+
+    positions.reserve( unique.size() );
+    normals.reserve( unique.size() );
+    tex_coords.reserve( unique.size() );
+
+    for ( size_t i = 0; i < unique.size(); ++i )
+    {
+        positions.push_back( obj.positions[unique[i].vertex] );
+        int nidx = unique[i].normal;
+        normals.push_back( nidx == -1 ? Vector3::Zero : obj.normals[nidx] );
+        int tidx = unique[i].tcoord;
+        tex_coords.push_back( tidx == -1 ? Vector2::Zero : obj.uvs[tidx] );
+    }
+
+    centroids.reserve( triangles.size() );
+    for ( size_t i = 0; i < triangles.size(); ++i )
+    {
+        centroids.push_back( compute_triangle_centroid( i ) );
+    }
+
+    use_lists();
+    return true;
+}
+
 const MeshTriangle* Mesh::get_triangles() const
 {
-    return triangles.empty() ? NULL : &triangles[0];
+    return triangle_data;
 }
 
 size_t Mesh::num_triangles() const
 {
-    return triangles.size();
+    return triangle_count;
+}
+
+const Vector3* Mesh::get_positions() const
+{
+    return position_data;
+}
+
+const Vector3* Mesh::get_normals() const
+{
+    return normal_data;
 }
 
-const MeshVertex* Mesh::get_vertices() const
+const Vector2* Mesh::get_tex_coords() const
 {
-    return vertices.empty() ? NULL : &vertices[0];
+    return tex_coord_data;
 }
 
 size_t Mesh::num_vertices() const
 {
-    return vertices.size();
+    return vertex_count;
+}
+
+const unsigned char* Mesh::get_bvh_data( size_t* size ) const
+{
+    *size = bvh_size;
+    return bvh_data;
+}
+
+bool Mesh::scan_bounds()
+{
+    if ( is_compiled_mesh_file( filename ) )
+    {
+        if ( !read_mesh_file_bounds( filename, &bounds_min, &bounds_max ) )
+        {
+            std::cout << "Compiled mesh '" << filename << "' was written by another version"
+                      << " or for another machine; compile it again.\n";
+            return false;
+        }
+        return true;
+    }
+
+    MappedFile file;
+    if ( !file.open( filename.c_str() ) )
+    {
+        std::cout << "Error opening file '" << filename << "' for mesh loading.\n";
+        return false;
+    }
+
+    Vector3 min_corner( INFINITY, INFINITY, INFINITY );
+    Vector3 max_corner( -INFINITY, -INFINITY, -INFINITY );
+    const char* end = file.data + file.size;
+
+    // only position lines are scanned, and only as far as their numbers
+    for ( const char* p = file.data; p < end; p = next_line( p, end ) )
+    {
+        p = skip_blanks( p, end );
+        if ( end - p < 2 || p[0] != 'v' || !is_blank( p[1] ) )
+        {
+            continue;
+        }
+
+        p += 2;
+        Vector3 position;
+        if ( !scan_real( p, end, position.x ) || !scan_real( p, end, position.y ) ||
+             !scan_real( p, end, position.z ) )
+        {
+            std::cout << "Position syntax error in '" << filename << "'.\n";
+            return false;
+        }
+
+        min_corner = Vector3( std::min( min_corner.x, position.x ), std::min( min_corner.y, position.y ),
+                              std::min( min_corner.z, position.z ) );
+        max_corner = Vector3( std::max( max_corner.x, position.x ), std::max( max_corner.y, position.y ),
+                              std::max( max_corner.z, position.z ) );
+    }
+
+    // an empty mesh has an empty box
+    if ( min_corner.x > max_corner.x )
+    {
+        min_corner = max_corner = Vector3::Zero;
+    }
+
+    bounds_min = min_corner;
+    bounds_max = max_corner;
+    return true;
+}
+
+void Mesh::get_bounds( Vector3* min_corner, Vector3* max_corner ) const
+{
+    *min_corner = bounds_min;
+    *max_corner = bounds_max;
+}
+
+void Mesh::set_streaming( bool s )
+{
+    streaming.store( s, std::memory_order_release );
+}
+
+bool Mesh::is_streaming() const
+{
+    return streaming.load( std::memory_order_acquire );
 }
 
 bool Mesh::are_normals_valid() const
@@ -416,21 +1221,15 @@ bool Mesh::are_tex_coords_valid() const
 // number of floats per vertex
 #define VERTEX_SIZE 8
 
-bool Mesh::create_gl_data()
+void Mesh::compute_normals()
 {
-    // if no vertices, nothing to do
-    if ( vertices.empty() || triangles.empty() )
-    {
-        return false;
-    }
-
-    // compute normals if needed
+    // compiled meshes always have normals
     if ( !has_normals )
     {
         // first zero out
-        for ( size_t i = 0; i < vertices.size(); ++i )
+        for ( size_t i = 0; i < normals.size(); ++i )
         {
-            vertices[i].normal = Vector3::Zero;
+            normals[i] = Vector3::Zero;
         }
 
         // then sum in all triangle normals
@@ -439,43 +1238,55 @@ bool Mesh::create_gl_data()
             Vector3 pos[3];
             for ( size_t j = 0; j < 3; ++j )
             {
-                pos[j] = vertices[triangles[i].vertices[j]].position;
+                pos[j] = positions[triangles[i].vertices[j]];
             }
             Vector3 normal = normalize( cross( pos[1] - pos[0], pos[2] - pos[0] ) );
             for ( size_t j = 0; j < 3; ++j )
             {
-                vertices[triangles[i].vertices[j]].normal += normal;
+                normals[triangles[i].vertices[j]] += normal;
             }
         }
 
         // then normalize
-        for ( size_t i = 0; i < vertices.size(); ++i )
+        for ( size_t i = 0; i < normals.size(); ++i )
         {
-            vertices[i].normal = normalize( vertices[i].normal );
+            normals[i] = normalize( normals[i] );
         }
 
         has_normals = true;
     }
+}
+
+bool Mesh::create_gl_data()
+{
+    // if no vertices, nothing to do
+    if ( vertex_count == 0 || triangle_count == 0 )
+    {
+        return false;
+    }
+
+    // compute normals if needed
+    compute_normals();
 
     // build vertex data
-    vertex_data.resize( vertices.size() * VERTEX_SIZE );
+    vertex_data.resize( vertex_count * VERTEX_SIZE );
     float* vertex = &vertex_data[0];
-    for ( size_t i = 0; i < vertices.size(); ++i )
+    for ( size_t i = 0; i < vertex_count; ++i )
     {
-        vertices[i].tex_coord.to_array( vertex + 0 );
-        vertices[i].normal.to_array( vertex + 2 );
-        vertices[i].position.to_array( vertex + 5 );
+        tex_coord_data[i].to_array( vertex + 0 );
+        normal_data[i].to_array( vertex + 2 );
+        position_data[i].to_array( vertex + 5 );
         vertex += VERTEX_SIZE;
     }
     // build index data
-    index_data.resize( triangles.size() * 3 );
+    index_data.resize( triangle_count * 3 );
     unsigned int* index = &index_data[0];
 
-    for ( size_t i = 0; i < triangles.size(); ++i )
+    for ( size_t i = 0; i < triangle_count; ++i )
     {
-        index[0] = triangles[i].vertices[0];
-        index[1] = triangles[i].vertices[1];
-        index[2] = triangles[i].vertices[2];
+        index[0] = triangle_data[i].vertices[0];
+        index[1] = triangle_data[i].vertices[1];
+        index[2] = triangle_data[i].vertices[2];
         index += 3;
     }
     return true;
@@ -483,14 +1294,18 @@ bool Mesh::create_gl_data()
 
 void Mesh::render() const
 {
-    assert( index_data.size() > 0 );
+    // meshes still loading in the background have no gl data yet
+    if ( index_data.empty() )
+    {
+        return;
+    }
     glInterleavedArrays( GL_T2F_N3F_V3F, VERTEX_SIZE * sizeof vertex_data[0], &vertex_data[0] );
     glDrawElements( GL_TRIANGLES, index_data.size(), GL_UNSIGNED_INT, &index_data[0] );
 }
 
 const Vector3& Mesh::get_triangle_centroid(size_t index) const
 {
-    return centroids[index];
+    return centroid_data[index];
 }
 
 Vector3 Mesh::compute_triangle_centroid(size_t index) const
@@ -501,7 +1316,7 @@ Vector3 Mesh::compute_triangle_centroid(size_t index) const
     vidx1 = triangles[index].vertices[1];
     vidx2 = triangles[index].vertices[2];
 
-    return (vertices[vidx0].position + vertices[vidx1].position + vertices[vidx2].position) / 3;
+    return (positions[vidx0] + positions[vidx1] + positions[vidx2]) / 3;
 }
 
 } /* _462 */
@@ -1,28 +1,44 @@
 #pragma once
 
 #include "math/vector.hpp"
+#include <string>
 #include <vector>
+#include <atomic>
 #include <cassert>
 
 namespace _462
 {
 
-struct MeshVertex
+struct MeshTriangle
 {
-    Vector3 position;
-    Vector3 normal;
-    Vector2 tex_coord;
+    // index into the vertex list of the 3 vertices
+    unsigned int vertices[3];
+};
 
+/// the ways Mesh::load_obj can read obj files
+enum ObjParser
+{
+    // maps the file into memory and scans it in place
+    OBJ_PARSER_MAPPED,
+    // reads the file line by line through string streams
+    OBJ_PARSER_STREAM
 };
 
-struct MeshTriangle
+/// the ways Mesh::load_obj can find the vertices faces share
+enum VertexDedup
 {
-    // index into the vertex list of the 3 vertices
-    unsigned int vertices[3];
+    // an open addressing hash table
+    VERTEX_DEDUP_HASH,
+    // a std::map
+    VERTEX_DEDUP_MAP
 };
 
 /**
- * A mesh of triangles.
+ * A mesh of triangles. The attributes of the vertices are kept in separate
+ * arrays, so intersection tests only touch the positions and the normals
+ * and texture coordinates are read when a hit is shaded. The arrays are
+ * either built from an obj file or used in place in a memory mapped
+ * compiled mesh file (see mesh_file.hpp).
  */
 class Mesh
 {
@@ -32,18 +48,74 @@ public:
     ~Mesh();
 
     /**
-     * Loads the model into a list of triangles and vertices.
+     * Loads the model into a list of triangles and vertices. Compiled mesh
+     * files are recognized by their header and mapped instead.
+     * @param threads How many threads the mapped parser may use on large
+     *  obj files; callers loading several meshes at once split their
+     *  threads between them.
+     * @return True on success.
+     */
+    bool load( int threads );
+
+    /**
+     * Loads the obj file named by filename with the given parser, without
+     * reporting progress. All parsers and ways of sharing vertices give the
+     * same mesh.
+     * @param threads How many threads the mapped parser may use on large
+     *  files.
+     * @return True on success.
+     */
+    bool load_obj( ObjParser parser, int threads = 1,
+                   VertexDedup dedup = VERTEX_DEDUP_HASH );
+
+    /**
+     * Maps the compiled mesh file named by filename and uses its arrays in
+     * place, without reporting progress.
      * @return True on success.
      */
-    bool load();
+    bool load_compiled();
+
+    /**
+     * Writes the mesh to a compiled mesh file, with the given bounding
+     * volume hierarchy (as written by BvhNode::save) if it isn't empty.
+     * Meshes without normals get smooth ones first.
+     * @return True on success.
+     */
+    bool save_compiled( const std::string& filename,
+                        const std::vector< unsigned char >& bvh );
+
+    /**
+     * The bounding volume hierarchy stored with a compiled mesh, or null
+     * if there is none.
+     */
+    const unsigned char* get_bvh_data( size_t* size ) const;
+
+    /**
+     * Finds the bounds of the mesh without loading it, from the header of a
+     * compiled mesh file or by scanning just the positions of an obj file,
+     * for get_bounds to return until the mesh is in.
+     * @return True on success.
+     */
+    bool scan_bounds();
+    /// the bounds found by scan_bounds
+    void get_bounds( Vector3* min_corner, Vector3* max_corner ) const;
+
+    /**
+     * Set while the mesh loads in the background; until it is cleared,
+     * nothing but the loader may touch the mesh's arrays.
+     */
+    void set_streaming( bool streaming );
+    bool is_streaming() const;
 
     /// Get a pointer to the triangles.
     const MeshTriangle* get_triangles() const;
     /// The number of elements in the triangle array.
     size_t num_triangles() const;
-    /// Get a pointer to the vertices.
-    const MeshVertex* get_vertices() const;
-    /// The number of elements in the vertex array.
+    /// Get pointers to the positions, normals and texture coordinates of the vertices.
+    const Vector3* get_positions() const;
+    const Vector3* get_normals() const;
+    const Vector2* get_tex_coords() const;
+    /// The number of elements in each vertex array.
     size_t num_vertices() const;
 
     /// Returns true if the loaded model contained normal data.
@@ -53,7 +125,11 @@ public:
 
     // scene loader stores the filename of the mesh here
     std::string filename;
+    // and the name the scene's models refer to it by
+    std::string name;
 
+    /// Computes smooth normals from the triangles if the file had none.
+    void compute_normals();
     /// Creates opengl data for rendering and computes normals if needed
     bool create_gl_data();
     /// Renders the mesh using opengl.
@@ -64,17 +140,41 @@ public:
 private:
 
     typedef std::vector< MeshTriangle > MeshTriangleList;
-    typedef std::vector< MeshVertex > MeshVertexList;
 
     // The list of all triangles in this model.
     MeshTriangleList triangles;
 
-    // The list of all vertices in this model.
-    MeshVertexList vertices;
+    // The attributes of all vertices in this model, by vertex.
+    std::vector< Vector3 > positions;
+    std::vector< Vector3 > normals;
+    std::vector< Vector2 > tex_coords;
 
     // Centroids of each triangle
     std::vector< Vector3 > centroids;
 
+    // the arrays the accessors return: the lists above, or sections of the
+    // mapping of a compiled mesh file
+    const MeshTriangle* triangle_data;
+    const Vector3* position_data;
+    const Vector3* normal_data;
+    const Vector2* tex_coord_data;
+    const Vector3* centroid_data;
+    size_t triangle_count;
+    size_t vertex_count;
+
+    // the mapping of a compiled mesh file, and the hierarchy in it
+    void* mapping;
+    size_t mapping_size;
+    const unsigned char* bvh_data;
+    size_t bvh_size;
+
+    Vector3 bounds_min, bounds_max;
+    std::atomic< bool > streaming;
+
+    /// points the arrays at the lists, dropping any mapping
+    void use_lists();
+    void unmap();
+
     Vector3 compute_triangle_centroid(size_t index) const;
 
     bool has_tcoords;
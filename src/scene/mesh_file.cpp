@@ -0,0 +1,245 @@
+#include "scene/mesh_file.hpp"
+#include "scene/mesh.hpp"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace _462
+{
+
+static const char mesh_file_magic[8] = { '4', '6', '2', 'M', 'E', 'S', 'H', '\0' };
+
+bool is_compiled_mesh_file( const std::string& filename )
+{
+    char magic[sizeof mesh_file_magic];
+    std::ifstream file( filename.c_str(), std::ios::binary );
+
+    return file.read( magic, sizeof magic ) &&
+        memcmp( magic, mesh_file_magic, sizeof magic ) == 0;
+}
+
+bool read_mesh_file_bounds( const std::string& filename, Vector3* min_corner,
+                            Vector3* max_corner )
+{
+    MeshFileHeader header;
+    std::ifstream file( filename.c_str(), std::ios::binary );
+
+    if ( !file.read( (char*) &header, sizeof header ) ||
+         memcmp( header.magic, mesh_file_magic, sizeof mesh_file_magic ) != 0 ||
+         header.version != mesh_file_version || header.byte_order != mesh_file_byte_order )
+    {
+        return false;
+    }
+
+    *min_corner = Vector3( header.bounds_min[0], header.bounds_min[1], header.bounds_min[2] );
+    *max_corner = Vector3( header.bounds_max[0], header.bounds_max[1], header.bounds_max[2] );
+    return true;
+}
+
+// whether a section lies in the file, aligned, and is as large as its
+// elements need
+static bool valid_section( const MeshFileHeader& header, MeshFileSection section,
+                           uint64_t file_size, uint64_t expected_size )
+{
+    uint64_t offset = header.offsets[section];
+    uint64_t size = header.sizes[section];
+
+    return offset % mesh_file_alignment == 0 && offset <= file_size &&
+        size <= file_size - offset && ( expected_size == 0 || size == expected_size );
+}
+
+bool Mesh::load_compiled()
+{
+    // drop whatever was loaded before, lists and all
+    std::vector< MeshTriangle >().swap( triangles );
+    std::vector< Vector3 >().swap( positions );
+    std::vector< Vector3 >().swap( normals );
+    std::vector< Vector2 >().swap( tex_coords );
+    std::vector< Vector3 >().swap( centroids );
+    use_lists();
+
+    int fd = open( filename.c_str(), O_RDONLY );
+    if ( fd < 0 )
+    {
+        std::cout << "Error opening file '" << filename << "' for mesh loading.\n";
+        return false;
+    }
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if ( fstat( fd, &st ) == 0 && (size_t) st.st_size >= sizeof( MeshFileHeader ) )
+    {
+        map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+    close( fd );
+
+    if ( map == MAP_FAILED )
+    {
+        std::cout << "Error mapping compiled mesh '" << filename << "'.\n";
+        return false;
+    }
+
+    mapping = map;
+    mapping_size = st.st_size;
+
+    const MeshFileHeader& header = *(const MeshFileHeader*) map;
+    uint64_t nv = header.num_vertices;
+    uint64_t nt = header.num_triangles;
+
+    if ( memcmp( header.magic, mesh_file_magic, sizeof mesh_file_magic ) != 0 ||
+         header.version != mesh_file_version || header.byte_order != mesh_file_byte_order ||
+         header.real_size != sizeof( real_t ) )
+    {
+        std::cout << "Compiled mesh '" << filename << "' was written by another version"
+                  << " or for another machine; compile it again.\n";
+        unmap();
+        return false;
+    }
+
+    // counts so large their sections' sizes wrap around can't be real
+    uint64_t max_count = UINT64_MAX / std::max( sizeof( Vector3 ), sizeof( MeshTriangle ) );
+    if ( nv == 0 || nt == 0 || nv > max_count || nt > max_count ||
+         !valid_section( header, MESH_SECTION_POSITIONS, mapping_size, nv * sizeof( Vector3 ) ) ||
+         !valid_section( header, MESH_SECTION_NORMALS, mapping_size, nv * sizeof( Vector3 ) ) ||
+         !valid_section( header, MESH_SECTION_TEX_COORDS, mapping_size, nv * sizeof( Vector2 ) ) ||
+         !valid_section( header, MESH_SECTION_TRIANGLES, mapping_size,
+                         nt * sizeof( MeshTriangle ) ) ||
+         !valid_section( header, MESH_SECTION_CENTROIDS, mapping_size, nt * sizeof( Vector3 ) ) ||
+         !valid_section( header, MESH_SECTION_BVH, mapping_size, 0 ) )
+    {
+        std::cout << "Compiled mesh '" << filename << "' is damaged.\n";
+        unmap();
+        return false;
+    }
+
+    // every triangle must index vertices the file has
+    const char* base = (const char*) map;
+    const MeshTriangle* file_triangles =
+        (const MeshTriangle*) ( base + header.offsets[MESH_SECTION_TRIANGLES] );
+    for ( uint64_t i = 0; i < nt; i++ )
+    {
+        const MeshTriangle& triangle = file_triangles[i];
+        if ( triangle.vertices[0] >= nv || triangle.vertices[1] >= nv ||
+             triangle.vertices[2] >= nv )
+        {
+            std::cout << "Compiled mesh '" << filename << "' is damaged.\n";
+            unmap();
+            return false;
+        }
+    }
+
+    position_data = (const Vector3*) ( base + header.offsets[MESH_SECTION_POSITIONS] );
+    normal_data = (const Vector3*) ( base + header.offsets[MESH_SECTION_NORMALS] );
+    tex_coord_data = (const Vector2*) ( base + header.offsets[MESH_SECTION_TEX_COORDS] );
+    triangle_data = file_triangles;
+    centroid_data = (const Vector3*) ( base + header.offsets[MESH_SECTION_CENTROIDS] );
+    vertex_count = nv;
+    triangle_count = nt;
+
+    if ( header.sizes[MESH_SECTION_BVH] > 0 )
+    {
+        bvh_data = (const unsigned char*) ( base + header.offsets[MESH_SECTION_BVH] );
+        bvh_size = header.sizes[MESH_SECTION_BVH];
+    }
+
+    has_normals = ( header.flags & MESH_FILE_NORMALS ) != 0;
+    has_tcoords = ( header.flags & MESH_FILE_TCOORDS ) != 0;
+    return true;
+}
+
+// writes zeros up to the next multiple of the alignment
+static void pad_to_alignment( std::ofstream& file, uint64_t& offset )
+{
+    static const char zeros[mesh_file_alignment] = { 0 };
+    uint64_t padding = ( mesh_file_alignment - offset % mesh_file_alignment ) % mesh_file_alignment;
+    file.write( zeros, padding );
+    offset += padding;
+}
+
+bool Mesh::save_compiled( const std::string& output, const std::vector< unsigned char >& bvh )
+{
+    if ( vertex_count == 0 || triangle_count == 0 )
+    {
+        std::cout << "Mesh '" << filename << "' has no triangles to compile.\n";
+        return false;
+    }
+
+    compute_normals();
+
+    const void* sections[NUM_MESH_SECTIONS] =
+    {
+        position_data, normal_data, tex_coord_data, triangle_data, centroid_data,
+        bvh.empty() ? NULL : &bvh[0]
+    };
+
+    MeshFileHeader header;
+    memset( &header, 0, sizeof header );
+    memcpy( header.magic, mesh_file_magic, sizeof mesh_file_magic );
+    header.version = mesh_file_version;
+    header.byte_order = mesh_file_byte_order;
+    header.real_size = sizeof( real_t );
+    header.flags = ( has_normals ? MESH_FILE_NORMALS : 0 ) |
+                   ( has_tcoords ? MESH_FILE_TCOORDS : 0 );
+    header.num_vertices = vertex_count;
+    header.num_triangles = triangle_count;
+    header.sizes[MESH_SECTION_POSITIONS] = vertex_count * sizeof( Vector3 );
+    header.sizes[MESH_SECTION_NORMALS] = vertex_count * sizeof( Vector3 );
+    header.sizes[MESH_SECTION_TEX_COORDS] = vertex_count * sizeof( Vector2 );
+    header.sizes[MESH_SECTION_TRIANGLES] = triangle_count * sizeof( MeshTriangle );
+    header.sizes[MESH_SECTION_CENTROIDS] = triangle_count * sizeof( Vector3 );
+    header.sizes[MESH_SECTION_BVH] = bvh.size();
+
+    for ( int axis = 0; axis < 3; ++axis )
+    {
+        header.bounds_min[axis] = INFINITY;
+        header.bounds_max[axis] = -INFINITY;
+    }
+    for ( size_t i = 0; i < vertex_count; ++i )
+    {
+        for ( int axis = 0; axis < 3; ++axis )
+        {
+            header.bounds_min[axis] = std::min( header.bounds_min[axis], (double) position_data[i][axis] );
+            header.bounds_max[axis] = std::max( header.bounds_max[axis], (double) position_data[i][axis] );
+        }
+    }
+
+    uint64_t offset = sizeof header;
+    for ( int i = 0; i < NUM_MESH_SECTIONS; ++i )
+    {
+        offset += ( mesh_file_alignment - offset % mesh_file_alignment ) % mesh_file_alignment;
+        header.offsets[i] = offset;
+        offset += header.sizes[i];
+    }
+
+    std::ofstream file( output.c_str(), std::ios::binary | std::ios::trunc );
+    if ( !file )
+    {
+        std::cout << "Error opening file '" << output << "' for writing.\n";
+        return false;
+    }
+
+    file.write( (const char*) &header, sizeof header );
+    offset = sizeof header;
+    for ( int i = 0; i < NUM_MESH_SECTIONS; ++i )
+    {
+        pad_to_alignment( file, offset );
+        file.write( (const char*) sections[i], header.sizes[i] );
+        offset += header.sizes[i];
+    }
+
+    if ( !file )
+    {
+        std::cout << "Error writing compiled mesh '" << output << "'.\n";
+        return false;
+    }
+
+    return true;
+}
+
+} /* _462 */
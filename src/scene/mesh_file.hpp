@@ -0,0 +1,72 @@
+#pragma once
+
+#include "math/vector.hpp"
+#include <string>
+#include <stdint.h>
+
+namespace _462
+{
+
+/**
+ * Compiled mesh files hold a mesh exactly as Mesh keeps it in memory, so
+ * loading one is mapping it: a header, then sections with the positions,
+ * normals and texture coordinates of the shared vertices, the triangles,
+ * their centroids and optionally a bounding volume hierarchy saved by
+ * BvhNode::save. Every section starts at a multiple of
+ * mesh_file_alignment. Files are written by "raytracer -P" and only read
+ * back on machines with the same byte order and precision.
+ */
+
+// bumped whenever the layout changes; files of other versions are rejected
+const uint32_t mesh_file_version = 2;
+const uint64_t mesh_file_alignment = 64;
+// written as is, so it reads back differently on a machine of the other
+// byte order
+const uint32_t mesh_file_byte_order = 0x01020304;
+
+enum MeshFileFlags
+{
+    MESH_FILE_NORMALS = 1 << 0,
+    MESH_FILE_TCOORDS = 1 << 1
+};
+
+enum MeshFileSection
+{
+    MESH_SECTION_POSITIONS,
+    MESH_SECTION_NORMALS,
+    MESH_SECTION_TEX_COORDS,
+    MESH_SECTION_TRIANGLES,
+    MESH_SECTION_CENTROIDS,
+    MESH_SECTION_BVH,
+    NUM_MESH_SECTIONS
+};
+
+struct MeshFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    // sizeof( real_t ) of the writer
+    uint32_t real_size;
+    uint32_t flags;
+    uint64_t num_vertices;
+    uint64_t num_triangles;
+    // byte offset and size of each section; empty sections have size 0
+    uint64_t offsets[NUM_MESH_SECTIONS];
+    uint64_t sizes[NUM_MESH_SECTIONS];
+    // bounds of the positions, so they can be had without mapping the rest
+    double bounds_min[3];
+    double bounds_max[3];
+};
+
+/// whether a file starts like a compiled mesh file
+bool is_compiled_mesh_file( const std::string& filename );
+
+/**
+ * Reads the bounds of a compiled mesh from its header.
+ * @return false if the file isn't a compiled mesh file of this version.
+ */
+bool read_mesh_file_bounds( const std::string& filename, Vector3* min_corner,
+                            Vector3* max_corner );
+
+} /* _462 */
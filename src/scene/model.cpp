@@ -24,11 +24,47 @@ Model::Model() : mesh( 0 ), material( 0 )
 {
     bvh = NULL;
 }
-Model::~Model() { }
+Model::~Model()
+{
+    delete bvh.load();
+}
+
+// intersects a ray with the bounds of the mesh, the proxy of a model whose
+// bvh isn't in yet. rays starting inside the box hit its far side.
+static bool intersect_proxy(const Mesh* mesh, const Ray& ray, float& time)
+{
+    Vector3 min_corner, max_corner;
+    mesh->get_bounds(&min_corner, &max_corner);
+    real_t tmin = -INFINITY, tmax = INFINITY;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (ray.dir[axis] != 0.0)
+        {
+            real_t t1 = (min_corner[axis] - ray.eye[axis]) / ray.dir[axis];
+            real_t t2 = (max_corner[axis] - ray.eye[axis]) / ray.dir[axis];
+            tmin = max(tmin, min(t1, t2));
+            tmax = min(tmax, max(t1, t2));
+        }
+        else if (ray.eye[axis] < min_corner[axis] || ray.eye[axis] > max_corner[axis])
+        {
+            return false;
+        }
+    }
+
+    real_t t = tmin > eps ? tmin : tmax;
+    if (tmax < tmin || t <= eps)
+    {
+        return false;
+    }
+
+    time = t;
+    return true;
+}
 
 void Model::render() const
 {
-    if (!mesh)
+    if (!mesh || mesh->is_streaming())
         return;
     if (material)
         material->set_gl_state();
@@ -37,11 +73,13 @@ void Model::render() const
         material->reset_gl_state();
 }
 
-void Model::intersect_packet(const Packet& packet, IsectInfo *infos, bool *intersected) const
+void Model::intersect_packet(const Packet& packet, HitRecord *hits, bool *intersected) const
 {
-    if (intersect_frustum(packet.frustum))
+    if (!packet.has_frustum || intersect_frustum(packet.frustum))
     {
         Packet instance_packet;
+        instance_packet.num_rays = packet.num_rays;
+        instance_packet.occupancy = packet.occupancy;
         BvhNode::IsectInfo temp_info[rays_per_packet];
         bool temp_intersected[rays_per_packet];
         
@@ -51,58 +89,108 @@ void Model::intersect_packet(const Packet& packet, IsectInfo *infos, bool *inter
                 inverse_transform_matrix.transform_point(packet.rays[i].eye);
             instance_packet.rays[i].dir = 
                 inverse_transform_matrix.transform_vector(packet.rays[i].dir);
-            temp_intersected[i] = true;
+            temp_intersected[i] = i < packet.num_rays;
         }
 
-        // packetized version
-        bvh->intersect_packet(instance_packet, temp_info, temp_intersected);
+        BvhNode* tree = bvh.load(memory_order_acquire);
+        if (tree)
+        {
+            // packetized version
+            tree->intersect_packet(instance_packet, temp_info, temp_intersected);
+        }
+        else
+        {
+            for (int i = 0; i < packet.num_rays; i++)
+            {
+                temp_intersected[i] = intersect_proxy(mesh, instance_packet.rays[i],
+                                                      temp_info[i].time);
+                temp_info[i].index = proxy_primitive;
+            }
+        }
 
         // TODO make this simd
-        for (int i = 0; i < rays_per_packet; i++)
+        for (int i = 0; i < packet.num_rays; i++)
         {
-            if (temp_intersected[i] && temp_info[i].time < infos[i].time)
+            if (temp_intersected[i] && temp_info[i].time < hits[i].time)
             {
-                compute_ray_info(temp_info[i], infos[i]);
+                hits[i].time = temp_info[i].time;
+                hits[i].geometry = id;
+                hits[i].primitive = (unsigned int) temp_info[i].index;
+                hits[i].beta = temp_info[i].beta;
+                hits[i].gamma = temp_info[i].gamma;
                 intersected[i] = true;
             }
         }
     }
 }
 
-void Model::compute_ray_info(const BvhNode::IsectInfo& bvh_info, IsectInfo& info) const
+void Model::shade(const Ray& ray, const HitRecord& hit, IsectInfo& info) const
 {
-    float min_alpha;
-    size_t min_v0 = mesh->get_triangles()[bvh_info.index].vertices[0];
-    size_t min_v1 = mesh->get_triangles()[bvh_info.index].vertices[1];
-    size_t min_v2 = mesh->get_triangles()[bvh_info.index].vertices[2];
-    Vector3 normal0 = mesh->get_vertices()[min_v0].normal;
-    Vector3 normal1 = mesh->get_vertices()[min_v1].normal;
-    Vector3 normal2 = mesh->get_vertices()[min_v2].normal;
-    min_alpha = 1.0 - bvh_info.gamma - bvh_info.beta;
-    Vector3 normal = min_alpha * normal0 + bvh_info.beta * normal1 + bvh_info.gamma * normal2;
-
-    info.normal = normalize(normal_matrix * normal);
     info.ambient = material->ambient;
     info.diffuse = material->diffuse;
     info.specular = material->specular;
     info.refractive = material->refractive_index;
-    info.time = bvh_info.time;
+    info.time = hit.time;
+
+    if (hit.primitive == proxy_primitive)
+    {
+        // proxies are flat shaded boxes without texture, facing the way
+        // of the side of the box nearest the hit
+        Vector3 eye = inverse_transform_matrix.transform_point(ray.eye);
+        Vector3 dir = inverse_transform_matrix.transform_vector(ray.dir);
+        Vector3 point = eye + hit.time * dir;
+        Vector3 min_corner, max_corner;
+        mesh->get_bounds(&min_corner, &max_corner);
+
+        Vector3 normal = Vector3::Zero;
+        real_t nearest = INFINITY;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (point[axis] - min_corner[axis] < nearest)
+            {
+                nearest = point[axis] - min_corner[axis];
+                normal = Vector3::Zero;
+                normal[axis] = -1;
+            }
+            if (max_corner[axis] - point[axis] < nearest)
+            {
+                nearest = max_corner[axis] - point[axis];
+                normal = Vector3::Zero;
+                normal[axis] = 1;
+            }
+        }
+
+        info.normal = normalize(normal_matrix * normal);
+        info.texture = Color3::White;
+        return;
+    }
+
+    float min_alpha;
+    size_t min_v0 = mesh->get_triangles()[hit.primitive].vertices[0];
+    size_t min_v1 = mesh->get_triangles()[hit.primitive].vertices[1];
+    size_t min_v2 = mesh->get_triangles()[hit.primitive].vertices[2];
+    const Vector3* normals = mesh->get_normals();
+    min_alpha = 1.0 - hit.gamma - hit.beta;
+    Vector3 normal = min_alpha * normals[min_v0] + hit.beta * normals[min_v1]
+        + hit.gamma * normals[min_v2];
+
+    info.normal = normalize(normal_matrix * normal);
 
     // texture
-    Vector2 tex_coord = min_alpha * mesh->get_vertices()[min_v0].tex_coord
-        + bvh_info.beta * mesh->get_vertices()[min_v1].tex_coord
-        + bvh_info.gamma * mesh->get_vertices()[min_v2].tex_coord;
-    double dec_x = fmod(tex_coord.x, 1.0);
-    double dec_y = fmod(tex_coord.y, 1.0);
-    int width, height;
-    material->get_texture_size(&width, &height);
-    dec_x *= width;
-    dec_y *= height;
-
-    info.texture = material->get_texture_pixel(dec_x, dec_y);
+    const Vector3* positions = mesh->get_positions();
+    const Vector2* tex_coords = mesh->get_tex_coords();
+    Vector2 tex_coord = min_alpha * tex_coords[min_v0]
+        + hit.beta * tex_coords[min_v1]
+        + hit.gamma * tex_coords[min_v2];
+    real_t uv_per_unit = triangle_uv_per_unit(positions[min_v0], positions[min_v1],
+                                              positions[min_v2], tex_coords[min_v0],
+                                              tex_coords[min_v1], tex_coords[min_v2]);
+    real_t footprint = texture_footprint(ray, info.time, info.normal, uv_per_unit);
+
+    info.texture = material->sample_texture(tex_coord, footprint);
 }
 
-bool Model::intersect_ray(const Ray& ray, IsectInfo& info) const
+bool Model::intersect_ray(const Ray& ray, HitRecord& hit) const
 {
     // first check intersection with bounding box
     Ray instance_ray;
@@ -110,14 +198,27 @@ bool Model::intersect_ray(const Ray& ray, IsectInfo& info) const
     instance_ray.dir = inverse_transform_matrix.transform_vector(ray.dir);
 
     BvhNode::IsectInfo bvh_info;
-    if (!bvh->intersect_ray(instance_ray, bvh_info))
+    BvhNode* tree = bvh.load(memory_order_acquire);
+    if (!tree)
+    {
+        if (!intersect_proxy(mesh, instance_ray, bvh_info.time))
+        {
+            return false;
+        }
+        bvh_info.index = proxy_primitive;
+    }
+    else if (!tree->intersect_ray(instance_ray, bvh_info))
     {
         return false;
     }
 
-    if (bvh_info.time < info.time && bvh_info.time > eps)
+    if (bvh_info.time < hit.time && bvh_info.time > eps)
     {
-        compute_ray_info(bvh_info, info);
+        hit.time = bvh_info.time;
+        hit.geometry = id;
+        hit.primitive = (unsigned int) bvh_info.index;
+        hit.beta = bvh_info.beta;
+        hit.gamma = bvh_info.gamma;
     }
     else
     {
@@ -127,29 +228,98 @@ bool Model::intersect_ray(const Ray& ray, IsectInfo& info) const
     return true;
 }
 
-bool Model::shadow_test(const Ray& ray) const
+bool Model::shadow_test(const Ray& ray, size_t* primitive) const
+{
+    Ray instance_ray;
+    instance_ray.eye = inverse_transform_matrix.transform_point(ray.eye);
+    instance_ray.dir = inverse_transform_matrix.transform_vector(ray.dir);
+
+    BvhNode* tree = bvh.load(memory_order_acquire);
+    if (!tree)
+    {
+        float time;
+        if (primitive)
+        {
+            *primitive = proxy_primitive;
+        }
+        return intersect_proxy(mesh, instance_ray, time);
+    }
+
+    return tree->shadow_test(instance_ray, primitive);
+}
+
+// the leaf test of BvhNode::shadow_test on a single triangle
+bool Model::shadow_test_primitive(const Ray& ray, size_t primitive) const
 {
     Ray instance_ray;
     instance_ray.eye = inverse_transform_matrix.transform_point(ray.eye);
     instance_ray.dir = inverse_transform_matrix.transform_vector(ray.dir);
 
-    return bvh->shadow_test(instance_ray);
+    if (primitive == proxy_primitive)
+    {
+        // once the bvh is in, the proxy is gone
+        float time;
+        return !bvh.load(memory_order_acquire) && intersect_proxy(mesh, instance_ray, time);
+    }
+
+    const MeshTriangle& triangle = mesh->get_triangles()[primitive];
+    const Vector3* positions = mesh->get_positions();
+    BvhNode::IsectInfo info;
+
+    return triangle_ray_intersect(instance_ray.eye, instance_ray.dir,
+                                  positions[triangle.vertices[0]],
+                                  positions[triangle.vertices[1]],
+                                  positions[triangle.vertices[2]],
+                                  info.time, info.gamma, info.beta);
 }
 
 void Model::make_bounding_volume()
 {
-    if (bvh)
+    // meshes don't change once loaded, so a bvh built while the scene's
+    // assets were loading is kept. meshes still loading in the background
+    // get theirs from the loader once they are in.
+    if (bvh.load(memory_order_acquire) || mesh->is_streaming())
     {
-        delete bvh;
+        return;
     }
 
     double bvh_create_start = CycleTimer::currentSeconds();
+    BvhNode* built = NULL;
+
+    // compiled meshes may carry their hierarchy
+    size_t bvh_size;
+    const unsigned char* bvh_data = mesh->get_bvh_data(&bvh_size);
+    if (bvh_data)
+    {
+        built = BvhNode::load(mesh, bvh_data, bvh_size);
+        if (built)
+        {
+            double done = CycleTimer::currentSeconds();
+            cout << "Bvh loading took        " << (done - bvh_create_start) << "s" << endl;
+        }
+        else
+        {
+            cout << "Saved bvh doesn't fit the mesh, rebuilding it" << endl;
+        }
+    }
 
-    bvh = new BvhNode(mesh, NULL, 0, 0);
+    if (!built)
+    {
+        built = new BvhNode(mesh, NULL, 0, 0);
 
-    double done = CycleTimer::currentSeconds();
+        double done = CycleTimer::currentSeconds();
+
+        cout << "Bvh creation took       " << (done - bvh_create_start) << "s" << endl;
+    }
 
-    cout << "Bvh creation took       " << (done - bvh_create_start) << "s" << endl;
+    // swaps the proxy for the bvh in one step. the loader and the main
+    // thread may both get here just as a streamed mesh comes in; the first
+    // one to finish wins.
+    BvhNode* none = NULL;
+    if (!bvh.compare_exchange_strong(none, built, memory_order_acq_rel))
+    {
+        delete built;
+    }
 }
 
 bool Model::intersect_frustum(const Frustum& frustum) const
@@ -165,14 +335,22 @@ bool Model::intersect_frustum(const Frustum& frustum) const
         instance_frustum.planes[i].normal = normalize(N * frustum.planes[i].normal);
     }
 
-    if (frustum_box_intersect(instance_frustum, bvh->left_bbox.min_corner,
-            bvh->left_bbox.max_corner))
+    BvhNode* tree = bvh.load(memory_order_acquire);
+    if (!tree)
+    {
+        Vector3 min_corner, max_corner;
+        mesh->get_bounds(&min_corner, &max_corner);
+        return frustum_box_intersect(instance_frustum, min_corner, max_corner);
+    }
+
+    if (frustum_box_intersect(instance_frustum, tree->left_bbox.min_corner,
+            tree->left_bbox.max_corner))
     {
         return true;
     }
 
-    if (frustum_box_intersect(instance_frustum, bvh->right_bbox.min_corner,
-            bvh->right_bbox.max_corner))
+    if (frustum_box_intersect(instance_frustum, tree->right_bbox.min_corner,
+            tree->right_bbox.max_corner))
     {
         return true;
     }
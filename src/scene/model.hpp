@@ -4,12 +4,18 @@
 #include "scene/mesh.hpp"
 #include "scene/material.hpp"
 #include "raytracer/bvh.hpp"
+#include <atomic>
 
 namespace _462
 {
 
+// the primitive of hits on the box a model is traced as until its bvh is in
+const unsigned int proxy_primitive = ~0u;
+
 /**
- * A mesh of triangles.
+ * A mesh of triangles. Until the bvh of a model is built it is traced as the
+ * bounding box of its mesh, a proxy that is swapped for the real thing when
+ * a mesh that loads in the background is in.
  */
 class Model : public Geometry
 {
@@ -18,19 +24,22 @@ public:
     const Mesh* mesh;
     const Material* material;
 
-    BvhNode* bvh;
+    // null until built; tracing threads read it while the loader sets it
+    std::atomic< BvhNode* > bvh;
 
     Model();
     virtual ~Model();
 
-    void compute_ray_info(const BvhNode::IsectInfo& bvh_info, IsectInfo& info) const;
     bool intersect_frustum(const Frustum& frustum) const;
 
     virtual void render() const;
-    virtual void intersect_packet(const Packet& packet, IsectInfo *infos, bool *intersected) const;
-    virtual bool intersect_ray(const Ray& ray, IsectInfo& info) const;
-    virtual bool shadow_test(const Ray& ray) const;
+    virtual void intersect_packet(const Packet& packet, HitRecord *hits, bool *intersected) const;
+    virtual bool intersect_ray(const Ray& ray, HitRecord& hit) const;
+    virtual void shade(const Ray& ray, const HitRecord& hit, IsectInfo& info) const;
+    virtual bool shadow_test(const Ray& ray, size_t* primitive = NULL) const;
+    virtual bool shadow_test_primitive(const Ray& ray, size_t primitive) const;
     virtual void make_bounding_volume();
+    virtual const Mesh* get_mesh() const { return mesh; }
 };
 
 
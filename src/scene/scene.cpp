@@ -65,7 +65,7 @@ size_t Scene::num_meshes() const
 
 void Scene::reset()
 {
-    for ( GeometryList::iterator i = geometries.begin(); i != geometries.end(); ++i )
+    for ( GeometryList::iterator i = single_geometries.begin(); i != single_geometries.end(); ++i )
     {
         delete *i;
     }
@@ -79,6 +79,8 @@ void Scene::reset()
     }
 
     geometries.clear();
+    single_geometries.clear();
+    geometry_arrays.clear();
     materials.clear();
     meshes.clear();
     point_lights.clear();
@@ -92,7 +94,9 @@ void Scene::reset()
 
 void Scene::add_geometry( Geometry* g )
 {
+    g->id = geometries.size();
     geometries.push_back( g );
+    single_geometries.push_back( g );
 }
 
 void Scene::add_material( Material* m )
@@ -8,6 +8,7 @@
 #include "scene/mesh.hpp"
 #include "scene/geometry.hpp"
 #include "raytracer/geom_utils.hpp"
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -53,7 +54,8 @@ public:
     /// Creates a new empty scene.
     Scene();
 
-    /// Destroys this scene. Invokes delete on everything in geometries.
+    /// Destroys this scene. Invokes delete on everything in geometries, or
+    /// delete[] on the arrays they were added in.
     ~Scene();
 
     // accessor functions
@@ -66,7 +68,7 @@ public:
     Mesh* const* get_meshes() const;
     size_t num_meshes() const;
 
-    /// Clears the scene, and invokes delete on everything in geometries.
+    /// Clears the scene, and deletes everything in geometries as the destructor does.
     void reset();
 
     // functions to add things to the scene
@@ -76,6 +78,23 @@ public:
     void add_mesh( Mesh* m );
     void add_light( const PointLight& l );
 
+    /**
+     * Adds every geometry of an array allocated with new[], which the scene
+     * deletes as a whole. Loaders use it to make the geometries of large
+     * scenes with one allocation per kind instead of one per geometry.
+     */
+    template< typename T >
+    void add_geometries( T* array, size_t count )
+    {
+        geometry_arrays.push_back( std::shared_ptr< void >( array, std::default_delete< T[] >() ) );
+        geometries.reserve( geometries.size() + count );
+        for ( size_t i = 0; i < count; ++i )
+        {
+            array[i].id = geometries.size();
+            geometries.push_back( &array[i] );
+        }
+    }
+
 private:
 
     typedef std::vector< PointLight > PointLightList;
@@ -91,6 +110,10 @@ private:
     MeshList meshes;
     // list of all geometries. deleted in dctor, so should be allocated on heap.
     GeometryList geometries;
+    // the geometries added one at a time, each deleted on its own
+    GeometryList single_geometries;
+    // the arrays added by add_geometries, deleted whole
+    std::vector< std::shared_ptr< void > > geometry_arrays;
 
 private:
 
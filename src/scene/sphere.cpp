@@ -94,18 +94,18 @@ void Sphere::render() const
         material->reset_gl_state();
 }
 
-void Sphere::intersect_packet(const Packet& packet, IsectInfo *infos, bool *intersected) const
+void Sphere::intersect_packet(const Packet& packet, HitRecord *hits, bool *intersected) const
 {
-    if (intersect_frustum(packet.frustum))
+    if (!packet.has_frustum || intersect_frustum(packet.frustum))
     {
-        for (int i = 0; i < rays_per_packet; i++)
+        for (int i = 0; i < packet.num_rays; i++)
         {
-            intersected[i] = intersected[i] || intersect_ray(packet.rays[i], infos[i]);
+            intersected[i] = intersect_ray(packet.rays[i], hits[i]) || intersected[i];
         }
     }
 }
 
-bool Sphere::intersect_ray(const Ray& ray, IsectInfo& info) const
+bool Sphere::intersect_ray(const Ray& ray, HitRecord& hit) const
 {
     Vector3 instance_eye = inverse_transform_matrix.transform_point(ray.eye);
     Vector3 instance_ray = inverse_transform_matrix.transform_vector(ray.dir);
@@ -131,12 +131,25 @@ bool Sphere::intersect_ray(const Ray& ray, IsectInfo& info) const
             / dot(instance_ray, instance_ray);
     }
 
-    if (t < eps || t > info.time)
+    // on a tie the geometry that was hit first keeps the ray
+    if (t < eps || t >= hit.time)
     {
         return false;
     }
 
-    // return info
+    hit.time = t;
+    hit.geometry = id;
+    hit.primitive = 0;
+
+    return true;
+}
+
+void Sphere::shade(const Ray& ray, const HitRecord& hit, IsectInfo& info) const
+{
+    Vector3 instance_eye = inverse_transform_matrix.transform_point(ray.eye);
+    Vector3 instance_ray = inverse_transform_matrix.transform_vector(ray.dir);
+    float t = hit.time;
+
     Vector3 normal = (instance_eye + t * instance_ray) / radius;
     info.normal = normalize(normal_matrix * normal);
     info.ambient = material->ambient;
@@ -148,18 +161,15 @@ bool Sphere::intersect_ray(const Ray& ray, IsectInfo& info) const
     // texture
     real_t theta = acos(normal.y);
     real_t phi = atan2(normal.x, normal.z);
-    real_t tex_u = fmod(phi / (2 * PI), 1.0);
-    real_t tex_v = fmod((PI - theta) / PI, 1.0);
-    int width, height;
-    material->get_texture_size(&width, &height);
-    tex_u *= width;
-    tex_v *= height;
-    info.texture = material->get_texture_pixel(tex_u, tex_v);
-
-    return true;
+    Vector2 tex_coord(phi / (2 * PI), (PI - theta) / PI);
+    // the texture covers the sphere once, 4 pi r^2 of the world
+    real_t world_radius = length(transform_matrix.transform_vector(normal * radius));
+    real_t uv_per_unit = 1.0 / (2 * world_radius * sqrt(PI));
+    real_t footprint = texture_footprint(ray, t, info.normal, uv_per_unit);
+    info.texture = material->sample_texture(tex_coord, footprint);
 }
 
-bool Sphere::shadow_test(const Ray& ray) const
+bool Sphere::shadow_test(const Ray& ray, size_t*) const
 {
     Vector3 instance_eye = inverse_transform_matrix.transform_point(ray.eye);
     Vector3 instance_ray = inverse_transform_matrix.transform_vector(ray.dir);
@@ -0,0 +1,177 @@
+#include "scene/texture.hpp"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace _462
+{
+
+// wraps a texel index into [0, size)
+static inline int wrap( int i, int size )
+{
+    i %= size;
+    return i < 0 ? i + size : i;
+}
+
+Color3 Texture::sample_bilinear( size_t level, const Vector2& coord ) const
+{
+    int width = sizes[level].width;
+    int height = sizes[level].height;
+
+    // texel centers sit at half-integer coordinates
+    real_t x = coord.x * width - 0.5;
+    real_t y = coord.y * height - 0.5;
+    real_t fx = floor( x );
+    real_t fy = floor( y );
+    real_t sx = x - fx;
+    real_t sy = y - fy;
+    int x0 = wrap( (int) fx, width );
+    int y0 = wrap( (int) fy, height );
+    int x1 = x0 + 1 < width ? x0 + 1 : 0;
+    int y1 = y0 + 1 < height ? y0 + 1 : 0;
+
+    Color3 texels[4];
+    fetch_quad( level, x0, y0, x1, y1, texels );
+
+    Color3 c0 = ( 1 - sx ) * texels[0] + sx * texels[1];
+    Color3 c1 = ( 1 - sx ) * texels[2] + sx * texels[3];
+    return ( 1 - sy ) * c0 + sy * c1;
+}
+
+Color3 Texture::sample( const Vector2& coord, real_t footprint ) const
+{
+    // keep the coordinates small so the texel indices can't overflow
+    Vector2 c( coord.x - floor( coord.x ), coord.y - floor( coord.y ) );
+
+    // the footprint in level 0 texels, as wide as the texels of level lod
+    real_t texels = footprint * sqrt( (real_t) width() * height() );
+    real_t lod = texels > 1 ? log2( texels ) : 0;
+    real_t max_lod = sizes.size() - 1;
+
+    if ( lod >= max_lod )
+    {
+        return sample_bilinear( sizes.size() - 1, c );
+    }
+
+    size_t l = (size_t) lod;
+    real_t t = lod - l;
+    Color3 fine = sample_bilinear( l, c );
+
+    if ( t == 0 )
+    {
+        return fine;
+    }
+
+    return ( 1 - t ) * fine + t * sample_bilinear( l + 1, c );
+}
+
+// rearranges a row by row level into tiles. the last row and column of
+// tiles are padded out to whole tiles.
+static void tile_level( MemoryTexture::Level& level, int width, int height )
+{
+    int tiles_y = ( height + texture_tile_dim - 1 ) / texture_tile_dim;
+    level.tiles_x = ( width + texture_tile_dim - 1 ) / texture_tile_dim;
+    std::vector< unsigned char > tiled( 4 * (size_t) level.tiles_x * tiles_y
+                                        * texture_tile_dim * texture_tile_dim );
+    unsigned char* dst = &tiled[0];
+
+    for ( int ty = 0; ty < tiles_y; ty++ )
+    {
+        for ( int tx = 0; tx < level.tiles_x; tx++ )
+        {
+            for ( int y = 0; y < texture_tile_dim; y++ )
+            {
+                // padding repeats the last row and column
+                int sy = std::min( ty * texture_tile_dim + y, height - 1 );
+
+                for ( int x = 0; x < texture_tile_dim; x++, dst += 4 )
+                {
+                    int sx = std::min( tx * texture_tile_dim + x, width - 1 );
+                    memcpy( dst, &level.data[4 * ( sy * (size_t) width + sx )], 4 );
+                }
+            }
+        }
+    }
+
+    level.data.swap( tiled );
+}
+
+MemoryTexture::MemoryTexture( const unsigned char* data, int width, int height,
+                              TextureLayout layout ) : layout( layout )
+{
+    LevelSize size = { width, height };
+    sizes.push_back( size );
+    levels.push_back( Level() );
+    levels[0].tiles_x = 0;
+    levels[0].data.assign( data, data + 4 * (size_t) width * height );
+
+    // filter each level from the one before it while they are still row
+    // by row
+    while ( sizes.back().width > 1 || sizes.back().height > 1 )
+    {
+        const LevelSize src_size = sizes.back();
+        LevelSize dst_size = { std::max( 1, src_size.width / 2 ),
+                               std::max( 1, src_size.height / 2 ) };
+        sizes.push_back( dst_size );
+        levels.push_back( Level() );
+        const Level& src = levels[levels.size() - 2];
+        Level& dst = levels.back();
+        dst.tiles_x = 0;
+        dst.data.resize( 4 * (size_t) dst_size.width * dst_size.height );
+
+        for ( int y = 0; y < dst_size.height; y++ )
+        {
+            // odd sizes drop the last row or column, 1 texel wide sides
+            // average the texel with itself
+            int y0 = std::min( 2 * y, src_size.height - 1 );
+            int y1 = std::min( 2 * y + 1, src_size.height - 1 );
+
+            for ( int x = 0; x < dst_size.width; x++ )
+            {
+                int x0 = std::min( 2 * x, src_size.width - 1 );
+                int x1 = std::min( 2 * x + 1, src_size.width - 1 );
+                const unsigned char* p00 = &src.data[4 * (y0 * (size_t) src_size.width + x0)];
+                const unsigned char* p01 = &src.data[4 * (y0 * (size_t) src_size.width + x1)];
+                const unsigned char* p10 = &src.data[4 * (y1 * (size_t) src_size.width + x0)];
+                const unsigned char* p11 = &src.data[4 * (y1 * (size_t) src_size.width + x1)];
+                unsigned char* p = &dst.data[4 * (y * (size_t) dst_size.width + x)];
+
+                for ( int c = 0; c < 4; c++ )
+                {
+                    p[c] = ( p00[c] + p01[c] + p10[c] + p11[c] + 2 ) / 4;
+                }
+            }
+        }
+    }
+
+    if ( layout == TEXTURE_TILED )
+    {
+        for ( size_t i = 0; i < levels.size(); i++ )
+        {
+            tile_level( levels[i], sizes[i].width, sizes[i].height );
+        }
+    }
+}
+
+void MemoryTexture::get_rows( size_t level, unsigned char* rows ) const
+{
+    for ( int y = 0; y < sizes[level].height; y++ )
+    {
+        for ( int x = 0; x < sizes[level].width; x++, rows += 4 )
+        {
+            memcpy( rows, texel( level, x, y ), 4 );
+        }
+    }
+}
+
+void MemoryTexture::fetch_quad( size_t level, int x0, int y0, int x1, int y1,
+                                Color3 texels[4] ) const
+{
+    texels[0] = Color3( texel( level, x0, y0 ) );
+    texels[1] = Color3( texel( level, x1, y0 ) );
+    texels[2] = Color3( texel( level, x0, y1 ) );
+    texels[3] = Color3( texel( level, x1, y1 ) );
+}
+
+} /* _462 */
+
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "math/color.hpp"
+#include "math/vector.hpp"
+#include <vector>
+
+namespace _462
+{
+
+// texels per side of a tile of a tiled texture. 4x4 RGBA texels fill one
+// 64 byte cache line.
+const int texture_tile_shift = 2;
+const int texture_tile_dim = 1 << texture_tile_shift;
+
+enum TextureLayout
+{
+    // one row after another, as decoded
+    TEXTURE_LINEAR,
+    // square tiles of texture_tile_dim texels, one row of tiles after
+    // another and the texels of each tile in row order. texels above and
+    // below each other are usually in the same cache line.
+    TEXTURE_TILED,
+};
+
+/**
+ * An RGBA texture and its mip pyramid. Level 0 is the image itself, every
+ * further level is a 2x2 box filtered copy of the one before it at half the
+ * size (rounded down, at least 1), down to a single texel. Subclasses decide
+ * where the texels are kept.
+ */
+class Texture
+{
+public:
+
+    virtual ~Texture() { }
+
+    int width() const { return sizes[0].width; }
+    int height() const { return sizes[0].height; }
+
+    size_t num_levels() const { return sizes.size(); }
+    int level_width( size_t level ) const { return sizes[level].width; }
+    int level_height( size_t level ) const { return sizes[level].height; }
+
+    /**
+     * Samples the texture with a trilinear filter. Coordinates wrap around,
+     * one texture width or height per unit.
+     * @param footprint The width of the surface area seen by the sample, in
+     *  texture coordinates. Picks the mip level whose texels are about as
+     *  wide; 0 samples level 0.
+     */
+    Color3 sample( const Vector2& coord, real_t footprint ) const;
+
+    /// samples a single level with a bilinear filter
+    Color3 sample_bilinear( size_t level, const Vector2& coord ) const;
+
+    /// copies a level out row by row, e.g. for opengl
+    virtual void get_rows( size_t level, unsigned char* rows ) const = 0;
+
+protected:
+
+    struct LevelSize
+    {
+        int width, height;
+    };
+
+    std::vector< LevelSize > sizes;
+
+    /**
+     * Fetches the four texels (x0,y0), (x1,y0), (x0,y1) and (x1,y1) of a
+     * level, in that order.
+     */
+    virtual void fetch_quad( size_t level, int x0, int y0, int x1, int y1,
+                             Color3 texels[4] ) const = 0;
+};
+
+/**
+ * A texture decoded into memory as a whole.
+ */
+class MemoryTexture : public Texture
+{
+public:
+
+    struct Level
+    {
+        // tiles per row of tiles, for the tiled layout
+        int tiles_x;
+        // RGBA texels in the texture's layout
+        std::vector< unsigned char > data;
+    };
+
+    /**
+     * Builds the pyramid of the given RGBA image. The image is copied, the
+     * caller keeps ownership of it.
+     */
+    MemoryTexture( const unsigned char* data, int width, int height,
+                   TextureLayout layout = TEXTURE_TILED );
+
+    TextureLayout get_layout() const { return layout; }
+
+    /// returns the RGBA texel (x,y) of a level, whatever the layout
+    const unsigned char* texel( size_t level, int x, int y ) const
+    {
+        const Level& l = levels[level];
+        size_t i;
+        if ( layout == TEXTURE_TILED )
+        {
+            size_t tile = ( y >> texture_tile_shift ) * (size_t) l.tiles_x
+                          + ( x >> texture_tile_shift );
+            i = ( tile << ( 2 * texture_tile_shift ) )
+                + ( ( y & ( texture_tile_dim - 1 ) ) << texture_tile_shift )
+                + ( x & ( texture_tile_dim - 1 ) );
+        }
+        else
+        {
+            i = y * (size_t) sizes[level].width + x;
+        }
+        return &l.data[4 * i];
+    }
+
+    virtual void get_rows( size_t level, unsigned char* rows ) const;
+
+protected:
+
+    virtual void fetch_quad( size_t level, int x0, int y0, int x1, int y1,
+                             Color3 texels[4] ) const;
+
+private:
+
+    TextureLayout layout;
+    std::vector< Level > levels;
+};
+
+} /* _462 */
+
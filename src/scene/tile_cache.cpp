@@ -0,0 +1,554 @@
+#include "scene/tile_cache.hpp"
+#include "application/imageio.hpp"
+#include <iostream>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace _462
+{
+
+static const char tile_file_magic[4] = { 'T', 'T', 'E', 'X' };
+static const uint32_t tile_file_version = 1;
+
+struct TileFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t tile_dim;
+    uint32_t num_levels;
+};
+
+struct TileFileLevel
+{
+    uint32_t width, height;
+    uint32_t tiles_x, tiles_y;
+    uint64_t offset;
+};
+
+// a tile's key in the cache: 20 bits of texture, 6 of level, 38 of tile
+static inline uint64_t tile_key( uint32_t texture, uint32_t level, uint32_t tile )
+{
+    return ( (uint64_t) texture << 44 ) | ( (uint64_t) level << 38 ) | tile;
+}
+
+static inline uint32_t key_texture( uint64_t key )
+{
+    return key >> 44;
+}
+
+TileCache::TileCache() : budget( 0 ) { }
+
+void TileCache::set_budget( size_t bytes )
+{
+    budget = bytes;
+}
+
+void TileCache::read_texels( const StreamedTexture& texture, uint32_t level, uint32_t tile,
+                             const int* offsets, int count, Color3* out )
+{
+    uint64_t key = tile_key( texture.get_id(), level, tile );
+    // fibonacci hashing spreads neighbouring tiles over the shards
+    Shard& shard = shards[( key * 0x9E3779B97F4A7C15ull ) >> 60];
+
+    {
+        std::lock_guard< std::mutex > lock( shard.mutex );
+        std::unordered_map< uint64_t, std::list< Tile >::iterator >::iterator
+            iter = shard.tiles.find( key );
+
+        if ( iter != shard.tiles.end() )
+        {
+            shard.hits++;
+            shard.lru.splice( shard.lru.begin(), shard.lru, iter->second );
+            const unsigned char* data = &iter->second->data[0];
+            for ( int i = 0; i < count; i++ )
+            {
+                out[i] = Color3( data + 4 * offsets[i] );
+            }
+            return;
+        }
+
+        shard.misses++;
+    }
+
+    // read without holding the lock. two threads missing on the same tile
+    // both read it; the first one to finish wins.
+    Tile loaded;
+    loaded.key = key;
+    loaded.data.resize( tile_file_tile_bytes );
+
+    if ( !texture.read_tile( level, tile, &loaded.data[0] ) )
+    {
+        // unreadable tiles look like no texture at all
+        for ( int i = 0; i < count; i++ )
+        {
+            out[i] = Color3::White;
+        }
+        return;
+    }
+
+    std::lock_guard< std::mutex > lock( shard.mutex );
+    std::unordered_map< uint64_t, std::list< Tile >::iterator >::iterator
+        iter = shard.tiles.find( key );
+
+    if ( iter == shard.tiles.end() )
+    {
+        shard.lru.push_front( Tile() );
+        shard.lru.front().key = key;
+        shard.lru.front().data.swap( loaded.data );
+        iter = shard.tiles.insert( std::make_pair( key, shard.lru.begin() ) ).first;
+        shard.resident += tile_file_tile_bytes;
+
+        // the new tile is at the front, so it is never the one evicted
+        while ( shard.resident > budget / num_shards && shard.lru.size() > 1 )
+        {
+            shard.tiles.erase( shard.lru.back().key );
+            shard.lru.pop_back();
+            shard.resident -= tile_file_tile_bytes;
+            shard.evictions++;
+        }
+    }
+
+    const unsigned char* data = &iter->second->data[0];
+    for ( int i = 0; i < count; i++ )
+    {
+        out[i] = Color3( data + 4 * offsets[i] );
+    }
+}
+
+void TileCache::drop( uint32_t texture_id )
+{
+    for ( int s = 0; s < num_shards; s++ )
+    {
+        Shard& shard = shards[s];
+        std::lock_guard< std::mutex > lock( shard.mutex );
+
+        for ( std::list< Tile >::iterator i = shard.lru.begin(); i != shard.lru.end(); )
+        {
+            if ( key_texture( i->key ) == texture_id )
+            {
+                shard.tiles.erase( i->key );
+                i = shard.lru.erase( i );
+                shard.resident -= tile_file_tile_bytes;
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+}
+
+TileCacheStats TileCache::get_stats() const
+{
+    TileCacheStats stats = { 0, 0, 0, 0 };
+
+    for ( int s = 0; s < num_shards; s++ )
+    {
+        const Shard& shard = shards[s];
+        std::lock_guard< std::mutex > lock( shard.mutex );
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.evictions += shard.evictions;
+        stats.resident += shard.resident;
+    }
+
+    return stats;
+}
+
+void TileCache::reset_stats()
+{
+    for ( int s = 0; s < num_shards; s++ )
+    {
+        std::lock_guard< std::mutex > lock( shards[s].mutex );
+        shards[s].hits = 0;
+        shards[s].misses = 0;
+        shards[s].evictions = 0;
+    }
+}
+
+TileCache& get_tile_cache()
+{
+    static TileCache cache;
+    return cache;
+}
+
+StreamedTexture::StreamedTexture() : fd( -1 )
+{
+    static std::atomic< uint32_t > next_id( 0 );
+    id = next_id++ & ( ( 1 << 20 ) - 1 );
+}
+
+StreamedTexture::~StreamedTexture()
+{
+    get_tile_cache().drop( id );
+
+    if ( fd >= 0 )
+    {
+        close( fd );
+    }
+}
+
+StreamedTexture* StreamedTexture::open( const std::string& filename )
+{
+    int fd = ::open( filename.c_str(), O_RDONLY );
+    if ( fd < 0 )
+    {
+        return NULL;
+    }
+
+    StreamedTexture* texture = new StreamedTexture();
+    texture->fd = fd;
+
+    TileFileHeader header;
+    bool ok = pread( fd, &header, sizeof header, 0 ) == sizeof header &&
+              memcmp( header.magic, tile_file_magic, 4 ) == 0 &&
+              header.version == tile_file_version &&
+              header.tile_dim == tile_file_tile_dim &&
+              header.num_levels > 0 && header.num_levels <= 32;
+
+    for ( uint32_t i = 0; ok && i < header.num_levels; i++ )
+    {
+        TileFileLevel level;
+        off_t offset = sizeof header + i * sizeof level;
+        ok = pread( fd, &level, sizeof level, offset ) == sizeof level &&
+             level.width > 0 && level.height > 0;
+
+        if ( ok )
+        {
+            LevelSize size = { (int) level.width, (int) level.height };
+            texture->sizes.push_back( size );
+            texture->level_offsets.push_back( level.offset );
+            texture->level_tiles_x.push_back( level.tiles_x );
+        }
+    }
+
+    if ( !ok )
+    {
+        std::cerr << "Invalid tile file " << filename << std::endl;
+        delete texture;
+        return NULL;
+    }
+
+    return texture;
+}
+
+bool StreamedTexture::read_tile( uint32_t level, uint32_t tile, unsigned char* data ) const
+{
+    off_t offset = level_offsets[level] + (uint64_t) tile * tile_file_tile_bytes;
+    return pread( fd, data, tile_file_tile_bytes, offset ) == (ssize_t) tile_file_tile_bytes;
+}
+
+void StreamedTexture::get_rows( size_t level, unsigned char* rows ) const
+{
+    int width = sizes[level].width;
+    int height = sizes[level].height;
+    std::vector< unsigned char > data( tile_file_tile_bytes );
+
+    for ( int ty = 0; ty * tile_file_tile_dim < height; ty++ )
+    {
+        for ( int tx = 0; tx < level_tiles_x[level]; tx++ )
+        {
+            if ( !read_tile( level, ty * level_tiles_x[level] + tx, &data[0] ) )
+            {
+                memset( &data[0], 0xff, tile_file_tile_bytes );
+            }
+
+            int x0 = tx * tile_file_tile_dim;
+            int y0 = ty * tile_file_tile_dim;
+            int w = std::min( tile_file_tile_dim, width - x0 );
+            int h = std::min( tile_file_tile_dim, height - y0 );
+
+            for ( int y = 0; y < h; y++ )
+            {
+                memcpy( rows + 4 * ( ( y0 + y ) * (size_t) width + x0 ),
+                        &data[4 * y * tile_file_tile_dim], 4 * w );
+            }
+        }
+    }
+}
+
+void StreamedTexture::fetch_quad( size_t level, int x0, int y0, int x1, int y1,
+                                  Color3 texels[4] ) const
+{
+    int xs[4] = { x0, x1, x0, x1 };
+    int ys[4] = { y0, y0, y1, y1 };
+    uint32_t tiles[4];
+    int offsets[4];
+    bool done[4] = { false, false, false, false };
+
+    for ( int i = 0; i < 4; i++ )
+    {
+        tiles[i] = ( ys[i] / tile_file_tile_dim ) * level_tiles_x[level]
+                   + xs[i] / tile_file_tile_dim;
+        offsets[i] = ( ys[i] % tile_file_tile_dim ) * tile_file_tile_dim
+                     + xs[i] % tile_file_tile_dim;
+    }
+
+    // one cache lookup per distinct tile; usually all four share one
+    for ( int i = 0; i < 4; i++ )
+    {
+        if ( done[i] )
+        {
+            continue;
+        }
+
+        int which[4];
+        int tile_offsets[4];
+        int count = 0;
+
+        for ( int j = i; j < 4; j++ )
+        {
+            if ( !done[j] && tiles[j] == tiles[i] )
+            {
+                which[count] = j;
+                tile_offsets[count++] = offsets[j];
+                done[j] = true;
+            }
+        }
+
+        Color3 out[4];
+        get_tile_cache().read_texels( *this, level, tiles[i], tile_offsets, count, out );
+
+        for ( int k = 0; k < count; k++ )
+        {
+            texels[which[k]] = out[k];
+        }
+    }
+}
+
+// one level of a tile file being built from the rows of the level before it
+struct TileLevelBuilder
+{
+    TileLevelBuilder() : info(), rows_in( 0 ), pending_y( -1 ) { }
+
+    TileFileLevel info;
+    // the row of tiles being filled, as texel rows padded out to whole
+    // tiles, and how many of its rows are in
+    std::vector< unsigned char > rows;
+    int rows_in;
+    // a row waiting for the other row of its pair, and the row of the next
+    // level the two make, -1 if none
+    std::vector< unsigned char > pending;
+    int pending_y;
+};
+
+// writes a filled row of tiles of a level to its place in the file
+static bool write_tile_row( FILE* file, const TileLevelBuilder& level, uint32_t ty )
+{
+    size_t stride = 4 * (size_t) level.info.tiles_x * tile_file_tile_dim;
+    std::vector< unsigned char > tile( tile_file_tile_bytes );
+
+    if ( fseeko( file, level.info.offset + (uint64_t) ty * level.info.tiles_x
+                 * tile_file_tile_bytes, SEEK_SET ) != 0 )
+    {
+        return false;
+    }
+
+    for ( uint32_t tx = 0; tx < level.info.tiles_x; tx++ )
+    {
+        for ( int y = 0; y < tile_file_tile_dim; y++ )
+        {
+            memcpy( &tile[4 * y * tile_file_tile_dim],
+                    &level.rows[y * stride + 4 * tx * tile_file_tile_dim],
+                    4 * tile_file_tile_dim );
+        }
+
+        if ( fwrite( &tile[0], tile_file_tile_bytes, 1, file ) != 1 )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// adds row y of a level, which come in from the top of the image down, and
+// filters it into the next level once its pair is in, as MemoryTexture does
+static bool add_level_row( FILE* file, std::vector< TileLevelBuilder >& levels, size_t l,
+                           int y, const unsigned char* row )
+{
+    TileLevelBuilder& level = levels[l];
+    int width = level.info.width;
+    int height = level.info.height;
+    size_t stride = 4 * (size_t) level.info.tiles_x * tile_file_tile_dim;
+
+    // padding repeats the last row and column
+    int first = y % tile_file_tile_dim;
+    int last = y == height - 1 ? tile_file_tile_dim - 1 : first;
+    for ( int r = first; r <= last; r++ )
+    {
+        unsigned char* dst = &level.rows[r * stride];
+        memcpy( dst, row, 4 * (size_t) width );
+        for ( size_t x = width; x < stride / 4; x++ )
+        {
+            memcpy( dst + 4 * x, row + 4 * ( width - 1 ), 4 );
+        }
+    }
+
+    int ty = y / tile_file_tile_dim;
+    if ( ++level.rows_in == std::min( tile_file_tile_dim, height - ty * tile_file_tile_dim ) )
+    {
+        level.rows_in = 0;
+        if ( !write_tile_row( file, level, ty ) )
+        {
+            return false;
+        }
+    }
+
+    if ( l + 1 == levels.size() )
+    {
+        return true;
+    }
+
+    // odd sizes drop the last row or column, 1 texel wide sides average the
+    // texel with itself
+    const TileLevelBuilder& next = levels[l + 1];
+    int dst_y = y / 2;
+    const unsigned char* other = row;
+    if ( height > 1 )
+    {
+        if ( dst_y >= (int) next.info.height )
+        {
+            return true;
+        }
+        if ( level.pending_y != dst_y )
+        {
+            level.pending.assign( row, row + 4 * (size_t) width );
+            level.pending_y = dst_y;
+            return true;
+        }
+        other = &level.pending[0];
+        level.pending_y = -1;
+    }
+
+    std::vector< unsigned char > dst( 4 * (size_t) next.info.width );
+    for ( uint32_t x = 0; x < next.info.width; x++ )
+    {
+        int x0 = std::min( 2 * (int) x, width - 1 );
+        int x1 = std::min( 2 * (int) x + 1, width - 1 );
+
+        for ( int c = 0; c < 4; c++ )
+        {
+            dst[4 * x + c] = ( row[4 * x0 + c] + row[4 * x1 + c] +
+                               other[4 * x0 + c] + other[4 * x1 + c] + 2 ) / 4;
+        }
+    }
+
+    return add_level_row( file, levels, l + 1, dst_y, &dst[0] );
+}
+
+bool write_image_tile_file( const std::string& filename, const std::string& image_filename )
+{
+    int width, height;
+    ImageioPngReader* reader = imageio_png_open( image_filename.c_str(), &width, &height );
+    if ( !reader )
+    {
+        return false;
+    }
+
+    // the same levels as a MemoryTexture of the image
+    std::vector< TileLevelBuilder > levels( 1 );
+    levels[0].info.width = width;
+    levels[0].info.height = height;
+    while ( levels.back().info.width > 1 || levels.back().info.height > 1 )
+    {
+        TileLevelBuilder level;
+        level.info.width = std::max( 1u, levels.back().info.width / 2 );
+        level.info.height = std::max( 1u, levels.back().info.height / 2 );
+        levels.push_back( level );
+    }
+
+    TileFileHeader header;
+    memcpy( header.magic, tile_file_magic, 4 );
+    header.version = tile_file_version;
+    header.tile_dim = tile_file_tile_dim;
+    header.num_levels = levels.size();
+
+    uint64_t offset = sizeof header + levels.size() * sizeof( TileFileLevel );
+    std::vector< TileFileLevel > infos;
+    for ( size_t i = 0; i < levels.size(); i++ )
+    {
+        TileFileLevel& info = levels[i].info;
+        info.tiles_x = ( info.width + tile_file_tile_dim - 1 ) / tile_file_tile_dim;
+        info.tiles_y = ( info.height + tile_file_tile_dim - 1 ) / tile_file_tile_dim;
+        info.offset = offset;
+        offset += (uint64_t) info.tiles_x * info.tiles_y * tile_file_tile_bytes;
+        levels[i].rows.resize( 4 * (size_t) info.tiles_x * tile_file_tile_dim * tile_file_tile_dim );
+        infos.push_back( info );
+    }
+
+    // write under a temporary name so nobody opens a half written file
+    std::string temp = filename + ".tmp";
+    FILE* file = fopen( temp.c_str(), "wb" );
+    if ( !file )
+    {
+        imageio_png_close( reader );
+        return false;
+    }
+
+    bool ok = fwrite( &header, sizeof header, 1, file ) == 1 &&
+        fwrite( &infos[0], sizeof( TileFileLevel ), infos.size(), file ) == infos.size();
+
+    // the image is read a row of tiles at a time, the rows of a band coming
+    // from the bottom up like the framebuffer's
+    std::vector< unsigned char > band( 4 * (size_t) width * tile_file_tile_dim );
+    for ( int top = height; ok && top > 0; top -= tile_file_tile_dim )
+    {
+        int num_rows = std::min( top, tile_file_tile_dim );
+        ok = imageio_png_read_rows( reader, &band[0], num_rows );
+        for ( int i = num_rows - 1; ok && i >= 0; i-- )
+        {
+            ok = add_level_row( file, levels, 0, top - num_rows + i,
+                                &band[4 * (size_t) width * i] );
+        }
+    }
+
+    imageio_png_close( reader );
+    ok = fclose( file ) == 0 && ok;
+    ok = ok && rename( temp.c_str(), filename.c_str() ) == 0;
+
+    if ( !ok )
+    {
+        remove( temp.c_str() );
+    }
+
+    return ok;
+}
+
+std::string tile_file_name( const std::string& image_filename )
+{
+    return image_filename + ".tiles";
+}
+
+std::shared_ptr< const Texture > open_streamed_texture( const std::string& image_filename )
+{
+    std::string filename = tile_file_name( image_filename );
+    struct stat image_stat, tile_stat;
+    bool have_image = stat( image_filename.c_str(), &image_stat ) == 0;
+    bool have_tiles = stat( filename.c_str(), &tile_stat ) == 0;
+
+    // tile files are made ahead of time with -P, never while rendering
+    if ( !have_tiles || ( have_image && tile_stat.st_mtime < image_stat.st_mtime ) )
+    {
+        std::cout << "No up to date tile file " << filename << " (make it with -P), "
+                  << "loading " << image_filename << " into memory.\n";
+        return std::shared_ptr< const Texture >();
+    }
+
+    StreamedTexture* texture = StreamedTexture::open( filename );
+    if ( !texture )
+    {
+        std::cout << "Cannot read tile file " << filename << ", loading "
+                  << image_filename << " into memory.\n";
+    }
+    return std::shared_ptr< const Texture >( texture );
+}
+
+} /* _462 */
+
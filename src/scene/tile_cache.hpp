@@ -0,0 +1,158 @@
+#pragma once
+
+#include "scene/texture.hpp"
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <stdint.h>
+
+namespace _462
+{
+
+// texels per side of the tiles of a tile file; 32x32 RGBA texels are 4 KiB
+const int tile_file_tile_dim = 32;
+const size_t tile_file_tile_bytes = 4 * tile_file_tile_dim * tile_file_tile_dim;
+
+class StreamedTexture;
+
+struct TileCacheStats
+{
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    // bytes of tiles currently held
+    size_t resident;
+};
+
+/**
+ * The tiles of every streamed texture that are in memory, kept under a
+ * memory budget by evicting the least recently used ones. The tiles are
+ * spread over shards, each with its own lock, LRU list and share of the
+ * budget, so render workers sampling different tiles rarely wait on each
+ * other. Files are read without holding any lock.
+ */
+class TileCache
+{
+public:
+
+    TileCache();
+
+    /// sets the memory budget; 0 disables texture streaming
+    void set_budget( size_t bytes );
+    size_t get_budget() const { return budget; }
+    bool enabled() const { return budget > 0; }
+
+    /**
+     * Copies texels of one tile of a texture, loading the tile from the
+     * texture's file on a miss.
+     * @param offsets The texels to copy, as indices into the tile.
+     */
+    void read_texels( const StreamedTexture& texture, uint32_t level, uint32_t tile,
+                      const int* offsets, int count, Color3* out );
+
+    /// forgets the tiles of a texture that is going away
+    void drop( uint32_t texture_id );
+
+    TileCacheStats get_stats() const;
+    void reset_stats();
+
+private:
+
+    static const int num_shards = 16;
+
+    struct Tile
+    {
+        uint64_t key;
+        std::vector< unsigned char > data;
+    };
+
+    struct Shard
+    {
+        Shard() : hits( 0 ), misses( 0 ), evictions( 0 ), resident( 0 ) { }
+
+        mutable std::mutex mutex;
+        // most recently used first
+        std::list< Tile > lru;
+        std::unordered_map< uint64_t, std::list< Tile >::iterator > tiles;
+        size_t hits, misses, evictions, resident;
+    };
+
+    Shard shards[num_shards];
+    size_t budget;
+
+    // prevent copy/assignment
+    TileCache( const TileCache& );
+    TileCache& operator=( const TileCache& );
+};
+
+/// the tile cache shared by all streamed textures
+TileCache& get_tile_cache();
+
+/**
+ * A texture whose texels stay in a tile file on disk and are read a tile at
+ * a time through the tile cache as they are sampled.
+ */
+class StreamedTexture : public Texture
+{
+public:
+
+    /**
+     * Opens a tile file written by write_image_tile_file.
+     * @return null if the file can't be read.
+     */
+    static StreamedTexture* open( const std::string& filename );
+
+    virtual ~StreamedTexture();
+
+    uint32_t get_id() const { return id; }
+
+    /// reads tile_file_tile_bytes of texels of a tile straight from the file
+    bool read_tile( uint32_t level, uint32_t tile, unsigned char* data ) const;
+
+    virtual void get_rows( size_t level, unsigned char* rows ) const;
+
+protected:
+
+    virtual void fetch_quad( size_t level, int x0, int y0, int x1, int y1,
+                             Color3 texels[4] ) const;
+
+private:
+
+    StreamedTexture();
+
+    int fd;
+    // identifies the texture's tiles in the cache
+    uint32_t id;
+    // file offset of the first tile of each level, and tiles per row
+    std::vector< uint64_t > level_offsets;
+    std::vector< int > level_tiles_x;
+};
+
+/**
+ * Writes the tile file of a png image: a header, a table of levels, then
+ * the tiles of each level, one row of tiles after another and the texels of
+ * each tile row by row. It is written without ever holding the image in
+ * memory: the image is read a row of tiles at a time, and each level is
+ * filtered from the one before it as its rows come in, so only a row of
+ * tiles of each level is held. The texels match those of a MemoryTexture
+ * of the image.
+ * @return false if the image can't be read (or is interlaced) or the file
+ *  can't be written.
+ */
+bool write_image_tile_file( const std::string& filename, const std::string& image_filename );
+
+/// the tile file of an image, named after it with ".tiles" appended
+std::string tile_file_name( const std::string& image_filename );
+
+/**
+ * Opens the tile file of an image, made ahead of time by "raytracer -P".
+ * @return null if it is missing, older than the image or can't be read,
+ *  after saying so; the image is then loaded into memory instead.
+ */
+std::shared_ptr< const Texture > open_streamed_texture( const std::string& image_filename );
+
+} /* _462 */
+
@@ -4,7 +4,7 @@
 namespace _462
 {
 
-Triangle::Triangle()
+Triangle::Triangle() : uv_per_unit(0)
 {
     vertices[0].material = 0;
     vertices[1].material = 0;
@@ -43,19 +43,19 @@ void Triangle::render() const
         vertices[0].material->reset_gl_state();
 }
 
-void Triangle::intersect_packet(const Packet& packet, IsectInfo *infos, bool *intersected) const
+void Triangle::intersect_packet(const Packet& packet, HitRecord *hits, bool *intersected) const
 {
-    if (intersect_frustum(packet.frustum))
+    if (!packet.has_frustum || intersect_frustum(packet.frustum))
     {
         // TODO simd
-        for (int i = 0; i < rays_per_packet; i++)
+        for (int i = 0; i < packet.num_rays; i++)
         {
-            intersected[i] = intersected[i] || intersect_ray(packet.rays[i], infos[i]);
+            intersected[i] = intersect_ray(packet.rays[i], hits[i]) || intersected[i];
         }
     }
 }
 
-bool Triangle::intersect_ray(const Ray& ray, IsectInfo& info) const
+bool Triangle::intersect_ray(const Ray& ray, HitRecord& hit) const
 {
     Vector3 instance_eye = inverse_transform_matrix.transform_point(ray.eye);
     Vector3 instance_ray = inverse_transform_matrix.transform_vector(ray.dir);
@@ -81,7 +81,9 @@ bool Triangle::intersect_ray(const Ray& ray, IsectInfo& info) const
     float m = a * ei_minus_hf + b * gf_minus_di + c * dh_minus_eg;
     float t = -1.0 * (f * ak_minus_jb + e * jc_minus_al + d * bl_minus_kc) / m;
 
-    if (t < eps || t > info.time)
+    // on a tie the geometry that was hit first keeps the ray. written so
+    // that a nan t (ray parallel to the triangle) is rejected as well.
+    if (!(t >= eps && t < hit.time))
     {
         return false;
     }
@@ -100,6 +102,21 @@ bool Triangle::intersect_ray(const Ray& ray, IsectInfo& info) const
         return false;
     }
 
+    hit.time = t;
+    hit.geometry = id;
+    hit.primitive = 0;
+    hit.beta = beta;
+    hit.gamma = gamma;
+
+    return true;
+}
+
+void Triangle::shade(const Ray& ray, const HitRecord& hit, IsectInfo& info) const
+{
+    Vector3 instance_ray = inverse_transform_matrix.transform_vector(ray.dir);
+    float t = hit.time;
+    float beta = hit.beta;
+    float gamma = hit.gamma;
     float alpha = 1.0 - gamma - beta;
     info.time = t;
     Vector3 normal = alpha * vertices[0].normal
@@ -130,28 +147,14 @@ bool Triangle::intersect_ray(const Ray& ray, IsectInfo& info) const
     Vector2 tex_coord = alpha * vertices[0].tex_coord
                         + beta * vertices[1].tex_coord
                         + gamma * vertices[2].tex_coord;
-    double integer_coord;
-    float dec_x = modf(tex_coord.x, &integer_coord);
-    float dec_y = modf(tex_coord.y, &integer_coord);
-    int width0, width1, width2, height0, height1, height2;
-    vertices[0].material->get_texture_size(&width0, &height0);
-    vertices[1].material->get_texture_size(&width1, &height1);
-    vertices[2].material->get_texture_size(&width2, &height2);
-    float dec_x0 = dec_x * width0;
-    float dec_y0 = dec_y * height0;
-    float dec_x1 = dec_x * width1;
-    float dec_y1 = dec_y * height1;
-    float dec_x2 = dec_x * width2;
-    float dec_y2 = dec_y * height2;
-    Color3 tc0 = vertices[0].material->get_texture_pixel(dec_x0, dec_y0);
-    Color3 tc1 = vertices[1].material->get_texture_pixel(dec_x1, dec_y1);
-    Color3 tc2 = vertices[2].material->get_texture_pixel(dec_x2, dec_y2);
+    real_t footprint = texture_footprint(ray, t, info.normal, uv_per_unit);
+    Color3 tc0 = vertices[0].material->sample_texture(tex_coord, footprint);
+    Color3 tc1 = vertices[1].material->sample_texture(tex_coord, footprint);
+    Color3 tc2 = vertices[2].material->sample_texture(tex_coord, footprint);
     info.texture = alpha * tc0 + beta * tc1 + gamma * tc2;
-
-    return true;
 }
 
-bool Triangle::shadow_test(const Ray& ray) const
+bool Triangle::shadow_test(const Ray& ray, size_t*) const
 {
     Vector3 instance_eye = inverse_transform_matrix.transform_point(ray.eye);
     Vector3 instance_ray = inverse_transform_matrix.transform_vector(ray.dir);
@@ -202,7 +205,9 @@ bool Triangle::shadow_test(const Ray& ray) const
 
 void Triangle::make_bounding_volume()
 {
-    return;
+    uv_per_unit = triangle_uv_per_unit(vertices[0].position, vertices[1].position,
+                                       vertices[2].position, vertices[0].tex_coord,
+                                       vertices[1].tex_coord, vertices[2].tex_coord);
 }
 
 bool Triangle::intersect_frustum(const Frustum& frustum) const
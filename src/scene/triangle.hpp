@@ -29,14 +29,19 @@ public:
     // the triangle's vertices, in CCW order
     Vertex vertices[3];
 
+    // texture span of one world unit on the triangle, set up along with the
+    // bounding volume
+    real_t uv_per_unit;
+
     bool intersect_frustum(const Frustum& frustum) const;
 
     Triangle();
     virtual ~Triangle();
     virtual void render() const;
-    virtual void intersect_packet(const Packet& packet, IsectInfo *infos, bool *intersected) const;
-    virtual bool intersect_ray(const Ray& ray, IsectInfo& info) const;
-    virtual bool shadow_test(const Ray& ray) const;
+    virtual void intersect_packet(const Packet& packet, HitRecord *hits, bool *intersected) const;
+    virtual bool intersect_ray(const Ray& ray, HitRecord& hit) const;
+    virtual void shade(const Ray& ray, const HitRecord& hit, IsectInfo& info) const;
+    virtual bool shadow_test(const Ray& ray, size_t* primitive = NULL) const;
     virtual void make_bounding_volume();
 };
 
@@ -0,0 +1,27 @@
+#!/bin/sh
+# runs every tests/test_*.sh against the given raytracer binary, from the
+# top of the repository so the scenes find their files
+# usage: tests/run_tests.sh [raytracer]
+
+cd "$(dirname "$0")/.." || exit 1
+RAYTRACER=${1:-./raytracer}
+export RAYTRACER
+
+passed=0
+failed=0
+for test in tests/test_*.sh; do
+    TEST_DIR=$(mktemp -d) || exit 1
+    export TEST_DIR
+    if sh "$test" > "$TEST_DIR/log" 2>&1; then
+        echo "PASS $test"
+        passed=$((passed + 1))
+    else
+        echo "FAIL $test"
+        sed 's/^/    /' "$TEST_DIR/log"
+        failed=$((failed + 1))
+    fi
+    rm -rf "$TEST_DIR"
+done
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]
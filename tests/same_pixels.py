@@ -0,0 +1,81 @@
+"""Exits 0 if two png files decode to the same pixels, however they were
+compressed. Handles the 8 bit rgb and rgba images the raytracer writes.
+usage: same_pixels.py a.png b.png"""
+
+import struct
+import sys
+import zlib
+
+
+def decode(filename):
+    data = open(filename, 'rb').read()
+    if data[:8] != b'\x89PNG\r\n\x1a\n':
+        raise ValueError('%s is not a png' % filename)
+
+    pos = 8
+    idat = b''
+    while pos < len(data):
+        length, = struct.unpack('>I', data[pos:pos + 4])
+        kind = data[pos + 4:pos + 8]
+        body = data[pos + 8:pos + 8 + length]
+        if kind == b'IHDR':
+            width, height, depth, color = struct.unpack('>IIBB', body[:10])
+        elif kind == b'IDAT':
+            idat += body
+        pos += 12 + length
+
+    if depth != 8 or color not in (2, 6):
+        raise ValueError('%s is not 8 bit rgb or rgba' % filename)
+
+    raw = zlib.decompress(idat)
+    bpp = 4 if color == 6 else 3
+    stride = width * bpp
+    pixels = bytearray()
+    above = bytearray(stride)
+
+    for y in range(height):
+        start = y * (stride + 1)
+        kind = raw[start]
+        row = bytearray(raw[start + 1:start + 1 + stride])
+        for x in range(stride):
+            a = row[x - bpp] if x >= bpp else 0
+            b = above[x]
+            c = above[x - bpp] if x >= bpp else 0
+            if kind == 1:
+                row[x] = (row[x] + a) & 255
+            elif kind == 2:
+                row[x] = (row[x] + b) & 255
+            elif kind == 3:
+                row[x] = (row[x] + ((a + b) >> 1)) & 255
+            elif kind == 4:
+                p = a + b - c
+                pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+                predictor = a if pa <= pb and pa <= pc else b if pb <= pc else c
+                row[x] = (row[x] + predictor) & 255
+        pixels += row
+        above = row
+
+    return width, height, color, bytes(pixels)
+
+
+def main():
+    a = decode(sys.argv[1])
+    b = decode(sys.argv[2])
+    if a[:3] != b[:3]:
+        print('%s and %s differ in size or format' % (sys.argv[1], sys.argv[2]))
+        return 1
+
+    width = a[0]
+    bpp = 4 if a[2] == 6 else 3
+    differ = sum(1 for i in range(0, len(a[3]), bpp) if a[3][i:i + bpp] != b[3][i:i + bpp])
+    if differ:
+        first = next(i for i in range(0, len(a[3]), bpp) if a[3][i:i + bpp] != b[3][i:i + bpp])
+        pixel = first // bpp
+        print('%s and %s differ in %d pixels, the first at %d,%d'
+              % (sys.argv[1], sys.argv[2], differ, pixel % width, pixel // width))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
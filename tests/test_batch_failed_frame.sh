@@ -0,0 +1,33 @@
+#!/bin/sh
+# a frame that fails to load in the middle of a sequence must not put the
+# buffer the next frame is traced into out of step with the one being saved:
+# every frame that loads matches the same scene rendered on its own
+
+set -e
+
+cat > "$TEST_DIR/sequence" <<SEQ
+scenes/cornell_box.scene
+scenes/no_such_scene.scene
+scenes/spheres.scene
+scenes/cube.scene
+scenes/tetrahedron.scene
+SEQ
+
+# the missing frame makes the sequence fail as a whole
+if "$RAYTRACER" -b -d 640 480 -z 9 "$TEST_DIR/sequence" "$TEST_DIR/frame.png"; then
+    echo "sequence with a missing frame succeeded"
+    exit 1
+fi
+
+[ ! -e "$TEST_DIR/frame_0001.png" ]
+
+check_frame()
+{
+    "$RAYTRACER" -r -d 640 480 -z 9 "scenes/$2.scene" "$TEST_DIR/$2.png"
+    cmp "$TEST_DIR/frame_$1.png" "$TEST_DIR/$2.png"
+}
+
+check_frame 0000 cornell_box
+check_frame 0002 spheres
+check_frame 0003 cube
+check_frame 0004 tetrahedron
@@ -0,0 +1,71 @@
+#!/bin/sh
+# compiled mesh files whose counts or triangles don't fit their vertices are
+# rejected as damaged when loaded, instead of being traced out of bounds, and
+# saved hierarchies deeper than any build makes are built again
+
+set -e
+
+"$RAYTRACER" -P models/monkey.obj "$TEST_DIR/monkey.mesh"
+sed "s|models/monkey.obj|$TEST_DIR/scene.mesh|" scenes/monkey_solo.scene > "$TEST_DIR/monkey.scene"
+
+cp "$TEST_DIR/monkey.mesh" "$TEST_DIR/scene.mesh"
+"$RAYTRACER" -r -d 160 120 "$TEST_DIR/monkey.scene" "$TEST_DIR/good.png" > "$TEST_DIR/good.log"
+grep -q "Bvh loading took" "$TEST_DIR/good.log"
+
+# damage <field> writes a copy of the mesh with one field of it changed
+damage()
+{
+    python3 - "$TEST_DIR/monkey.mesh" "$TEST_DIR/scene.mesh" "$1" <<'PY'
+import struct, sys
+data = bytearray(open(sys.argv[1], 'rb').read())
+num_vertices, = struct.unpack_from('<Q', data, 24)
+# offsets of the sections follow the counts, then their sizes; the
+# triangles are the fourth section and the bvh the sixth
+triangles, = struct.unpack_from('<Q', data, 40 + 3 * 8)
+bvh, = struct.unpack_from('<Q', data, 40 + 5 * 8)
+bvh_size, = struct.unpack_from('<Q', data, 40 + 6 * 8 + 5 * 8)
+if sys.argv[3] == 'index':
+    struct.pack_into('<I', data, triangles + 12 * 100 + 4, num_vertices)
+elif sys.argv[3] == 'vertices':
+    # 24 byte positions of this many vertices take 2^64 + 24 bytes
+    struct.pack_into('<Q', data, 24, (1 << 64) // 24 + 1)
+elif sys.argv[3] == 'bvh':
+    # the same number of nodes relinked into one chain of inner nodes, each
+    # with an empty leaf on its left, ending in a leaf of every triangle
+    num_triangles, num_nodes = struct.unpack_from('<II', data, bvh)
+    nodes = bvh + 8 + (num_triangles * 4 + 7) // 8 * 8
+    node_size = (bvh + bvh_size - nodes) // num_nodes
+    boxes = bytes(data[nodes:nodes + node_size - 16])
+    for i in range(num_nodes):
+        at = nodes + i * node_size
+        if i % 2 == 0 and i + 1 < num_nodes:
+            node = boxes + struct.pack('<iiii', 0, 0, 0, 0)
+        else:
+            last = i + 1 == num_nodes
+            node = bytes(node_size - 16) + struct.pack('<iiii', 0, num_triangles if last else 0, 1, 0)
+        data[at:at + node_size] = node
+open(sys.argv[2], 'wb').write(data)
+PY
+}
+
+# reject <field> checks that a mesh damaged in that field doesn't load
+reject()
+{
+    damage "$1"
+    if "$RAYTRACER" -r -d 160 120 "$TEST_DIR/monkey.scene" "$TEST_DIR/bad.png" \
+        > "$TEST_DIR/bad.log"; then
+        echo "mesh with a damaged $1 field loaded"
+        exit 1
+    fi
+    grep -q "is damaged" "$TEST_DIR/bad.log"
+}
+
+reject index
+reject vertices
+
+# the chain is a whole tree, just far too deep; the mesh loads and its
+# hierarchy is built again
+damage bvh
+"$RAYTRACER" -r -d 160 120 "$TEST_DIR/monkey.scene" "$TEST_DIR/rebuilt.png" > "$TEST_DIR/rebuilt.log"
+grep -q "Saved bvh doesn't fit the mesh" "$TEST_DIR/rebuilt.log"
+cmp "$TEST_DIR/good.png" "$TEST_DIR/rebuilt.png"
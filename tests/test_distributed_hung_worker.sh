@@ -0,0 +1,35 @@
+#!/bin/sh
+# a worker process that stops answering (stopped here with SIGSTOP) is
+# killed once its band is past the deadline given by -W, and its band is
+# rendered again by a fresh worker, so the image still matches one traced
+# in a single process
+
+set -e
+
+"$RAYTRACER" -r -d 1600 1200 scenes/cube.scene "$TEST_DIR/single.png"
+
+"$RAYTRACER" -r -w 2 -W 1 -d 1600 1200 scenes/cube.scene "$TEST_DIR/workers.png" \
+    > "$TEST_DIR/workers.log" &
+coordinator=$!
+
+# a coordinator that waits on the stopped worker forever fails the test
+# instead of hanging it
+(sleep 60; pkill -9 -P "$coordinator"; kill -9 "$coordinator" 2> /dev/null) &
+watchdog=$!
+
+# stop the first worker as soon as it is forked
+worker=
+while [ -z "$worker" ] && kill -0 "$coordinator" 2> /dev/null; do
+    worker=$(pgrep -P "$coordinator" | head -n 1)
+done
+[ -n "$worker" ]
+kill -STOP "$worker"
+
+status=0
+wait "$coordinator" || status=$?
+kill "$watchdog" 2> /dev/null || true
+cat "$TEST_DIR/workers.log"
+[ "$status" -eq 0 ]
+
+grep -q "timed out" "$TEST_DIR/workers.log"
+cmp "$TEST_DIR/single.png" "$TEST_DIR/workers.png"
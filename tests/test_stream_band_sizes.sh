@@ -0,0 +1,26 @@
+#!/bin/sh
+# streamed renders (-R) match the image traced whole for band sizes that
+# aren't multiples of the packet size, including ones that would leave a
+# band a row high, and for image heights that aren't either
+
+set -e
+
+check_bands()
+{
+    scene=$1
+    width=$2
+    height=$3
+    shift 3
+
+    "$RAYTRACER" -r -d "$width" "$height" "scenes/$scene.scene" "$TEST_DIR/whole.png"
+    for rows in "$@"; do
+        "$RAYTRACER" -r -d "$width" "$height" -R "$rows" "scenes/$scene.scene" "$TEST_DIR/bands.png"
+        # the bands are compressed in strips of their own, so only the
+        # pixels are the same, not the bytes
+        python3 tests/same_pixels.py "$TEST_DIR/whole.png" "$TEST_DIR/bands.png"
+    done
+}
+
+check_bands cornell_box 200 150 1 7 9 17 64 1000
+check_bands cornell_box 200 145 1 9 33
+check_bands monkey 160 121 9 25
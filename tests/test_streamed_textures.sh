@@ -0,0 +1,32 @@
+#!/bin/sh
+# -M streams textures from tile files made ahead of time with -P and never
+# writes any while rendering; images without one are loaded into memory.
+# either way the image matches the one rendered without -M
+
+set -e
+
+# the scene's textures are copied, so the tile files go next to the copies
+cp images/cube.png images/tiles.png "$TEST_DIR"
+sed "s|images/|$TEST_DIR/|g" scenes/cube.scene > "$TEST_DIR/cube.scene"
+
+"$RAYTRACER" -r -d 320 240 "$TEST_DIR/cube.scene" "$TEST_DIR/memory.png"
+
+# no tile files: falls back to memory without making any
+"$RAYTRACER" -r -d 320 240 -M 1 "$TEST_DIR/cube.scene" "$TEST_DIR/fallback.png" \
+    > "$TEST_DIR/fallback.log"
+grep -q "No up to date tile file" "$TEST_DIR/fallback.log"
+[ -z "$(find "$TEST_DIR" -name '*.tiles')" ]
+cmp "$TEST_DIR/memory.png" "$TEST_DIR/fallback.png"
+
+"$RAYTRACER" -P "$TEST_DIR/cube.png"
+"$RAYTRACER" -P "$TEST_DIR/tiles.png"
+[ -f "$TEST_DIR/cube.png.tiles" ] && [ -f "$TEST_DIR/tiles.png.tiles" ]
+
+# with them, and a budget small enough to evict tiles
+"$RAYTRACER" -r -d 320 240 -M 1 "$TEST_DIR/cube.scene" "$TEST_DIR/streamed.png" \
+    > "$TEST_DIR/streamed.log"
+if grep -q "No up to date tile file" "$TEST_DIR/streamed.log"; then
+    echo "tile files were not used"
+    exit 1
+fi
+cmp "$TEST_DIR/memory.png" "$TEST_DIR/streamed.png"